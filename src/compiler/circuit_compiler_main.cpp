@@ -0,0 +1,103 @@
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+extern "C" {
+#include "hope.h"
+}
+#include "CircuitCompiler.h"
+#include "Grid.h"
+
+const char* prog_desc =
+    "Circuit compiler turns an elecSim board into native code, for the "
+    "compiled simulation engine. Boards with feedback loops, where a tile "
+    "feeds back into its own inputs, cannot be compiled.";
+const char* prog_version = "0.1";
+
+static hope_t initParser(const char* prog_name) {
+  hope_t hope = hope_init(prog_name, prog_desc);
+  hope_set_t paramSet = hope_init_set("Main");
+  hope_add_param(&paramSet, hope_init_param("-f", "Grid file to compile",
+                                            HOPE_TYPE_STRING, 1));
+  hope_add_param(&paramSet,
+                 hope_init_param("-o", "C++ source file to write",
+                                 HOPE_TYPE_STRING, 1));
+  hope_add_param(&paramSet,
+                 hope_init_param("-l",
+                                 "Also build the source into this shared "
+                                 "library, with $CXX or c++",
+                                 HOPE_TYPE_STRING, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-v", "Verbose mode: Print what was compiled",
+                                 HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+  hope_set_t helpSet = hope_init_set("Help");
+  hope_add_param(&helpSet, hope_init_param("-h", "Show this help message",
+                                           HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+
+  hope_add_set(&hope, paramSet);
+  hope_add_set(&hope, helpSet);
+  return hope;
+}
+
+int main([[maybe_unused]] int argc, char** argv) {
+  hope_t hope = initParser(argv[0]);
+
+  if (hope_parse_argv(&hope, argv))  // error occurred, print error message
+    return 1;
+  if (strcmp(hope.used_set_name, "Help") == 0) {
+    hope_print_help(&hope, stdout);
+    return 0;
+  }
+  std::string gridFile = hope_get_single_string(&hope, "-f");
+  std::string sourceFile = hope_get_single_string(&hope, "-o");
+  const char* libraryArg = hope_get_single_string(&hope, "-l");
+  std::string libraryFile = libraryArg ? libraryArg : "";
+  bool verbose = hope_get_single_switch(&hope, "-v");
+  hope_free(&hope);
+
+  if (!std::filesystem::exists(gridFile)) {
+    std::cerr << std::format("Grid file not found: {}", gridFile) << std::endl;
+    return 1;
+  }
+
+  try {
+    ElecSim::Grid grid;
+    grid.Load(gridFile);
+    const ElecSim::CircuitCompiler compiler(grid);
+
+    const auto sourceDirectory =
+        std::filesystem::path(sourceFile).parent_path();
+    if (!sourceDirectory.empty()) {
+      std::filesystem::create_directories(sourceDirectory);
+    }
+    std::ofstream source(sourceFile, std::ios::binary);
+    source << compiler.GenerateSource();
+    source.close();
+    if (!source) {
+      std::cerr << std::format("Could not write {}", sourceFile) << std::endl;
+      return 1;
+    }
+    if (verbose) {
+      std::cout << std::format(
+                       "Compiled {} of {} tiles into {} state bits with {} "
+                       "inputs: {}",
+                       compiler.GetTileCount(), grid.GetTiles().size(),
+                       compiler.GetBitCount(), compiler.GetInputCount(),
+                       sourceFile)
+                << std::endl;
+    }
+
+    if (!libraryFile.empty()) {
+      ElecSim::CircuitCompiler::BuildLibrary(sourceFile, libraryFile);
+      if (verbose) std::cout << "Built " << libraryFile << std::endl;
+    }
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -6,10 +6,13 @@
 #include "imgui.h"
 #include "imgui-SFML.h"
 
+#include <chrono>
 #include <filesystem>
 #include <format>
 #include <iostream>
 #include <ranges>
+#include <stdexcept>
+#include <string_view>
 
 static std::optional<std::string> OpenSaveDialog() {
   constexpr nfdfilteritem_t filterItem[] = {
@@ -86,6 +89,17 @@ void Game::Initialize() {
 
   textureAtlas = TileTextureAtlas(static_cast<uint32_t>(defaultZoomFactor) * 4);
   chunkManager = TileChunkManager();
+  chunkManager.SetChunkLoader([this](const ElecSim::vi2d& chunkBasePos) {
+    constexpr int chunkLength = static_cast<int>(TileChunk::CHUNK_LENGTH);
+    for (int y = 0; y < chunkLength; ++y) {
+      for (int x = 0; x < chunkLength; ++x) {
+        if (auto tile = grid.GetTile(chunkBasePos + ElecSim::vi2d(x, y))) {
+          chunkManager.SetTile(tile->get(), textureAtlas);
+        }
+      }
+    }
+  });
+  chunkManager.SetMemoryBudget(chunkMemoryBudget);
   previewRenderer.Initialize();
 
   keysHeld.Reset();
@@ -101,15 +115,51 @@ void Game::Shutdown() {
   }
 }
 
+// The simulation state is kept next to the layout, so a board picks up
+// where it was left off when it is loaded again.
+static std::string StateFilename(std::string const& gridFilename) {
+  return gridFilename + ".state";
+}
+
+// Preprocessed paths are shared by all boards and sessions, unless
+// --preprocess-cache= names another directory or none.
+static std::string DefaultPreprocessCache() {
+  std::error_code error;
+  const auto tempDirectory = std::filesystem::temp_directory_path(error);
+  if (error) return "";
+  return (tempDirectory / "elecSim" / "preprocessCache").string();
+}
+
 void Game::SaveGrid(std::string const& filename) {
+  // A full save supersedes the edit log, so start a new one from it.
+  editLog.reset();
   grid.Save(filename);
+  grid.SaveState(StateFilename(filename));
+  ElecSim::EditLog::Discard(filename);
+  editLog = std::make_unique<ElecSim::EditLog>(filename, grid);
   gridFilename = filename;
   window.setTitle(std::format("{} - {}", windowTitle, filename));
   unsavedChanges = false;
 }
 
 void Game::LoadGrid(std::string const& filename) {
+  editLog.reset();
   grid.Load(filename);
+  // Edits autosaved since the last full save. They change the layout, so
+  // the checkpoint below only applies when there were none.
+  ElecSim::EditLog::Replay(grid, filename);
+  editLog = std::make_unique<ElecSim::EditLog>(filename, grid);
+  if (std::filesystem::exists(StateFilename(filename))) {
+    // A damaged checkpoint only costs the simulation state, not the board.
+    try {
+      grid.LoadState(StateFilename(filename));
+    } catch (const std::runtime_error& error) {
+      std::cerr << std::format("Ignoring checkpoint: {}", error.what())
+                << std::endl;
+      grid.ResetSimulation();
+    }
+  }
+  journal.Clear();
   gridFilename = filename;
   window.setTitle(std::format("{} - {}", windowTitle, filename));
   ResetViews();
@@ -159,8 +209,51 @@ void Game::AttemptQuit() {
 }
 
 int Game::Run(int argc, char* argv[]) {
-  if (argc > 1) {
-    LoadGrid(argv[1]);
+  // Edits are preprocessed in the background, see UpdatePreprocessing().
+  grid.SetDeferredPreprocessing(true);
+  grid.SetPreprocessCache(DefaultPreprocessCache());
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg.starts_with("--preprocess-cache=")) {
+      grid.SetPreprocessCache(std::string(arg.substr(arg.find('=') + 1)));
+      continue;
+    }
+    const bool engineArg = arg.starts_with("--engine=");
+    if (engineArg || arg.starts_with("--cross-check=")) {
+      const auto name = arg.substr(arg.find('=') + 1);
+      const auto engine = ElecSim::ParseEngine(name);
+      if (!engine || !ElecSim::IsEngineAvailable(*engine)) {
+        std::cerr << std::format("Unknown or unavailable engine: {}", name)
+                  << std::endl;
+        return 1;
+      }
+      if (engineArg) {
+        grid.SetEngine(*engine);
+      } else {
+        crossCheckEngine = engine;
+      }
+      continue;
+    }
+    if (arg.starts_with("--circuit=")) {
+      const auto library = arg.substr(arg.find('=') + 1);
+      try {
+        grid.SetCompiledCircuit(
+            ElecSim::CompiledCircuit::Load(std::string(library)));
+      } catch (const std::runtime_error& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+      }
+      continue;
+    }
+    LoadGrid(std::string(arg));
+  }
+  // Without one, the compiled engine would silently simulate tile by tile.
+  if ((grid.GetEngine() == ElecSim::SimulationEngine::Compiled ||
+       crossCheckEngine == ElecSim::SimulationEngine::Compiled) &&
+      !grid.GetCompiledCircuit()) {
+    std::cerr << "The compiled engine needs a circuit library, see --circuit"
+              << std::endl;
+    return 1;
   }
 
   while (window.isOpen()) {
@@ -303,12 +396,28 @@ void Game::HandleInput() {
       keysHeld.SetReleased(Key::RControl);
     }
 
+    // Undo and redo
+    if ((keysHeld[Key::LControl] || keysHeld[Key::RControl]) &&
+        (keysPressed[Key::Z] || keysPressed[Key::Y])) {
+      UndoEdit(keysPressed[Key::Y]);
+      selectionActive = false;
+      keysHeld.SetReleased(Key::Z);
+      keysHeld.SetReleased(Key::Y);
+    }
+
     if (keysHeld[Key::Z]) {
       ClearBuffer();
       keysHeld.SetReleased(Key::Z);
     }
 
-    // Mouse controls
+    // Mouse controls. Everything painted or deleted in one stroke is undone
+    // as a whole.
+    if (mousePressed[Button::Left] || mousePressed[Button::Right]) {
+      journal.BeginGroup();
+    }
+    if (mouseReleased[Button::Left] || mouseReleased[Button::Right]) {
+      journal.EndGroup();
+    }
     if (mouseHeld[Button::Left] && !selectionActive) {
       PasteTiles(currentGridPos);
     }
@@ -320,6 +429,7 @@ void Game::HandleInput() {
     if (mousePressed[Button::Left]) {
       // Interact with the tile under the mouse cursor
       grid.InteractWithTile(WorldToGrid(mousePos));
+      if (referenceGrid) referenceGrid->InteractWithTile(WorldToGrid(mousePos));
       unsavedChanges = true;
     }
     // TODO: A cool thing would be to select a tile with right click and then
@@ -403,6 +513,7 @@ void Game::HandleInput() {
     paused = !paused;
     if (paused) {
       grid.ResetSimulation();
+      if (referenceGrid) referenceGrid->ResetSimulation();
     }
   }
 
@@ -581,87 +692,182 @@ void Game::CopyTiles(const ElecSim::vi2d& startIndex, const ElecSim::vi2d& endIn
 
 void Game::PasteTiles(const ElecSim::vi2d& pastePosition) {
   if (tileBuffer.empty()) return;
-  std::vector<ElecSim::GridTile*> placedTiles;
+  std::vector<std::shared_ptr<ElecSim::GridTile>> placedTiles;
+  placedTiles.reserve(tileBuffer.size());
   for (const auto& tile : tileBuffer) {
     if (std::optional oldTile = grid.GetTile(pastePosition + tile->GetPos())) {
       if ((*oldTile)->GetTileType() == tile->GetTileType()) [[unlikely]] {
         continue;
       }
     }
-    auto clonedTile = tile->Clone();
-    auto newPos = tile->GetPos() + pastePosition;
-    clonedTile->SetPos(newPos);
-    auto tilePtr = std::move(clonedTile);
-    placedTiles.push_back(tilePtr.get());
-    grid.SetTile(newPos, std::move(tilePtr));
+    std::shared_ptr<ElecSim::GridTile> clonedTile = tile->Clone();
+    clonedTile->SetPos(tile->GetPos() + pastePosition);
+    placedTiles.push_back(std::move(clonedTile));
   }
 
-  for(const auto& tile : placedTiles) {
-    chunkManager.SetTile(tile, textureAtlas);           
-  }
+  // One batch for the grid and one for the renderer, however large the paste.
+  journal.SetTiles(grid, placedTiles);
+  std::vector<const ElecSim::GridTile*> renderedTiles;
+  renderedTiles.reserve(placedTiles.size());
+  for (const auto& tile : placedTiles) renderedTiles.push_back(tile.get());
+  chunkManager.SetTiles(renderedTiles, textureAtlas);
 
-  unsavedChanges = true;
+  RecordEdit({}, placedTiles);
 }
 
 void Game::CutTiles(const ElecSim::vi2d& startIndex, const ElecSim::vi2d& endIndex) {
   // First copy the tiles to buffer
   CopyTiles(startIndex, endIndex);
 
-  // Then delete them from the grid
-  // Ensure startIndex is actually the top-left corner
-  ElecSim::vi2d topLeft = startIndex.min(endIndex);
-  ElecSim::vi2d bottomRight = startIndex.max(endIndex);
+  // Then delete them from the grid, visiting only the tiles actually there
+  const auto tilesToErase = grid.GetTilePositions(startIndex, endIndex);
+  journal.EraseTiles(grid, tilesToErase);
 
-  // Delete all tiles in the selection rectangle
-  std::vector<ElecSim::vi2d> tilesToErase;
-  
-  for (int y = topLeft.y; y <= bottomRight.y; y++) {
-    for (int x = topLeft.x; x <= bottomRight.x; x++) {
-      ElecSim::vi2d pos(x, y);
-      // Check if there's a tile at this position
-      if (grid.GetTile(pos)) {
-        tilesToErase.push_back(pos);
-        grid.EraseTile(pos);
-      }
-    }
-  }
-  
   // Erase from the chunk manager
   chunkManager.EraseTiles(tilesToErase);
-  
-  unsavedChanges = true;
+
+  RecordEdit(tilesToErase, {});
 }
 
 void Game::DeleteTiles(const ElecSim::vi2d& position) {
   // Check if there's a tile at this position
   if (grid.GetTile(position)) {
-    grid.EraseTile(position);
+    journal.EraseTiles(grid, std::array{position});
     chunkManager.EraseTile(position);
+    RecordEdit(std::array{position}, {});
   }
+}
+
+void Game::UndoEdit(bool redo) {
+  const auto change = redo ? journal.Redo(grid) : journal.Undo(grid);
+  if (!change) return;
+
+  chunkManager.EraseTiles(change->erased);
+  std::vector<const ElecSim::GridTile*> placedTiles;
+  placedTiles.reserve(change->placed.size());
+  for (const auto& tile : change->placed) placedTiles.push_back(tile.get());
+  chunkManager.SetTiles(placedTiles, textureAtlas);
 
-  unsavedChanges = true;
+  RecordEdit(change->erased, change->placed);
+}
+
+void Game::RecordEdit(
+    std::span<const ElecSim::vi2d> erased,
+    std::span<const std::shared_ptr<ElecSim::GridTile>> placed) {
+  if (!editLog) {
+    unsavedChanges = true;
+    return;
+  }
+  editLog->Append(erased, placed);
+  // Folding the log into a snapshot keeps replaying it on load cheap.
+  if (editLog->ShouldCompact()) editLog->Compact();
 }
 
 void Game::Update() {
   ImGui::SFML::Update(window, frameTimeTracker.getTime());
 
   if (!paused) lastTickElapsedTime += frameTimeTracker.getFrameTime();
+  UpdatePreprocessing();
   if (cameraVelocity != sf::Vector2f(0.f, 0.f)) {
     gridView.move(cameraVelocity);
   }
   // Simulation step
   while (!paused && lastTickElapsedTime >= (1.f / tps)) {
     lastTickElapsedTime -= (1.f / tps);
-    lastSimulationResult = grid.Simulate();
-    // Update the visual state of tiles that changed in the simulation
+    if (crossCheckEngine) {
+      CrossCheck();
+    } else {
+      lastSimulationResult = grid.Simulate();
+    }
+    // Update the visual state of tiles that changed in the simulation. Only
+    // their activation can have changed, so leave the geometry alone.
     for (const auto& change : lastSimulationResult.affectedTiles) {
       if (auto tile = grid.GetTile(change.pos)) {
-        chunkManager.SetTile(tile->get(), textureAtlas);
+        chunkManager.SetActivation(change.pos, (*tile)->GetActivation());
+      }
+    }
+    // Whole groups flip with one bulk write per chunk they cross. Their slot
+    // lists are built the first time a group changes and dropped whenever
+    // the grid hands out new group ids.
+    if (grid.GetGroupRevision() != groupRevision) {
+      chunkManager.ClearGroups();
+      groupRevision = grid.GetGroupRevision();
+    }
+    for (const auto& change : lastSimulationResult.affectedGroups) {
+      if (!chunkManager.HasGroup(change.group)) {
+        chunkManager.SetGroup(change.group, grid.GetGroupTiles(change.group));
       }
+      chunkManager.SetGroupActivation(change.group, change.newState);
     }
   }
 }
 
+void Game::CrossCheck() {
+  // Only a board reset along with the grid can keep in step with it, so
+  // edits and loaded checkpoints start both over.
+  if (!referenceGrid || referenceRevision != grid.GetEditRevision()) {
+    grid.ResetSimulation();
+    referenceGrid = grid.Fork();
+    referenceGrid->SetEngine(*crossCheckEngine);
+    referenceGrid->ResetSimulation();
+    referenceRevision = grid.GetEditRevision();
+  }
+
+  lastSimulationResult = grid.Simulate();
+  referenceGrid->Simulate();
+  const auto pos = grid.FindDivergence(*referenceGrid);
+  if (!pos) return;
+
+  auto describe = [&pos](ElecSim::Grid& board) -> std::string {
+    const auto tile = board.GetTile(*pos);
+    if (!tile) return "None";
+    return (*tile)->GetActivation() ? "active" : "inactive";
+  };
+  std::cerr << std::format("Engines diverged at tick {}, tile at {}: {} {}, "
+                           "{} {}",
+                           grid.GetCurrentTick(), *pos,
+                           ElecSim::EngineToString(grid.GetEngine()),
+                           describe(grid),
+                           ElecSim::EngineToString(referenceGrid->GetEngine()),
+                           describe(*referenceGrid))
+            << std::endl;
+  // Leave the board as it diverged for a look, and stop checking.
+  paused = true;
+  crossCheckEngine.reset();
+  referenceGrid.reset();
+}
+
+void Game::UpdatePreprocessing() {
+  // The grid steps tile by tile until then, see SetDeferredPreprocessing().
+  if (preprocessing.valid() &&
+      preprocessing.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready) {
+    // Refused if the grid was edited while the fork was being preprocessed
+    grid.AdoptPreprocessing(*preprocessing.get());
+  }
+
+  // Preprocessing mid-stroke would mostly be thrown away, so wait for the
+  // edits to pause.
+  if (grid.GetEditRevision() != lastEditRevision) {
+    lastEditRevision = grid.GetEditRevision();
+    editIdleTime = 0.f;
+    return;
+  }
+  editIdleTime += frameTimeTracker.getFrameTime();
+  if (preprocessing.valid() || !grid.NeedsPreprocessing() ||
+      editIdleTime < preprocessingDelay) {
+    return;
+  }
+
+  // The fork has tiles of its own, so editing can go on meanwhile.
+  preprocessingProgress = 0.f;
+  preprocessing = std::async(std::launch::async,
+                             [this, fork = grid.Fork()]() mutable {
+                               fork->Preprocess(&preprocessingProgress);
+                               return std::move(fork);
+                             });
+}
+
 void Game::Render() {
   window.setView(gridView);
   window.clear(sf::Color::Blue);
@@ -747,19 +953,27 @@ sf::Vector2f Game::GridToWorld(const ElecSim::vi2d& gridPos) const noexcept {
 void Game::InitChunks() {
   chunkManager.clear();
   
-  // We can't directly use UpdateTiles here because Grid::GetTiles returns a map,
-  // not a vector of unique_ptr<GridTile>. We would need to convert the data structure.
-  // For now, using the direct approach
+  // One bulk insert, so every chunk is created and set up once.
+  std::vector<const ElecSim::GridTile*> tiles;
+  tiles.reserve(grid.GetTiles().size());
   for(const auto& tile : grid.GetTiles() | std::views::values) {
-    chunkManager.SetTile(tile.get(), textureAtlas);
+    tiles.push_back(tile.get());
   }
-  
-  // TODO: Consider adding a method to Grid to get tiles as a vector of pointers,
-  // which would allow us to use the UpdateTiles method here
+  chunkManager.SetTiles(tiles, textureAtlas);
+  chunkManager.EnforceMemoryBudget();
 }
 
 // Hacky, but it does prevent storing yet another variable in the class
 static constinit int lastUpdateCount = 0;
+std::string Game::PreprocessingStatus() const {
+  if (preprocessing.valid()) {
+    return std::format("Preprocessing: {:.0f}%",
+                       preprocessingProgress.load() * 100.f);
+  }
+  return std::format("Preprocessing: {}",
+                     grid.NeedsPreprocessing() ? "Pending" : "Done");
+}
+
 void Game::RenderStatusWindow() {
   // Prepare status text data
   std::string brushName = "None";
@@ -790,7 +1004,8 @@ void Game::RenderStatusWindow() {
     std::format("Buffer: {} tiles", tileBuffer.size()),
     std::format("Selection: {}", selectionActive ? "Active" : "None"),
     std::format("Total Tiles: {}", grid.GetTileCount()),
-    std::format("Updates: {}", lastUpdateCount)
+    std::format("Updates: {}", lastUpdateCount),
+    PreprocessingStatus()
   };
 
   // Calculate maximum text width
@@ -836,6 +1051,7 @@ void Game::RenderStatusWindow() {
     ImGui::Separator();
     ImGui::Text("Total Tiles: %zu", grid.GetTileCount());
     ImGui::Text("Updates: %d", lastUpdateCount);
+    ImGui::TextUnformatted(textLines.back().c_str());
     
     // Reset font scaling
     if (scaleFactor != 1.0f) {
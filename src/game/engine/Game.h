@@ -1,10 +1,18 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <future>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <vector>
 
 #include "Drawables.h"
+#include "EditJournal.h"
+#include "EditLog.h"
 #include "Grid.h"
 #include "GridTileTypes.h"
 #include "KeyState.h"
@@ -73,6 +81,14 @@ class Game {
   Game();
   ~Game() = default;
 
+  /**
+   * @brief Runs the game until the window closes.
+   * @param argc Argument count
+   * @param argv A grid file to open, plus any of --engine=<name> to pick the
+   * simulation engine and --cross-check=<name> to run a second engine in
+   * lockstep and report the first tile they disagree on
+   * @return The exit code
+   */
   int Run(int argc, char* argv[]);
 
  private:
@@ -87,8 +103,22 @@ class Game {
   void HandleInput();
   void HandleResize(const sf::Vector2u& newSize);
   void Update();
+  /**
+   * @brief Preprocesses a fork of the grid in the background once editing
+   * has paused for a moment, and hands the result to the grid when done.
+   * Never waits for it: the grid simulates tile by tile meanwhile.
+   */
+  void UpdatePreprocessing();
+  /**
+   * @brief Steps the reference grid along with the grid and compares them,
+   * pausing on the first divergence. The reference starts over from a reset
+   * of the grid whenever the layout changed.
+   */
+  void CrossCheck();
   void Render();  
   void RenderStatusWindow();
+  // Status window line on the background preprocessing
+  [[nodiscard]] std::string PreprocessingStatus() const;
   void Shutdown();
   /**
    * @brief Aligns a world position to the nearest grid position.
@@ -149,16 +179,36 @@ class Game {
   
   void DeleteTiles(const ElecSim::vi2d& position);
 
+  /**
+   * @brief Reverts or reapplies the latest edit and updates the chunks to
+   * match.
+   * @param redo Whether to redo rather than undo
+   */
+  void UndoEdit(bool redo);
+
+  /**
+   * @brief Autosaves an edit batch to the edit log of the grid's file, or
+   * flags the changes as unsaved if the grid has no file yet.
+   * @param erased The positions that were cleared, first
+   * @param placed The tiles that were placed, after
+   */
+  void RecordEdit(std::span<const ElecSim::vi2d> erased,
+                  std::span<const std::shared_ptr<ElecSim::GridTile>> placed);
+
   // Window and rendering
   sf::RenderWindow window;
   sf::View gridView;
   constexpr static std::string_view windowTitle = "ElecSim";  // Game state
   std::string gridFilename;
   ElecSim::Grid grid;
+  ElecSim::EditJournal journal;  // Undo history of the edits made to grid
+  std::unique_ptr<ElecSim::EditLog> editLog;  // Autosave of gridFilename
   Highlighter highlighter;
 
   TileTextureAtlas textureAtlas; 
   TileChunkManager chunkManager;
+  // Chunks past this get paged out, least recently drawn first
+  static constexpr std::size_t chunkMemoryBudget = std::size_t{1} << 30;
   TilePreviewRenderer previewRenderer;  // Used for rendering tile previews
 
 
@@ -167,6 +217,20 @@ class Game {
   float tps = 8.f;  // Ticks per second for simulation
   float lastTickElapsedTime = 0.f;  // Time elapsed since last tick
   ElecSim::Grid::SimulationResult lastSimulationResult = {};  // Result of the last simulation
+  std::uint32_t groupRevision = 0;  // Grid group ids chunkManager knows about
+
+  // Lockstep comparison with another engine, see CrossCheck()
+  std::optional<ElecSim::SimulationEngine> crossCheckEngine;
+  std::unique_ptr<ElecSim::Grid> referenceGrid;
+  std::uint64_t referenceRevision = 0;  // Grid edit revision it was made at
+
+  // Background preprocessing, see UpdatePreprocessing()
+  static constexpr float preprocessingDelay = 0.5f;  // Idle seconds after an edit
+  std::uint64_t lastEditRevision = 0;  // Grid edit revision seen last frame
+  float editIdleTime = 0.f;  // Time since the grid was last edited
+  std::atomic<float> preprocessingProgress = 0.f;
+  // Declared after what the worker uses, so it is waited for first.
+  std::future<std::unique_ptr<ElecSim::Grid>> preprocessing;
 
   // Tile manipulation
   bool selectionActive = false;
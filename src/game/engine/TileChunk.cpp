@@ -1,11 +1,48 @@
 #include "TileChunk.h"
 
 #include <algorithm>
+#include <string_view>
 
 #include "Common.h"
 
 namespace Engine {
 
+namespace {
+// Hands the untransformed, chunk-local vertex position through, so that the
+// fragment shader knows which tile it is shading.
+constexpr std::string_view STATE_VERTEX_SHADER = R"(
+varying vec2 localPos;
+void main() {
+  localPos = gl_Vertex.xy;
+  gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+  gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;
+  gl_FrontColor = gl_Color;
+}
+)";
+
+// Looks the tile up in the 16x64 state texture, four tiles per texel, and
+// moves over to the active atlas cell, which takes up the atlas' bottom half.
+constexpr std::string_view STATE_FRAGMENT_SHADER = R"(
+uniform sampler2D atlas;
+uniform sampler2D states;
+varying vec2 localPos;
+void main() {
+  vec2 tile = floor(localPos);
+  vec4 texel = texture2D(states, vec2((floor(tile.x / 4.0) + 0.5) / 16.0,
+                                      (tile.y + 0.5) / 64.0));
+  float channel = mod(tile.x, 4.0);
+  float state = channel < 0.5 ? texel.r
+              : channel < 1.5 ? texel.g
+              : channel < 2.5 ? texel.b
+              : texel.a;
+  vec2 uv = gl_TexCoord[0].xy + vec2(0.0, step(0.5, state) * 0.5);
+  gl_FragColor = gl_Color * texture2D(atlas, uv);
+}
+)";
+static_assert(TileChunk::CHUNK_LENGTH == 64,
+              "The state shader hardcodes the chunk size.");
+}  // namespace
+
 TileChunk::TileChunk(sf::Vector2f worldPos, const sf::Texture* atlas)
     : texture(atlas) {
   setPosition(worldPos);
@@ -22,15 +59,77 @@ std::size_t TileChunk::SlotIndex(sf::Vector2i local) noexcept {
          static_cast<std::size_t>(local.x);
 }
 
-void TileChunk::MarkDirty(std::size_t slot) const noexcept {
-  if (slotIsDirty[slot]) return;
-  slotIsDirty[slot] = true;
-  dirtySlots.push_back(static_cast<std::uint16_t>(slot));
+std::uint16_t TileChunk::SlotOf(const ElecSim::vi2d& tilePos) noexcept {
+  return static_cast<std::uint16_t>(SlotIndex(LocalCoords(tilePos)));
+}
+
+std::array<sf::Vector2f, 4> TileChunk::TexCoords(
+    sf::IntRect textureRect) noexcept {
+  const sf::Vector2f textureTopLeft(textureRect.position);
+  const sf::Vector2f textureBottomRight(textureTopLeft +
+                                        sf::Vector2f(textureRect.size));
+  return {
+      textureTopLeft,
+      sf::Vector2f(textureBottomRight.x, textureTopLeft.y),
+      textureBottomRight,
+      sf::Vector2f(textureTopLeft.x, textureBottomRight.y),
+  };
+}
+
+void TileChunk::MarkDirty(std::size_t quad) const noexcept {
+  lodStale = true;
+  if (quadIsDirty[quad]) return;
+  quadIsDirty[quad] = true;
+  dirtyQuads.push_back(static_cast<std::uint16_t>(quad));
 }
 
 void TileChunk::ClearDirty() const noexcept {
-  for (const auto slot : dirtySlots) slotIsDirty[slot] = false;
-  dirtySlots.clear();
+  for (const auto quad : dirtyQuads) quadIsDirty[quad] = false;
+  dirtyQuads.clear();
+}
+
+std::size_t TileChunk::FindQuad(std::size_t slot) const noexcept {
+  if (dense) return slotIsOccupied[slot] ? slot : NO_QUAD;
+  const auto it = quadOfSlot.find(static_cast<std::uint16_t>(slot));
+  return it != quadOfSlot.end() ? it->second : NO_QUAD;
+}
+
+std::size_t TileChunk::AddQuad(std::size_t slot) {
+  ++tileCount;
+  slotIsOccupied[slot] = true;
+  if (!dense && tileCount > DENSE_THRESHOLD) MakeDense();
+
+  if (dense) {
+    highWaterMark = std::max(highWaterMark, slot + 1);
+    return slot;
+  }
+  const std::size_t quad = slotOfQuad.size();
+  slotOfQuad.push_back(static_cast<std::uint16_t>(slot));
+  quadOfSlot.emplace(static_cast<std::uint16_t>(slot),
+                     static_cast<std::uint16_t>(quad));
+  vertices.resize(vertices.size() + VERTICES_PER_TILE);
+  highWaterMark = slotOfQuad.size();
+  return quad;
+}
+
+void TileChunk::MakeDense() {
+  std::vector<sf::Vertex> spread(VERTEX_COUNT);
+  highWaterMark = 0;
+  for (std::size_t quad = 0; quad < slotOfQuad.size(); ++quad) {
+    const std::size_t slot = slotOfQuad[quad];
+    std::copy_n(vertices.begin() + quad * VERTICES_PER_TILE, VERTICES_PER_TILE,
+                spread.begin() + slot * VERTICES_PER_TILE);
+    highWaterMark = std::max(highWaterMark, slot + 1);
+  }
+  vertices = std::move(spread);
+  quadOfSlot = {};
+  slotOfQuad = {};
+  dense = true;
+
+  // Every quad moved, so the buffer is rebuilt from scratch on the next draw.
+  ClearDirty();
+  buffer.reset();
+  bufferQuads = 0;
 }
 
 void TileChunk::SetTile(const ElecSim::GridTile* tile,
@@ -44,26 +143,17 @@ void TileChunk::SetTile(const ElecSim::GridTile* tile,
     {{{0,1}, {0,0}, {1,0}, {1,1}}},   // 270
   }};
   static_assert(VERTICES_PER_TILE == 6);
-  static constexpr std::array<std::size_t, VERTICES_PER_TILE> TRIANGLE_ORDER = 
-    {0, 1, 3, 1, 2, 3};
-
 
   const sf::Vector2i local = LocalCoords(tile->GetPos());
   const std::size_t slot = SlotIndex(local);
-  const std::size_t baseIndex = slot * VERTICES_PER_TILE;
+  std::size_t quad = FindQuad(slot);
+  if (quad == NO_QUAD) quad = AddQuad(slot);
+  const std::size_t baseIndex = quad * VERTICES_PER_TILE;
 
   const sf::Vector2f localPos(static_cast<float>(local.x),
                               static_cast<float>(local.y));
 
-  const sf::Vector2f textureTopLeft(textureRect.position);
-  const sf::Vector2f textureBottomRight(textureTopLeft +
-                                        sf::Vector2f(textureRect.size));
-  const std::array<sf::Vector2f, 4> texCoords = {
-      textureTopLeft,
-      sf::Vector2f(textureBottomRight.x, textureTopLeft.y),
-      textureBottomRight,
-      sf::Vector2f(textureTopLeft.x, textureBottomRight.y),
-  };
+  const auto texCoords = TexCoords(textureRect);
 
   const auto corners = 
     CORNER_COORDS[static_cast<std::size_t>(tile->GetFacing())];
@@ -76,24 +166,103 @@ void TileChunk::SetTile(const ElecSim::GridTile* tile,
     v.color = sf::Color::White;
   }
 
-  highWaterMark = std::max(highWaterMark, slot + 1);
-  MarkDirty(slot);
+  MarkDirty(quad);
+  WriteState(slot, false);
+}
+
+void TileChunk::SetActivation(const ElecSim::vi2d& tilePos, bool activation) {
+  SetSlotActivation(SlotIndex(LocalCoords(tilePos)), activation);
+}
+
+void TileChunk::SetActivations(std::span<const std::uint16_t> slots,
+                               bool activation) {
+  for (const auto slot : slots) SetSlotActivation(slot, activation);
+}
+
+void TileChunk::SetSlotActivation(std::size_t slot, bool activation) {
+  if (slotIsActive[slot] == activation) return;
+  WriteState(slot, activation);
+  if (StateShader()) return;
+
+  const std::size_t quad = FindQuad(slot);
+  if (quad == NO_QUAD) return;
+
+  // No shader to pick the cell, so move the texture coordinates down to the
+  // active cell or back up. Vertex 4 sits on the bottom right corner of the
+  // cell and vertex 0 on the top left one.
+  const std::size_t baseIndex = quad * VERTICES_PER_TILE;
+  const float cellHeight = vertices[baseIndex + 4].texCoords.y -
+                           vertices[baseIndex].texCoords.y;
+  const float shift = activation ? cellHeight : -cellHeight;
+  for (std::size_t i = 0; i < VERTICES_PER_TILE; ++i) {
+    vertices[baseIndex + i].texCoords.y += shift;
+  }
+  MarkDirty(quad);
+}
+
+// Slot order is row-major, which is exactly the byte order of the RGBA state
+// texture with four tiles per texel.
+void TileChunk::WriteState(std::size_t slot, bool activation) noexcept {
+  slotIsActive[slot] = activation;
+  statePixels[slot] = activation ? 255 : 0;
+  lodStale = true;
+  const std::size_t row = slot / CHUNK_LENGTH;
+  dirtyRowBegin = std::min(dirtyRowBegin, row);
+  dirtyRowEnd = std::max(dirtyRowEnd, row + 1);
+}
+
+sf::Shader* TileChunk::StateShader() {
+  static const std::unique_ptr<sf::Shader> shader = [] {
+    std::unique_ptr<sf::Shader> loaded;
+    if (!sf::Shader::isAvailable()) return loaded;
+    loaded = std::make_unique<sf::Shader>();
+    if (!loaded->loadFromMemory(STATE_VERTEX_SHADER, STATE_FRAGMENT_SHADER)) {
+      loaded.reset();
+      return loaded;
+    }
+    loaded->setUniform("atlas", sf::Shader::CurrentTexture);
+    return loaded;
+  }();
+  return shader.get();
 }
 
 void TileChunk::EraseTile(const ElecSim::vi2d& tilePos) {
   const std::size_t slot = SlotIndex(LocalCoords(tilePos));
-  const std::size_t baseIndex = slot * VERTICES_PER_TILE;
+  const std::size_t quad = FindQuad(slot);
+  if (quad == NO_QUAD) return;
 
-  for (std::size_t i = 0; i < VERTICES_PER_TILE; ++i) {
-    vertices[baseIndex + i].color = sf::Color::Transparent;
+  --tileCount;
+  slotIsOccupied[slot] = false;
+  WriteState(slot, false);
+
+  if (dense) {
+    const std::size_t baseIndex = quad * VERTICES_PER_TILE;
+    for (std::size_t i = 0; i < VERTICES_PER_TILE; ++i) {
+      vertices[baseIndex + i].color = sf::Color::Transparent;
+    }
+    MarkDirty(quad);
+    return;
   }
 
-  MarkDirty(slot);
+  // Keep the quads packed by moving the last one into the hole.
+  const std::size_t lastQuad = slotOfQuad.size() - 1;
+  if (quad != lastQuad) {
+    std::copy_n(vertices.begin() + lastQuad * VERTICES_PER_TILE,
+                VERTICES_PER_TILE, vertices.begin() + quad * VERTICES_PER_TILE);
+    const auto movedSlot = slotOfQuad[lastQuad];
+    slotOfQuad[quad] = movedSlot;
+    quadOfSlot[movedSlot] = static_cast<std::uint16_t>(quad);
+    MarkDirty(quad);
+  }
+  slotOfQuad.pop_back();
+  quadOfSlot.erase(static_cast<std::uint16_t>(slot));
+  vertices.resize(lastQuad * VERTICES_PER_TILE);
+  highWaterMark = lastQuad;
 }
 
 void TileChunk::Sync() const {
-  // Nothing pending and the buffer already exists.
-  if (dirtySlots.empty() && buffer) return;
+  // Nothing pending and the buffer already exists and is large enough.
+  if (dirtyQuads.empty() && buffer && bufferQuads >= highWaterMark) return;
 
   if (!sf::VertexBuffer::isAvailable()) {
     // No GPU buffer support: draw() streams the CPU array instead. Drop the
@@ -102,13 +271,26 @@ void TileChunk::Sync() const {
     return;
   }
 
-  if (!buffer) {
+  if (highWaterMark == 0) {
+    ClearDirty();  // nothing to draw, so nothing to upload either
+    return;
+  }
+
+  if (!buffer || bufferQuads < highWaterMark) {
+    // Sparse chunks grow their buffer by doubling, dense ones take the whole
+    // chunk at once since they only ever get there by filling up.
+    const std::size_t quads =
+        dense ? CHUNK_TILE_COUNT
+              : std::min(CHUNK_TILE_COUNT,
+                         std::max({highWaterMark, 2 * bufferQuads,
+                                   MIN_BUFFER_QUADS}));
     auto fresh = std::make_unique<sf::VertexBuffer>(
         sf::PrimitiveType::Triangles, sf::VertexBuffer::Usage::Dynamic);
-    if (!fresh->create(VERTEX_COUNT)) return;  // retry next frame
+    if (!fresh->create(quads * VERTICES_PER_TILE)) return;  // retry next frame
     if (!fresh->update(vertices.data(), highWaterMark * VERTICES_PER_TILE, 0))
       return;
     buffer = std::move(fresh);
+    bufferQuads = quads;
     ClearDirty();  // the full upload covered everything
     return;
   }
@@ -118,7 +300,7 @@ void TileChunk::Sync() const {
   // of the chunk, but could be worth making static. 
   constexpr std::size_t FULL_UPLOAD_THRESHOLD = CHUNK_TILE_COUNT / 16; 
 
-  if(dirtySlots.size() > FULL_UPLOAD_THRESHOLD) {
+  if(dirtyQuads.size() > FULL_UPLOAD_THRESHOLD) {
     if(!buffer->update(vertices.data(), highWaterMark * VERTICES_PER_TILE, 0))
       return;
     ClearDirty();
@@ -127,18 +309,23 @@ void TileChunk::Sync() const {
 
   // Coalesce dirty tiles into contiguous runs so a row of tiles that changed
   // together becomes one upload rather than one per tile.
-  std::ranges::sort(dirtySlots);
+  std::ranges::sort(dirtyQuads);
 
   std::size_t i = 0;
-  while (i < dirtySlots.size()) {
-    const std::size_t runStart = dirtySlots[i];
+  while (i < dirtyQuads.size()) {
+    const std::size_t runStart = dirtyQuads[i];
     std::size_t runEnd = runStart + 1;
-    while (i + 1 < dirtySlots.size() && dirtySlots[i + 1] == runEnd) {
+    while (i + 1 < dirtyQuads.size() && dirtyQuads[i + 1] == runEnd) {
       ++i;
       ++runEnd;
     }
     ++i;
 
+    // Quads past the end were erased from a sparse chunk since; nothing
+    // draws them anymore.
+    runEnd = std::min(runEnd, highWaterMark);
+    if (runStart >= runEnd) continue;
+
     const std::size_t firstVertex = runStart * VERTICES_PER_TILE;
     const std::size_t count = (runEnd - runStart) * VERTICES_PER_TILE;
     if (!buffer->update(vertices.data() + firstVertex, count,
@@ -150,14 +337,82 @@ void TileChunk::Sync() const {
   ClearDirty();
 }
 
+void TileChunk::SyncStates() const {
+  if (stateTexture && dirtyRowBegin >= dirtyRowEnd) return;
+
+  if (!stateTexture) {
+    auto fresh = std::make_unique<sf::Texture>();
+    if (!fresh->resize({STATE_TEXTURE_WIDTH,
+                        static_cast<unsigned>(CHUNK_LENGTH)})) {
+      return;  // retry next frame
+    }
+    fresh->update(statePixels.data());
+    stateTexture = std::move(fresh);
+  } else {
+    // One upload for the band of rows that changed; that is a few hundred
+    // bytes even when every tile in the band flipped.
+    const auto rowCount = static_cast<unsigned>(dirtyRowEnd - dirtyRowBegin);
+    stateTexture->update(statePixels.data() + dirtyRowBegin * STATE_ROW_BYTES,
+                         {STATE_TEXTURE_WIDTH, rowCount},
+                         {0u, static_cast<unsigned>(dirtyRowBegin)});
+  }
+  dirtyRowBegin = CHUNK_LENGTH;
+  dirtyRowEnd = 0;
+}
+
+std::size_t TileChunk::MemoryUsage() const noexcept {
+  std::size_t bytes = sizeof(TileChunk);
+  bytes += vertices.capacity() * sizeof(sf::Vertex);
+  bytes += quadOfSlot.size() * sizeof(decltype(quadOfSlot)::value_type);
+  bytes += slotOfQuad.capacity() * sizeof(std::uint16_t);
+  bytes += dirtyQuads.capacity() * sizeof(std::uint16_t);
+  bytes += statePixels.capacity();
+  // GPU side, four bytes per texel.
+  bytes += bufferQuads * VERTICES_PER_TILE * sizeof(sf::Vertex);
+  if (stateTexture) bytes += STATE_TEXTURE_WIDTH * CHUNK_LENGTH * 4;
+  if (lodTexture) bytes += LOD_TEXTURE_SIZE * LOD_TEXTURE_SIZE * 4;
+  return bytes;
+}
+
+const sf::Texture* TileChunk::GetLodTexture(bool refresh) const {
+  if (refresh && lodStale) {
+    if (!lodTexture) {
+      auto fresh = std::make_unique<sf::RenderTexture>();
+      if (!fresh->resize({LOD_TEXTURE_SIZE, LOD_TEXTURE_SIZE})) return nullptr;
+      fresh->setSmooth(true);
+      constexpr float chunkWorldLength = CHUNK_LENGTH * TILE_WORLD_SIZE;
+      fresh->setView(sf::View(
+          sf::FloatRect({0.f, 0.f}, {chunkWorldLength, chunkWorldLength})));
+      lodTexture = std::move(fresh);
+    }
+    // Undo the chunk's own placement, so it lands on the texture's origin at
+    // one texel per tile.
+    sf::RenderStates states;
+    states.transform = getInverseTransform();
+    lodTexture->clear(sf::Color::Transparent);
+    lodTexture->draw(*this, states);
+    lodTexture->display();
+    lodStale = false;
+  }
+  return lodTexture ? &lodTexture->getTexture() : nullptr;
+}
+
 void TileChunk::draw(sf::RenderTarget& target, sf::RenderStates states) const {
   states.transform *= getTransform();
   states.texture = texture;
 
   Sync();
+  if (auto* shader = StateShader()) {
+    SyncStates();
+    if (stateTexture) {
+      shader->setUniform("states", *stateTexture);
+      states.shader = shader;
+    }
+  }
 
   const std::size_t vertexCount = highWaterMark * VERTICES_PER_TILE;
-  if (buffer) {
+  if (vertexCount == 0) return;
+  if (buffer && bufferQuads >= highWaterMark) {
     target.draw(*buffer, 0, vertexCount, states);
   } else {
     target.draw(vertices.data(), vertexCount, sf::PrimitiveType::Triangles,
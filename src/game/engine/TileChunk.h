@@ -1,12 +1,15 @@
 #pragma once
 
+#include <array>
 #include <bitset>
 #include <cstdint>
 #include <memory>
+#include <span>
 #include <vector>
 
 #include "GridTile.h"
 #include "SFML/Graphics.hpp"
+#include "ankerl/unordered_dense.h"
 
 namespace Engine {
 
@@ -22,23 +25,74 @@ namespace Engine {
  *
  * If sf::VertexBuffer is unavailable on the running system, drawing falls back
  * to streaming the CPU array directly, which is exactly the old behaviour.
+ *
+ * Tile activation is kept out of the vertices: every tile is textured with its
+ * inactive atlas cell, and a per-chunk state texture holding one byte per tile
+ * tells a fragment shader to sample the active cell instead. Flipping a tile
+ * therefore only re-uploads the rows of that small texture. Without shader
+ * support, activation falls back to rewriting the tile's texture coordinates.
+ *
+ * A chunk starts out sparse: only placed tiles get a quad, packed back to back
+ * in placement order, and a slot-to-quad map finds them again. Once enough of
+ * the chunk is filled in, it turns dense for good, where every slot owns the
+ * quad at its own index and the map is dropped. Either way, the vertex buffer
+ * only grows as far as the quads in use, so a chunk crossed by a single wire
+ * costs a few kilobytes rather than a full chunk's worth of vertices.
+ *
+ * For zoomed out views, the chunk can also prerender itself into a small LOD
+ * texture with one texel per tile, which is only redrawn once something in
+ * the chunk changed.
  */
 class TileChunk : public sf::Drawable, public sf::Transformable {
  public:
   TileChunk() = default;
   TileChunk(sf::Vector2f worldPos, const sf::Texture* atlas = nullptr);
 
-  /// @brief Set a tile in the chunk, using a certain part of the texture atlas.
+  /// @brief Set a tile in the chunk, using a certain part of the texture atlas
+  /// as its inactive look. The tile starts out inactive.
   void SetTile(const ElecSim::GridTile* tile, sf::IntRect textureRect);
 
+  /// @brief Switches a placed tile between the inactive and the active cell
+  /// of the atlas, which sits right below the inactive one.
+  void SetActivation(const ElecSim::vi2d& tilePos, bool activation);
+
   /// @brief Removes a tile at the given position.
   void EraseTile(const ElecSim::vi2d& tilePos);
 
+  /// @brief SetActivation() for many slots at once.
+  void SetActivations(std::span<const std::uint16_t> slots, bool activation);
+
+  /// @brief Number of tiles placed in the chunk.
+  [[nodiscard]] std::size_t TileCount() const noexcept { return tileCount; }
+  [[nodiscard]] bool Empty() const noexcept { return tileCount == 0; }
+
+  /// @brief Slot a world tile position occupies within its chunk.
+  [[nodiscard]] static std::uint16_t SlotOf(
+      const ElecSim::vi2d& tilePos) noexcept;
+
+  /// @brief The chunk prerendered at one texel per tile.
+  /// @param refresh Whether to redraw it first if the chunk changed since it
+  /// was last drawn. Pass false to get the previous content cheaply.
+  /// @return The texture, or nullptr if it was never drawn
+  [[nodiscard]] const sf::Texture* GetLodTexture(bool refresh) const;
+  /// @brief Whether the chunk changed since its LOD texture was last drawn.
+  [[nodiscard]] bool IsLodStale() const noexcept { return lodStale; }
+
+  /// @brief Rough number of bytes the chunk holds in CPU and GPU memory.
+  [[nodiscard]] std::size_t MemoryUsage() const noexcept;
+
+  /// @brief Records the frame the chunk was last drawn or prerendered in.
+  void Touch(std::uint64_t frame) noexcept { lastUsedFrame = frame; }
+  [[nodiscard]] std::uint64_t LastUsedFrame() const noexcept {
+    return lastUsedFrame;
+  }
+
   /// @brief Set the chunk texture atlas.
   inline void SetTexture(const sf::Texture* atlas) noexcept { texture = atlas; }
 
   constexpr static float TILE_WORLD_SIZE = 1.f;
   constexpr static std::size_t CHUNK_LENGTH = 64;  // Side length in tiles
+  constexpr static unsigned LOD_TEXTURE_SIZE = CHUNK_LENGTH;  // In texels
 
  private:
   constexpr static std::size_t CHUNK_TILE_COUNT = CHUNK_LENGTH * CHUNK_LENGTH;
@@ -47,12 +101,40 @@ class TileChunk : public sf::Drawable, public sf::Transformable {
       CHUNK_TILE_COUNT * VERTICES_PER_TILE;
 
   static_assert(CHUNK_TILE_COUNT <= UINT16_MAX + 1,
-                "Dirty slot indices are stored as uint16_t.");
+                "Slot and quad indices are stored as uint16_t.");
+
+  /// Past this many tiles a chunk turns dense. A sparse quad costs its six
+  /// vertices plus a map entry, so at a quarter full the sparse layout is
+  /// still well below the dense one, while dense skips the map lookups and
+  /// uploads neighbouring tiles as contiguous runs.
+  constexpr static std::size_t DENSE_THRESHOLD = CHUNK_TILE_COUNT / 4;
+  /// Smallest vertex buffer a sparse chunk creates, in quads.
+  constexpr static std::size_t MIN_BUFFER_QUADS = 16;
+  constexpr static std::size_t NO_QUAD = SIZE_MAX;
+
+  /// The state texture packs four tiles into the RGBA channels of a texel.
+  constexpr static unsigned STATE_TEXTURE_WIDTH = CHUNK_LENGTH / 4;
+  constexpr static std::size_t STATE_ROW_BYTES = CHUNK_LENGTH;
+
+  /// Corner of the tile quad each vertex of its two triangles sits on.
+  static constexpr std::array<std::size_t, VERTICES_PER_TILE> TRIANGLE_ORDER = {
+      0, 1, 3, 1, 2, 3};
 
   const sf::Texture* texture = nullptr;
 
-  /// Authoritative CPU-side copy. Always valid, always up to date.
-  std::vector<sf::Vertex> vertices = std::vector<sf::Vertex>(VERTEX_COUNT);
+  /// Authoritative CPU-side copy. Always valid, always up to date. Holds one
+  /// quad of VERTICES_PER_TILE vertices per placed tile while sparse, and one
+  /// per slot once dense.
+  std::vector<sf::Vertex> vertices;
+
+  bool dense = false;
+  /// Sparse layout only: where each placed slot's quad sits, and the reverse,
+  /// so erasing can move the last quad into the hole.
+  ankerl::unordered_dense::map<std::uint16_t, std::uint16_t> quadOfSlot;
+  std::vector<std::uint16_t> slotOfQuad;
+  /// Dense layout only: which slots hold a tile.
+  std::bitset<CHUNK_TILE_COUNT> slotIsOccupied;
+  std::size_t tileCount = 0;
 
   /// GPU mirror. Held by pointer for two reasons:
   ///   1. sf::VertexBuffer declares a copy ctor and a destructor, so it has no
@@ -61,27 +143,65 @@ class TileChunk : public sf::Drawable, public sf::Transformable {
   ///   2. It lets the buffer be created lazily, on first draw.
   /// Mutable because draw() is const but is where the sync happens.
   mutable std::unique_ptr<sf::VertexBuffer> buffer;
+  /// Quads the buffer was created with.
+  mutable std::size_t bufferQuads = 0;
 
-  /// Tile slots changed since the last upload, plus a membership bitset so the
+  /// Quads changed since the last upload, plus a membership bitset so the
   /// list stays deduplicated without a hash set.
-  mutable std::vector<std::uint16_t> dirtySlots;
-  mutable std::bitset<CHUNK_TILE_COUNT> slotIsDirty;
+  mutable std::vector<std::uint16_t> dirtyQuads;
+  mutable std::bitset<CHUNK_TILE_COUNT> quadIsDirty;
 
-  /// A marker of the highest tile slot written to. This is used so 
-  /// that the vertex buffer draw can be partial. 
+  /// Number of quads in use: the quad count while sparse, one past the
+  /// highest slot written to once dense. This is used so that the vertex
+  /// buffer draw can be partial.
   std::size_t highWaterMark = 0;
 
+  /// Activation of every slot; the state texture's pixels mirror it.
+  std::bitset<CHUNK_TILE_COUNT> slotIsActive;
+  std::vector<std::uint8_t> statePixels =
+      std::vector<std::uint8_t>(CHUNK_TILE_COUNT);
+  /// GPU mirror of statePixels, created on first draw like the buffer.
+  mutable std::unique_ptr<sf::Texture> stateTexture;
+  /// Rows of statePixels changed since the last upload, as [begin, end).
+  mutable std::size_t dirtyRowBegin = CHUNK_LENGTH;
+  mutable std::size_t dirtyRowEnd = 0;
+
+  /// Prerendered chunk for far away views, created on first use.
+  mutable std::unique_ptr<sf::RenderTexture> lodTexture;
+  mutable bool lodStale = true;
+
+  std::uint64_t lastUsedFrame = 0;
+
   /// Local tile coordinates within the chunk, correct for negative world
   /// positions.
   [[nodiscard]] static sf::Vector2i LocalCoords(
       const ElecSim::vi2d& tilePos) noexcept;
   [[nodiscard]] static std::size_t SlotIndex(sf::Vector2i local) noexcept;
 
-  void MarkDirty(std::size_t slot) const noexcept;
+  [[nodiscard]] static std::array<sf::Vector2f, 4> TexCoords(
+      sf::IntRect textureRect) noexcept;
+
+  void MarkDirty(std::size_t quad) const noexcept;
   void ClearDirty() const noexcept;
 
+  /// Quad holding a slot's tile, or NO_QUAD if the slot is empty.
+  [[nodiscard]] std::size_t FindQuad(std::size_t slot) const noexcept;
+  /// Hands out a quad for a slot that had no tile yet.
+  std::size_t AddQuad(std::size_t slot);
+  /// Spreads the packed quads out to their slots, one way.
+  void MakeDense();
+
+  void SetSlotActivation(std::size_t slot, bool activation);
+  /// Records a slot's activation in the state texture, nothing else.
+  void WriteState(std::size_t slot, bool activation) noexcept;
+
+  /// Shared by all chunks; nullptr if shaders are unavailable.
+  [[nodiscard]] static sf::Shader* StateShader();
+
   /// Push pending changes to the GPU. No-op when nothing changed.
   void Sync() const;
+  /// Same for the state texture.
+  void SyncStates() const;
 
   void draw(sf::RenderTarget& target,
             sf::RenderStates states) const final override;
@@ -1,5 +1,12 @@
 #include "TileChunkManager.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <ranges>
+#include <tuple>
+
 #include "Common.h"
 #include "Drawables.h"
 
@@ -22,30 +29,58 @@ void TileChunkManager::SetTile(const ElecSim::GridTile* tile,
       ElecSim::vi2d(AlignToChunkGrid(tilePos.x), AlignToChunkGrid(tilePos.y));
 
   if (auto it = chunks.find(chunkBasePos); it != chunks.end()) {
+    const bool wasStale = it->second.IsLodStale();
     it->second.SetTile(tile, textureRect);
+    if (!wasStale) MarkLodDirty(chunkBasePos);
+  } else if (evicted.contains(chunkBasePos)) {
+    // Paged out; the loader picks the tile up from the grid on page-in.
+    MarkLodDirty(chunkBasePos);
   } else {  // Construct new chunk if it doesn't exist yet.
     // Use the texture from the texture rect
     TileChunk newChunk(sf::Vector2f(chunkBasePos.x, chunkBasePos.y));
     newChunk.SetTile(tile, textureRect);
     chunks.emplace(chunkBasePos, std::move(newChunk));
+    AddChunkToLod(chunkBasePos);
   }
 }
 
 void TileChunkManager::SetTile(const ElecSim::GridTile* tile,
                                const TileTextureAtlas& textureAtlas) {
-  const auto texRect =
-      textureAtlas.GetTileRect(tile->GetTileType(), tile->GetActivation());
+  // Chunks always take the inactive cell, activation is drawn on top of it.
+  const auto texRect = textureAtlas.GetTileRect(tile->GetTileType(), false);
   const auto& tilePos = tile->GetPos();
   const auto chunkBasePos =
       ElecSim::vi2d(AlignToChunkGrid(tilePos.x), AlignToChunkGrid(tilePos.y));
 
   if (auto it = chunks.find(chunkBasePos); it != chunks.end()) {
+    const bool wasStale = it->second.IsLodStale();
     it->second.SetTexture(&textureAtlas.GetTexture());
     it->second.SetTile(tile, texRect);
+    it->second.SetActivation(tilePos, tile->GetActivation());
+    if (!wasStale) MarkLodDirty(chunkBasePos);
+  } else if (evicted.contains(chunkBasePos)) {
+    // Paged out; the loader picks the tile up from the grid on page-in.
+    MarkLodDirty(chunkBasePos);
   } else {  // Construct new chunk if it doesn't exist yet.
     TileChunk newChunk(sf::Vector2f(chunkBasePos.x, chunkBasePos.y), &textureAtlas.GetTexture());
     newChunk.SetTile(tile, texRect);
+    newChunk.SetActivation(tilePos, tile->GetActivation());
     chunks.emplace(chunkBasePos, std::move(newChunk));
+    AddChunkToLod(chunkBasePos);
+  }
+}
+
+void TileChunkManager::SetActivation(const ElecSim::vi2d& tilePos,
+                                     bool activation) {
+  const auto chunkBasePos =
+      ElecSim::vi2d(AlignToChunkGrid(tilePos.x), AlignToChunkGrid(tilePos.y));
+
+  if (auto it = chunks.find(chunkBasePos); it != chunks.end()) {
+    const bool wasStale = it->second.IsLodStale();
+    it->second.SetActivation(tilePos, activation);
+    if (!wasStale && it->second.IsLodStale()) MarkLodDirty(chunkBasePos);
+  } else if (evicted.contains(chunkBasePos)) {
+    MarkLodDirty(chunkBasePos);
   }
 }
 
@@ -57,12 +92,73 @@ void TileChunkManager::SetTiles(
   }
 }
 
+void TileChunkManager::SetTiles(std::span<const ElecSim::GridTile* const> tiles,
+                                const TileTextureAtlas& textureAtlas) {
+  const auto chunkBaseOf = [](const ElecSim::GridTile* tile) {
+    const auto& tilePos = tile->GetPos();
+    return ElecSim::vi2d(AlignToChunkGrid(tilePos.x),
+                         AlignToChunkGrid(tilePos.y));
+  };
+  const auto chunkOrder = [&](const ElecSim::GridTile* lhs,
+                              const ElecSim::GridTile* rhs) {
+    const auto lhsBase = chunkBaseOf(lhs);
+    const auto rhsBase = chunkBaseOf(rhs);
+    return std::tie(lhsBase.y, lhsBase.x) < std::tie(rhsBase.y, rhsBase.x);
+  };
+
+  // Stable, so that a position given twice still ends up with the last tile.
+  std::vector<const ElecSim::GridTile*> sorted(tiles.begin(), tiles.end());
+  std::ranges::stable_sort(sorted, chunkOrder);
+
+  for (auto runBegin = sorted.begin(); runBegin != sorted.end();) {
+    const auto chunkBasePos = chunkBaseOf(*runBegin);
+    const auto runEnd = std::find_if(runBegin, sorted.end(), [&](const auto* tile) {
+      return chunkBaseOf(tile) != chunkBasePos;
+    });
+
+    auto it = chunks.find(chunkBasePos);
+    bool wasStale = true;
+    if (it != chunks.end()) {
+      wasStale = it->second.IsLodStale();
+    } else if (evicted.contains(chunkBasePos)) {
+      // Paged out; the loader picks the tiles up from the grid on page-in.
+      MarkLodDirty(chunkBasePos);
+      runBegin = runEnd;
+      continue;
+    } else {
+      it = chunks.emplace(chunkBasePos,
+                          TileChunk(sf::Vector2f(chunkBasePos.x, chunkBasePos.y)))
+               .first;
+      AddChunkToLod(chunkBasePos);
+    }
+
+    auto& chunk = it->second;
+    chunk.SetTexture(&textureAtlas.GetTexture());
+    for (const auto* tile : std::ranges::subrange(runBegin, runEnd)) {
+      chunk.SetTile(tile, textureAtlas.GetTileRect(tile->GetTileType(), false));
+      chunk.SetActivation(tile->GetPos(), tile->GetActivation());
+    }
+    if (!wasStale) MarkLodDirty(chunkBasePos);
+    runBegin = runEnd;
+  }
+}
+
 void TileChunkManager::EraseTile(const ElecSim::vi2d& tilePos) {
   const auto chunkBasePos =
       ElecSim::vi2d(AlignToChunkGrid(tilePos.x), AlignToChunkGrid(tilePos.y));
 
   if (auto it = chunks.find(chunkBasePos); it != chunks.end()) {
+    const bool wasStale = it->second.IsLodStale();
     it->second.EraseTile(tilePos);
+    // Nothing left to draw, so give the chunk's memory back.
+    if (it->second.Empty()) {
+      chunks.erase(it);
+      RemoveChunkFromLod(chunkBasePos);
+    } else if (!wasStale && it->second.IsLodStale()) {
+      MarkLodDirty(chunkBasePos);
+    }
+  } else if (evicted.contains(chunkBasePos)) {
+    MarkLodDirty(chunkBasePos);
   }
 }
 
@@ -74,42 +170,359 @@ void TileChunkManager::EraseTiles(
   }
 }
 
-bool TileChunkManager::IsChunkVisible(const sf::Vector2f& chunkWorldPos, const sf::View& view) const {
-  // Get view bounds in world coordinates
+void TileChunkManager::SetGroup(
+    ElecSim::GroupId group,
+    const std::vector<std::shared_ptr<ElecSim::GridTile>>& tiles) {
+  std::vector<GroupSlots> groupSlots;
+  for (const auto& tile : tiles) {
+    const auto& tilePos = tile->GetPos();
+    const auto chunkBasePos =
+        ElecSim::vi2d(AlignToChunkGrid(tilePos.x), AlignToChunkGrid(tilePos.y));
+    // Groups are wire networks in practice, so they cross few chunks and
+    // this list stays short.
+    auto it = std::ranges::find_if(groupSlots, [&](const GroupSlots& run) {
+      return run.chunkPos == chunkBasePos;
+    });
+    if (it == groupSlots.end()) {
+      groupSlots.push_back({chunkBasePos, {}});
+      it = std::prev(groupSlots.end());
+    }
+    it->slots.push_back(TileChunk::SlotOf(tilePos));
+  }
+  groups.insert_or_assign(group, std::move(groupSlots));
+}
+
+void TileChunkManager::SetGroupActivation(ElecSim::GroupId group,
+                                          bool activation) {
+  auto groupIt = groups.find(group);
+  if (groupIt == groups.end()) return;
+  for (const auto& run : groupIt->second) {
+    if (auto it = chunks.find(run.chunkPos); it != chunks.end()) {
+      const bool wasStale = it->second.IsLodStale();
+      it->second.SetActivations(run.slots, activation);
+      if (!wasStale && it->second.IsLodStale()) MarkLodDirty(run.chunkPos);
+    } else if (evicted.contains(run.chunkPos)) {
+      MarkLodDirty(run.chunkPos);
+    }
+  }
+}
+
+TileChunkManager::ChunkRange TileChunkManager::VisibleRange(
+    const sf::View& view, float cellWorldLength) noexcept {
   const sf::Vector2f viewCenter = view.getCenter();
   const sf::Vector2f viewSize = view.getSize();
   const sf::Vector2f viewTopLeft = viewCenter - viewSize * 0.5f;
   const sf::Vector2f viewBottomRight = viewCenter + viewSize * 0.5f;
-  
-  // Calculate chunk bounds
-  const sf::Vector2f chunkSize(TileChunk::CHUNK_LENGTH * TileChunk::TILE_WORLD_SIZE,
-                               TileChunk::CHUNK_LENGTH * TileChunk::TILE_WORLD_SIZE);
-  const sf::Vector2f chunkBottomRight = chunkWorldPos + chunkSize;
-  
-  // Check for intersection (AABB collision detection)
-  return !(chunkWorldPos.x >= viewBottomRight.x || 
-           chunkBottomRight.x <= viewTopLeft.x ||
-           chunkWorldPos.y >= viewBottomRight.y || 
-           chunkBottomRight.y <= viewTopLeft.y);
+
+  // A cell is visible if it overlaps the view with a non-zero area, so the
+  // last cell is the one holding the point just before the bottom right
+  // corner, not the corner itself.
+  const auto first = [&](float edge) {
+    return static_cast<int>(std::floor(edge / cellWorldLength));
+  };
+  const auto last = [&](float edge) {
+    return static_cast<int>(std::ceil(edge / cellWorldLength)) - 1;
+  };
+  return {{first(viewTopLeft.x), first(viewTopLeft.y)},
+          {last(viewBottomRight.x), last(viewBottomRight.y)}};
+}
+
+template <typename Map, typename Visit>
+void TileChunkManager::ForEachInRange(Map& map, ChunkRange range,
+                                      int keyScale, Visit&& visit) {
+  // Works for sets as well as maps.
+  const auto keyOf = [](const auto& entry) -> const ElecSim::vi2d& {
+    if constexpr (requires { entry.first; }) {
+      return entry.first;
+    } else {
+      return entry;
+    }
+  };
+
+  const auto [first, last] = range;
+  if (last.x < first.x || last.y < first.y) return;
+
+  const auto columns = static_cast<std::size_t>(last.x - first.x) + 1;
+  const auto rows = static_cast<std::size_t>(last.y - first.y) + 1;
+
+  // Zoomed out past the board, there are fewer entries than positions in
+  // view, and walking the map is the cheaper way to find the visible ones.
+  if (columns * rows > map.size()) {
+    for (auto& entry : map) {
+      const ElecSim::vi2d index = keyOf(entry) / keyScale;
+      if (index.x >= first.x && index.x <= last.x && index.y >= first.y &&
+          index.y <= last.y) {
+        visit(index, entry);
+      }
+    }
+    return;
+  }
+
+  // Otherwise only the positions in view are probed, whatever the size of
+  // the rest of the board.
+  for (int y = first.y; y <= last.y; ++y) {
+    for (int x = first.x; x <= last.x; ++x) {
+      const ElecSim::vi2d index(x, y);
+      if (auto it = map.find(index * keyScale); it != map.end()) {
+        visit(index, *it);
+      }
+    }
+  }
 }
 
 void TileChunkManager::RenderVisibleChunks(sf::RenderTarget& target, sf::RenderStates states,
-                                          const sf::View& view, [[maybe_unused]] const sf::Texture* texture) const {
+                                          const sf::View& view, [[maybe_unused]] const sf::Texture* texture) {
   // Don't override states.texture here since TileChunk manages its own texture
   // The texture parameter is kept for future use or if chunks don't have texture set
+  constexpr float chunkWorldLength =
+      TileChunk::CHUNK_LENGTH * TileChunk::TILE_WORLD_SIZE;
+  constexpr int chunkLength = static_cast<int>(TileChunk::CHUNK_LENGTH);
+
+  ++frame;
+  const std::size_t level = LodLevelFor(target, view);
+  if (level <= 1) {
+    PageIn(VisibleRange(view, chunkWorldLength));
+  }
+
+  if (level == 0) {
+    ForEachInRange(chunks, VisibleRange(view, chunkWorldLength), chunkLength,
+                   [&](ElecSim::vi2d, auto& entry) {
+                     entry.second.Touch(frame);
+                     target.draw(entry.second, states);
+                   });
+  } else {
+    // Far out: one textured quad per chunk or super-chunk.
+    const float cellWorldLength =
+        chunkWorldLength * static_cast<float>(LodSpan(level));
+    std::size_t budget = LOD_REFRESH_BUDGET;
+    const auto drawCell = [&](ElecSim::vi2d index) {
+      if (const auto* lod = RefreshLod(level, index, budget).texture) {
+        DrawLodQuad(target, states, *lod,
+                    sf::FloatRect({index.x * cellWorldLength,
+                                   index.y * cellWorldLength},
+                                  {cellWorldLength, cellWorldLength}));
+      }
+    };
+    const auto range = VisibleRange(view, cellWorldLength);
+    if (level == 1) {
+      ForEachInRange(chunks, range, chunkLength,
+                     [&](ElecSim::vi2d index, const auto&) { drawCell(index); });
+    } else {
+      ForEachInRange(lodLevels[level], range, 1,
+                     [&](ElecSim::vi2d index, const auto&) { drawCell(index); });
+    }
+  }
+
+  if (frame % PAGING_INTERVAL == 0) EnforceMemoryBudget();
+}
+
+void TileChunkManager::EnforceMemoryBudget() {
+  std::size_t total = 0;
+  std::vector<std::pair<std::uint64_t, ElecSim::vi2d>> candidates;
+  std::vector<ElecSim::vi2d> empty;
   for (const auto& [chunkPos, chunk] : chunks) {
-    const sf::Vector2f chunkWorldPos(static_cast<float>(chunkPos.x), static_cast<float>(chunkPos.y));
-    
-    if (IsChunkVisible(chunkWorldPos, view)) {
-      target.draw(chunk, states);
+    if (chunk.Empty()) {
+      empty.push_back(chunkPos);
+      continue;
+    }
+    total += chunk.MemoryUsage();
+    if (chunk.LastUsedFrame() != frame) {
+      candidates.emplace_back(chunk.LastUsedFrame(), chunkPos);
+    }
+  }
+
+  // Paged in from an area that was cleared meanwhile.
+  for (const auto& chunkPos : empty) {
+    chunks.erase(chunkPos);
+    RemoveChunkFromLod(chunkPos);
+  }
+
+  if (!loader || total <= memoryBudget) return;
+
+  // Least recently used first. Chunks on screen this frame are never paged
+  // out, even if that means going over the budget.
+  std::ranges::sort(candidates);
+  for (const auto& [lastUsed, chunkPos] : candidates) {
+    if (total <= memoryBudget) break;
+    auto it = chunks.find(chunkPos);
+    total -= it->second.MemoryUsage();
+    chunks.erase(it);
+    evicted.insert(chunkPos);
+  }
+}
+
+void TileChunkManager::PageIn(ChunkRange range) {
+  if (evicted.empty()) return;
+  constexpr int chunkLength = static_cast<int>(TileChunk::CHUNK_LENGTH);
+
+  std::vector<ElecSim::vi2d> due;
+  ForEachInRange(evicted, range, chunkLength,
+                 [&](ElecSim::vi2d, const ElecSim::vi2d& chunkBasePos) {
+                   if (due.size() < PAGE_IN_BUDGET) due.push_back(chunkBasePos);
+                 });
+  for (const auto& chunkBasePos : due) PageIn(chunkBasePos);
+}
+
+// The chunk keeps its place in the LOD tree while paged out, so it is put
+// back directly rather than through SetTile's new chunk path. If the area was
+// cleared meanwhile, it comes back empty and the next paging pass drops it;
+// doing that here could pull LOD nodes out from under RefreshLod.
+void TileChunkManager::PageIn(const ElecSim::vi2d& chunkBasePos) {
+  if (evicted.erase(chunkBasePos) == 0) return;
+  auto [it, _] = chunks.emplace(
+      chunkBasePos, TileChunk(sf::Vector2f(chunkBasePos.x, chunkBasePos.y)));
+  it->second.Touch(frame);
+  loader(chunkBasePos);
+}
+
+std::size_t TileChunkManager::LodLevelFor(const sf::RenderTarget& target,
+                                          const sf::View& view) noexcept {
+  const float viewWidth = view.getSize().x;
+  if (viewWidth <= 0.f) return 0;
+  const float pixelsPerTile = static_cast<float>(target.getSize().x) *
+                              view.getViewport().size.x / viewWidth *
+                              TileChunk::TILE_WORLD_SIZE;
+  if (pixelsPerTile >= LOD_MIN_TILE_PIXELS) return 0;
+
+  // Go up until a texel of the level's textures covers at least a pixel.
+  // Every cell then spans LOD_TEXTURE_SIZE pixels or more, which caps the
+  // number of cells on screen no matter how large the board is.
+  std::size_t level = 1;
+  float texelPixels = pixelsPerTile;
+  while (level < MAX_LOD_LEVEL && texelPixels < 1.f) {
+    ++level;
+    texelPixels *= LOD_FANOUT;
+  }
+  return level;
+}
+
+int TileChunkManager::LodSpan(std::size_t level) noexcept {
+  int span = 1;
+  for (std::size_t i = 1; i < level; ++i) span *= LOD_FANOUT;
+  return span;
+}
+
+ElecSim::vi2d TileChunkManager::LodNodeIndex(const ElecSim::vi2d& chunkBasePos,
+                                             std::size_t level) noexcept {
+  const int span =
+      LodSpan(level) * static_cast<int>(TileChunk::CHUNK_LENGTH);
+  const auto floorDiv = [span](int pos) {
+    const auto [quot, rem] = std::div(pos, span);
+    return quot - (rem < 0);
+  };
+  return {floorDiv(chunkBasePos.x), floorDiv(chunkBasePos.y)};
+}
+
+void TileChunkManager::AddChunkToLod(const ElecSim::vi2d& chunkBasePos) {
+  for (std::size_t level = 2; level <= MAX_LOD_LEVEL; ++level) {
+    auto& node = lodLevels[level][LodNodeIndex(chunkBasePos, level)];
+    ++node.chunkCount;
+    node.dirty = true;
+  }
+}
+
+void TileChunkManager::RemoveChunkFromLod(const ElecSim::vi2d& chunkBasePos) {
+  for (std::size_t level = 2; level <= MAX_LOD_LEVEL; ++level) {
+    auto it = lodLevels[level].find(LodNodeIndex(chunkBasePos, level));
+    if (it == lodLevels[level].end()) continue;
+    if (--it->second.chunkCount == 0) {
+      lodLevels[level].erase(it);
+    } else {
+      it->second.dirty = true;
+    }
+  }
+}
+
+// A dirty node always has dirty ancestors: nodes are only cleaned by
+// RefreshLod, which refreshes the children first and leaves the node dirty if
+// any of them could not be. So the walk can stop at the first dirty node.
+void TileChunkManager::MarkLodDirty(const ElecSim::vi2d& chunkBasePos) {
+  for (std::size_t level = 2; level <= MAX_LOD_LEVEL; ++level) {
+    auto it = lodLevels[level].find(LodNodeIndex(chunkBasePos, level));
+    if (it == lodLevels[level].end() || it->second.dirty) return;
+    it->second.dirty = true;
+  }
+}
+
+TileChunkManager::LodTexture TileChunkManager::RefreshLod(
+    std::size_t level, const ElecSim::vi2d& index, std::size_t& budget) {
+  if (level == 1) {
+    const ElecSim::vi2d chunkBasePos =
+        index * static_cast<int>(TileChunk::CHUNK_LENGTH);
+    if (budget > 0 && evicted.contains(chunkBasePos)) {
+      --budget;
+      PageIn(chunkBasePos);
+    }
+    auto it = chunks.find(chunkBasePos);
+    if (it == chunks.end()) {
+      return {nullptr, !evicted.contains(chunkBasePos)};
     }
+    auto& chunk = it->second;
+    chunk.Touch(frame);
+    const bool refresh = chunk.IsLodStale() && budget > 0;
+    if (refresh) --budget;
+    const auto* lod = chunk.GetLodTexture(refresh);
+    return {lod, !chunk.IsLodStale()};
+  }
+
+  auto it = lodLevels[level].find(index);
+  if (it == lodLevels[level].end()) return {nullptr, true};
+  auto& node = it->second;
+  if (!node.dirty || budget == 0) {
+    return {node.texture ? &node.texture->getTexture() : nullptr, !node.dirty};
+  }
+  --budget;
+
+  if (!node.texture) {
+    auto fresh = std::make_unique<sf::RenderTexture>();
+    if (!fresh->resize({TileChunk::LOD_TEXTURE_SIZE, TileChunk::LOD_TEXTURE_SIZE}))
+      return {nullptr, false};
+    fresh->setSmooth(true);
+    node.texture = std::move(fresh);
   }
+
+  // Children live one level down, in a different map, so node stays valid.
+  constexpr float childSize =
+      static_cast<float>(TileChunk::LOD_TEXTURE_SIZE) / LOD_FANOUT;
+  bool current = true;
+  node.texture->clear(sf::Color::Transparent);
+  for (int y = 0; y < LOD_FANOUT; ++y) {
+    for (int x = 0; x < LOD_FANOUT; ++x) {
+      const auto child =
+          RefreshLod(level - 1, index * LOD_FANOUT + ElecSim::vi2d(x, y), budget);
+      current = current && child.current;
+      if (child.texture) {
+        DrawLodQuad(*node.texture, sf::RenderStates::Default, *child.texture,
+                    sf::FloatRect({x * childSize, y * childSize},
+                                  {childSize, childSize}));
+      }
+    }
+  }
+  node.texture->display();
+  node.dirty = !current;
+  return {&node.texture->getTexture(), current};
+}
+
+void TileChunkManager::DrawLodQuad(sf::RenderTarget& target,
+                                   sf::RenderStates states,
+                                   const sf::Texture& texture,
+                                   const sf::FloatRect& area) {
+  const sf::Vector2f texSize(texture.getSize());
+  const sf::Vector2f topLeft = area.position;
+  const sf::Vector2f bottomRight = area.position + area.size;
+  const std::array<sf::Vertex, 4> quad = {{
+      {topLeft, sf::Color::White, {0.f, 0.f}},
+      {{bottomRight.x, topLeft.y}, sf::Color::White, {texSize.x, 0.f}},
+      {{topLeft.x, bottomRight.y}, sf::Color::White, {0.f, texSize.y}},
+      {bottomRight, sf::Color::White, texSize},
+  }};
+  states.texture = &texture;
+  target.draw(quad.data(), quad.size(), sf::PrimitiveType::TriangleStrip,
+              states);
 }
 
-// TODO: Consider adding a memory management strategy for chunks:
-// 1. Unload distant chunks when memory pressure is high
-// 2. Only keep actively modified chunks in memory
-// 3. Implement chunk serialization for very large grids
-// 4. Add spatial indexing (e.g., quadtree) for faster visibility queries with many chunks
+// TODO: Paged out chunks are rebuilt from the grid, which keeps the whole
+// board in memory on the simulation side. Chunk serialization would let very
+// large grids page out completely.
 
 }  // namespace Engine
\ No newline at end of file
@@ -1,4 +1,10 @@
 #pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+
 #include "TileChunk.h"
 #include "ankerl/unordered_dense.h"
 #include "Drawables.h"
@@ -10,7 +16,20 @@ namespace Engine {
  * 
  * The TileChunkManager is responsible for organizing tiles into chunks based on their positions,
  * which allows for efficient rendering by only drawing visible chunks. It provides frustum culling
- * to render only chunks visible in the current view.
+ * to render only chunks visible in the current view. Visible chunks are looked up by their
+ * position rather than by testing every chunk, so the cost of a frame does not depend on how
+ * much of the board lies outside the view.
+ *
+ * Zoomed far out, drawing every tile stops paying off, so chunks are drawn as
+ * single quads textured with a prerendered image of the chunk instead. Further
+ * out still, super-chunks take over: each aggregates LOD_FANOUT x LOD_FANOUT
+ * cells of the level below into one texture of its own, so the number of
+ * quads per frame stays bounded at any zoom. All of these textures are only
+ * redrawn once something in them changed, and only so many per frame.
+ *
+ * Given a chunk loader and a memory budget, chunks that have not been on
+ * screen for the longest time are paged out whenever the budget is exceeded,
+ * and rebuilt through the loader from the grid once they are needed again.
  * 
  * This class provides methods to add, update, and remove tiles from the appropriate chunks,
  * abstracting away the chunk management logic from the client code. Tiles can be added either
@@ -39,6 +58,14 @@ class TileChunkManager {
    * @param textureAtlas Reference to the texture atlas for getting the texture rect
    */
   void SetTile(const ElecSim::GridTile* tile, const TileTextureAtlas& textureAtlas);
+
+  /**
+   * @brief Shows a placed tile as active or inactive. Only touches the chunk's
+   * state texture, the tile's geometry stays as it is.
+   * @param tilePos Position of the tile
+   * @param activation The tile's activation
+   */
+  void SetActivation(const ElecSim::vi2d& tilePos, bool activation);
   /**
    * @brief Sets many tiles in the correct chunks.
    * @param tiles Vector of tile-texture rectangle pairs
@@ -46,12 +73,68 @@ class TileChunkManager {
   void SetTiles(
       const std::vector<std::pair<const ElecSim::GridTile*, const sf::IntRect>>&
           tiles);
+  /**
+   * @brief Sets many tiles using the texture atlas, chunk by chunk: each
+   * chunk is looked up, created and flagged for LOD redraw once per batch
+   * rather than once per tile.
+   * @param tiles The tiles to add
+   * @param textureAtlas Reference to the texture atlas for getting the texture rects
+   */
+  void SetTiles(std::span<const ElecSim::GridTile* const> tiles,
+                const TileTextureAtlas& textureAtlas);
           
   void EraseTile(const ElecSim::vi2d& tilePos);
   void EraseTiles(const std::vector<ElecSim::vi2d>& tilePositions);
   void clear() noexcept {
     chunks.clear();
+    groups.clear();
+    for (auto& level : lodLevels) level.clear();
+    evicted.clear();
+  }
+
+  /// Rebuilds a paged out chunk by calling SetTile() for every tile in it.
+  using ChunkLoader = std::function<void(const ElecSim::vi2d& chunkBasePos)>;
+
+  /**
+   * @brief Enables paging. Without a loader, chunks are never paged out.
+   * @param chunkLoader Called with a chunk's base position to rebuild it
+   */
+  void SetChunkLoader(ChunkLoader chunkLoader) {
+    loader = std::move(chunkLoader);
+  }
+  /**
+   * @brief Sets how much memory chunks may take before the least recently
+   * drawn ones are paged out. Unlimited by default.
+   * @param bytes The budget, counting CPU and GPU memory alike
+   */
+  void SetMemoryBudget(std::size_t bytes) noexcept { memoryBudget = bytes; }
+  /**
+   * @brief Pages out least recently drawn chunks until the budget is met, and
+   * drops chunks that turned out empty on page-in. Called every
+   * PAGING_INTERVAL frames by RenderVisibleChunks().
+   */
+  void EnforceMemoryBudget();
+
+  /**
+   * @brief Precomputes which chunk slots a simulation group covers, so the
+   * whole group can be recoloured with SetGroupActivation().
+   * @param group Id of the group
+   * @param tiles The group's tiles, as given by ElecSim::Grid::GetGroupTiles
+   */
+  void SetGroup(ElecSim::GroupId group,
+                const std::vector<std::shared_ptr<ElecSim::GridTile>>& tiles);
+  [[nodiscard]] bool HasGroup(ElecSim::GroupId group) const noexcept {
+    return groups.contains(group);
   }
+  /**
+   * @brief Recolours every tile of a group registered with SetGroup(), with
+   * one bulk write per chunk the group covers.
+   * @param group Id of the group
+   * @param activation The group's new activation
+   */
+  void SetGroupActivation(ElecSim::GroupId group, bool activation);
+  /// @brief Forgets all groups, e.g. after the grid reassigned group ids.
+  void ClearGroups() noexcept { groups.clear(); }
 
   /**
    * @brief Render all chunks visible within the given view frustum.
@@ -61,7 +144,7 @@ class TileChunkManager {
    * @param texture Texture atlas to use for rendering
    */
   void RenderVisibleChunks(sf::RenderTarget& target, sf::RenderStates states, 
-                          const sf::View& view, const sf::Texture* texture) const;
+                          const sf::View& view, const sf::Texture* texture);
 
   /**
    * @brief Get all chunks for manual rendering (without culling).
@@ -74,13 +157,105 @@ class TileChunkManager {
                                                 ElecSim::PositionHash>;
   ChunkMap chunks;
 
+  struct GroupSlots {
+    ElecSim::vi2d chunkPos;
+    std::vector<std::uint16_t> slots;
+  };
+  ankerl::unordered_dense::map<ElecSim::GroupId, std::vector<GroupSlots>>
+      groups;
+
+  /// Levels of detail: 0 draws tiles, 1 draws one quad per chunk, and every
+  /// level above draws super-chunks made of LOD_FANOUT x LOD_FANOUT cells of
+  /// the level below.
+  constexpr static std::size_t MAX_LOD_LEVEL = 8;
+  constexpr static int LOD_FANOUT = 4;
+  /// Below this many screen pixels per tile, tiles are no longer drawn one by
+  /// one.
+  constexpr static float LOD_MIN_TILE_PIXELS = 2.f;
+  /// LOD textures redrawn per frame at most. The rest keep showing their old
+  /// content for a few more frames, so frame time stays bounded even while
+  /// the whole board changes.
+  constexpr static std::size_t LOD_REFRESH_BUDGET = 64;
+
+  struct LodNode {
+    std::size_t chunkCount = 0;  // Chunks within the super-chunk
+    bool dirty = true;           // Texture is out of date
+    std::unique_ptr<sf::RenderTexture> texture;  // Created on first use
+  };
+  using LodLevel = ankerl::unordered_dense::map<ElecSim::vi2d, LodNode,
+                                                ElecSim::PositionHash>;
+  /// Super-chunks by level, keyed by index; levels 0 and 1 stay empty.
+  std::array<LodLevel, MAX_LOD_LEVEL + 1> lodLevels;
+
+  /// Frames between two paging passes.
+  constexpr static std::uint64_t PAGING_INTERVAL = 60;
+  /// Chunks paged back in per frame at most, on top of LOD_REFRESH_BUDGET.
+  constexpr static std::size_t PAGE_IN_BUDGET = 16;
+
+  ChunkLoader loader;
+  std::size_t memoryBudget = SIZE_MAX;
+  /// Base positions of paged out chunks. They still count as chunks of the
+  /// LOD tree, their super-chunks' textures keep showing them.
+  ankerl::unordered_dense::set<ElecSim::vi2d, ElecSim::PositionHash> evicted;
+  std::uint64_t frame = 0;  // Frames rendered, for least recently used order
+
+  struct LodTexture {
+    const sf::Texture* texture;  // nullptr if never drawn
+    bool current;                // Whether it shows the latest content
+  };
+
+  /// Inclusive range of cell indices (cell position divided by the cell
+  /// length) overlapping a view.
+  struct ChunkRange {
+    ElecSim::vi2d first;
+    ElecSim::vi2d last;
+  };
+
   /**
-   * @brief Check if a chunk at the given world position is visible in the view.
-   * @param chunkWorldPos World position of the chunk
+   * @brief Computes which cells of a square grid the view rectangle covers.
    * @param view The current view
-   * @return True if the chunk intersects with the view bounds
+   * @param cellWorldLength Side length of a cell in world units
+   * @return The covered range; empty if the view has no area
    */
-  bool IsChunkVisible(const sf::Vector2f& chunkWorldPos, const sf::View& view) const;
+  [[nodiscard]] static ChunkRange VisibleRange(const sf::View& view,
+                                               float cellWorldLength) noexcept;
+
+  /// Calls visit(index, value) for every entry of a map whose key, divided by
+  /// keyScale, lies in range. Probes the range or walks the map, whichever
+  /// takes fewer steps.
+  template <typename Map, typename Visit>
+  static void ForEachInRange(Map& map, ChunkRange range, int keyScale,
+                             Visit&& visit);
+
+  /// Level of detail to draw a view at, see MAX_LOD_LEVEL.
+  [[nodiscard]] static std::size_t LodLevelFor(const sf::RenderTarget& target,
+                                               const sf::View& view) noexcept;
+  /// Side length of a level's cells, in chunks.
+  [[nodiscard]] static int LodSpan(std::size_t level) noexcept;
+  [[nodiscard]] static ElecSim::vi2d LodNodeIndex(
+      const ElecSim::vi2d& chunkBasePos, std::size_t level) noexcept;
+
+  void AddChunkToLod(const ElecSim::vi2d& chunkBasePos);
+  void RemoveChunkFromLod(const ElecSim::vi2d& chunkBasePos);
+  /// Flags the super-chunks holding a chunk whose LOD texture just went stale.
+  void MarkLodDirty(const ElecSim::vi2d& chunkBasePos);
+
+  /**
+   * @brief Brings a cell's LOD texture up to date, children first, as far as
+   * the budget allows.
+   * @param level Level of the cell, 1 or above
+   * @param index Index of the cell within its level
+   * @param budget Redraws left this frame; decremented per redraw
+   * @return The texture and whether it is current
+   */
+  LodTexture RefreshLod(std::size_t level, const ElecSim::vi2d& index,
+                        std::size_t& budget);
+
+  /// Pages in the paged out chunks within a range, up to PAGE_IN_BUDGET.
+  void PageIn(ChunkRange range);
+  void PageIn(const ElecSim::vi2d& chunkBasePos);
+  static void DrawLodQuad(sf::RenderTarget& target, sf::RenderStates states,
+                          const sf::Texture& texture, const sf::FloatRect& area);
 };
 
 }  // namespace Engine
\ No newline at end of file
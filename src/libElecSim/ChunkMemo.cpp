@@ -0,0 +1,250 @@
+#include "ChunkMemo.h"
+
+#include <cstdlib>
+#include <format>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+namespace ElecSim {
+
+namespace {
+// Salts of the key hashes and of the independent check hashes.
+constexpr std::uint32_t KEY_SALT = 0;
+constexpr std::uint32_t CHECK_SALT = 1;
+}  // namespace
+
+bool ChunkMemo::TransitionKey::operator==(const TransitionKey& other) const {
+  return layoutHash == other.layoutHash && layoutCheck == other.layoutCheck &&
+         stateHash == other.stateHash && stateCheck == other.stateCheck &&
+         localPos == other.localPos && fromDirection == other.fromDirection &&
+         isActive == other.isActive;
+}
+
+std::uint64_t ChunkMemo::TransitionKeyHash::operator()(
+    const TransitionKey& key) const noexcept {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  return hash(&key, sizeof(TransitionKey));
+}
+
+vi2d ChunkMemo::AlignToCell(vi2d pos) noexcept {
+  // Floor division, like AlignToChunk().
+  auto align = [](int value) {
+    const auto [quot, rem] = std::div(value, CELL_LENGTH);
+    return (quot - (rem < 0)) * CELL_LENGTH;
+  };
+  return vi2d(align(pos.x), align(pos.y));
+}
+
+std::uint64_t ChunkMemo::LayoutHash(vi2d localPos, const GridTile& tile,
+                                    std::uint32_t salt) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  struct {
+    vi2d localPos;
+    std::int32_t type;
+    std::int32_t facing;
+    std::uint32_t salt;
+  } key{localPos, static_cast<std::int32_t>(tile.GetTileType()),
+        static_cast<std::int32_t>(tile.GetFacing()), salt};
+  return hash(&key, sizeof(key));
+}
+
+std::uint64_t ChunkMemo::StateHash(vi2d localPos, std::uint32_t bits,
+                                   std::uint32_t salt) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  struct {
+    vi2d localPos;
+    std::uint32_t bits;
+    std::uint32_t salt;
+  } key{localPos, bits, salt};
+  return hash(&key, sizeof(key));
+}
+
+void ChunkMemo::Restate(Cell& cell, vi2d localPos, std::uint32_t oldBits,
+                        std::uint32_t newBits) {
+  cell.stateHash ^= StateHash(localPos, oldBits, KEY_SALT) ^
+                    StateHash(localPos, newBits, KEY_SALT);
+  cell.stateCheck += StateHash(localPos, newBits, CHECK_SALT) -
+                     StateHash(localPos, oldBits, CHECK_SALT);
+}
+
+void ChunkMemo::Rebuild(const TileMap& tiles) {
+  cells.clear();
+  for (const auto& [pos, tile] : tiles) {
+    const vi2d cellPos = AlignToCell(pos);
+    const vi2d localPos = pos - cellPos;
+    auto& cell = cells[cellPos];
+    cell.tiles.push_back(tile);
+    cell.layoutHash ^= LayoutHash(localPos, *tile, KEY_SALT);
+    cell.layoutCheck += LayoutHash(localPos, *tile, CHECK_SALT);
+    cell.stateHash ^= StateHash(localPos, tile->GetStateBits(), KEY_SALT);
+    cell.stateCheck += StateHash(localPos, tile->GetStateBits(), CHECK_SALT);
+  }
+}
+
+void ChunkMemo::CopyFrom(const ChunkMemo& other, const TileMap& tiles) {
+  transitions = other.transitions;
+  hits = 0;
+  misses = 0;
+  Rebuild(tiles);
+}
+
+void ChunkMemo::Clear() {
+  cells.clear();
+  transitions = std::make_shared<TransitionMap>();
+  hits = 0;
+  misses = 0;
+}
+
+void ChunkMemo::MarkStale(vi2d pos) {
+  if (auto it = cells.find(AlignToCell(pos)); it != cells.end()) {
+    it->second.stale = true;
+  }
+}
+
+void ChunkMemo::NoteChange(const GridTile& tile, std::uint32_t oldBits) {
+  const vi2d cellPos = AlignToCell(tile.GetPos());
+  auto it = cells.find(cellPos);
+  if (it == cells.end() || it->second.stale) return;
+  Restate(it->second, tile.GetPos() - cellPos, oldBits, tile.GetStateBits());
+}
+
+ChunkMemo::Cell& ChunkMemo::Refresh(vi2d cellPos) {
+  auto it = cells.find(cellPos);
+  if (it == cells.end()) {
+    throw std::runtime_error(std::format(
+        "Chunk memo is out of date: no cell at {}, rebuild it first",
+        cellPos));
+  }
+  auto& cell = it->second;
+  if (cell.stale) {
+    cell.stateHash = 0;
+    cell.stateCheck = 0;
+    for (const auto& tile : cell.tiles) {
+      const vi2d localPos = tile->GetPos() - cellPos;
+      cell.stateHash ^= StateHash(localPos, tile->GetStateBits(), KEY_SALT);
+      cell.stateCheck +=
+          StateHash(localPos, tile->GetStateBits(), CHECK_SALT);
+    }
+    cell.stale = false;
+  }
+  return cell;
+}
+
+ChunkMemo::ProcessResult ChunkMemo::Process(
+    const std::shared_ptr<GridTile>& tile, const SignalEvent& event,
+    const TileMap& tiles) {
+  const vi2d cellPos = AlignToCell(tile->GetPos());
+  auto& cell = Refresh(cellPos);
+  const TransitionKey key{cell.layoutHash,
+                          cell.layoutCheck,
+                          cell.stateHash,
+                          cell.stateCheck,
+                          tile->GetPos() - cellPos,
+                          static_cast<std::int32_t>(event.fromDirection),
+                          event.isActive ? 1 : 0};
+
+  ProcessResult result;
+  auto it = transitions->find(key);
+  if (it != transitions->end()) {
+    ++hits;
+    // Replay the cached cascade onto the tiles.
+    for (const auto& [localPos, bits] : it->second.finalStates) {
+      const auto& target = tiles.find(cellPos + localPos)->second;
+      const auto oldBits = target->GetStateBits();
+      target->SetStateBits(bits);
+      Restate(cell, localPos, oldBits, target->GetStateBits());
+      result.touchedTiles.push_back(target);
+    }
+  } else {
+    ++misses;
+    auto transition = Simulate(cell, cellPos, tile, event, tiles);
+    for (const auto& [localPos, bits] : transition.finalStates) {
+      result.touchedTiles.push_back(tiles.find(cellPos + localPos)->second);
+    }
+    if (transitions->size() >= MAX_TRANSITIONS) {
+      transitions = std::make_shared<TransitionMap>();
+    } else if (transitions.use_count() > 1) {
+      transitions = std::make_shared<TransitionMap>(*transitions);
+    }
+    it = transitions->emplace(key, std::move(transition)).first;
+  }
+
+  const auto& transition = it->second;
+  result.updatesProcessed = transition.updatesProcessed;
+  result.newSignals.reserve(transition.outputs.size());
+  for (const auto& output : transition.outputs) {
+    result.newSignals.emplace_back(output.sourcePos + cellPos,
+                                   output.fromDirection, output.isActive);
+  }
+  return result;
+}
+
+// Runs the cascade for real, confined to the cell. Signals crossing the
+// cell border are recorded instead of followed, whether or not anything is
+// there to receive them, since the neighbours are not part of the key.
+// Signals into logic tiles are recorded the same way.
+ChunkMemo::Transition ChunkMemo::Simulate(
+    Cell& cell, vi2d cellPos, const std::shared_ptr<GridTile>& tile,
+    const SignalEvent& event, const TileMap& tiles) {
+  Transition transition;
+  ankerl::unordered_dense::map<vi2d, std::uint32_t, PositionHash> oldBits;
+  std::vector<std::shared_ptr<GridTile>> processed;
+
+  std::queue<std::pair<std::shared_ptr<GridTile>, SignalEvent>> pending;
+  pending.emplace(tile, event);
+  while (!pending.empty()) {
+    if (transition.updatesProcessed > MAX_LOCAL_UPDATES) {
+      throw std::runtime_error(std::format(
+          "Cycle detected in signal processing: cascade in cell at {} did "
+          "not settle within {} updates",
+          cellPos, MAX_LOCAL_UPDATES));
+    }
+    auto [current, signal] = std::move(pending.front());
+    pending.pop();
+    ++transition.updatesProcessed;
+
+    if (oldBits.try_emplace(current->GetPos(), current->GetStateBits())
+            .second) {
+      processed.push_back(current);
+    }
+    for (const auto& newSignal : current->ProcessSignal(signal)) {
+      const auto targetPos = TranslatePosition(
+          newSignal.sourcePos, FlipDirection(newSignal.fromDirection));
+      if (AlignToCell(targetPos) != cellPos) {
+        transition.outputs.emplace_back(newSignal.sourcePos - cellPos,
+                                        newSignal.fromDirection,
+                                        newSignal.isActive);
+        continue;
+      }
+      auto targetIt = tiles.find(targetPos);
+      if (targetIt == tiles.end() ||
+          !targetIt->second->CanReceiveFrom(newSignal.fromDirection)) {
+        continue;
+      }
+      if (!targetIt->second->IsDeterministic()) {
+        // Logic tiles are order sensitive, so they wait in the grid's queue
+        // like they would without memoisation.
+        transition.outputs.emplace_back(newSignal.sourcePos - cellPos,
+                                        newSignal.fromDirection,
+                                        newSignal.isActive);
+        continue;
+      }
+      pending.emplace(targetIt->second,
+                      SignalEvent(targetPos,
+                                  FlipDirection(newSignal.fromDirection),
+                                  newSignal.isActive));
+    }
+  }
+
+  transition.finalStates.reserve(processed.size());
+  for (const auto& current : processed) {
+    const vi2d localPos = current->GetPos() - cellPos;
+    const auto bits = current->GetStateBits();
+    Restate(cell, localPos, oldBits.find(current->GetPos())->second, bits);
+    transition.finalStates.push_back({localPos, bits});
+  }
+  return transition;
+}
+
+}  // namespace ElecSim
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class ChunkMemo
+ * @brief Memoises how a small cell of the board responds to a signal
+ * entering it, Hashlife style.
+ *
+ * A signal entering a cell cascades through the cell's deterministic tiles
+ * until it dies out, leaves the cell or reaches a logic tile. Logic tiles
+ * are left to the grid's queue, as their outcome depends on the order they
+ * see signals in, so each of them starts a cascade of its own. So do the
+ * signals leaving the cell.
+ *
+ * A cascade only depends on the cell's layout, the state of its tiles and
+ * the entering signal, so it is cached under hashes of exactly those. Layout
+ * hashes use cell-local positions, which makes a transition reusable by
+ * every copy of the same circuit anywhere on the board, and the state hashes
+ * are kept up to date incrementally. Layout and state are each hashed twice,
+ * independently, so that cells sharing one of the hashes are still told
+ * apart. A cache hit writes the cached tile states back and hands out the
+ * signals ending the cascade, without running a single ProcessSignal().
+ *
+ * Cells are CELL_LENGTH tiles square, far smaller than a chunk, because a
+ * key covers the state of every tile in the cell: the parts of a whole chunk
+ * are rarely all in the same state again, the parts of a cell often are.
+ *
+ * Unlike Hashlife, this never skips ahead in time, and a hit still writes
+ * back every tile the cascade changed. The cost stays linear in the tiles
+ * that change, only the signal processing is saved. That beats the legacy
+ * engine, but not the groups of the preprocessed engine, which memoisation
+ * bypasses. Boards that settle into a cycle are better served by period
+ * detection, see Grid::SetPeriodDetection().
+ */
+class ChunkMemo {
+ public:
+  using TileMap = ankerl::unordered_dense::map<vi2d, std::shared_ptr<GridTile>,
+                                               PositionHash>;
+
+  struct ProcessResult {
+    std::vector<SignalEvent> newSignals;  // Signals ending the cascade
+    std::vector<std::shared_ptr<GridTile>> touchedTiles;  // Tiles processed
+    int updatesProcessed = 0;  // Updates the cascade took, cached or not
+  };
+
+  ChunkMemo() = default;
+  ~ChunkMemo() = default;
+
+  /**
+   * @brief Sorts every tile into its cell and hashes layouts and states from
+   * scratch. Cached transitions are kept, they stay valid for any board.
+   * @param tiles All tiles of the board
+   */
+  void Rebuild(const TileMap& tiles);
+
+  /**
+   * @brief Starts over for a copy of another memo's board. The cached
+   * transitions are shared with the other memo until either one caches
+   * something new, so copying costs nothing beyond the rehash of the tiles.
+   * @param other The memo to copy
+   * @param tiles All tiles of the copied board
+   */
+  void CopyFrom(const ChunkMemo& other, const TileMap& tiles);
+
+  /**
+   * @brief Drops all cells and every cached transition.
+   */
+  void Clear();
+
+  /**
+   * @brief Flags the cell holding a position for a full state rehash,
+   * because a tile in it was changed from outside of Process().
+   * @param pos Position of the changed tile
+   */
+  void MarkStale(vi2d pos);
+
+  /**
+   * @brief Rehashes a single tile whose state was changed outside of
+   * Process() in a known way. Cheaper than MarkStale() for frequent changes.
+   * @param tile The changed tile
+   * @param oldBits The tile's state bits before the change
+   */
+  void NoteChange(const GridTile& tile, std::uint32_t oldBits);
+
+  /**
+   * @brief Runs the cascade a signal causes within the cell of the tile it
+   * reaches, either from the cache or by simulating it and caching the result.
+   * @param tile The tile receiving the signal
+   * @param event The signal
+   * @param tiles All tiles of the board
+   * @return The signals ending the cascade and the tiles that were processed
+   */
+  ProcessResult Process(const std::shared_ptr<GridTile>& tile,
+                        const SignalEvent& event, const TileMap& tiles);
+
+  [[nodiscard]] std::size_t GetHits() const noexcept { return hits; }
+  [[nodiscard]] std::size_t GetMisses() const noexcept { return misses; }
+  [[nodiscard]] std::size_t GetCacheSize() const noexcept {
+    return transitions->size();
+  }
+
+ private:
+  static constexpr int CELL_LENGTH = 8;  // In tiles, see the class comment
+  // A cascade longer than this cannot settle within a cell, so there has to
+  // be a cycle in it.
+  static constexpr int MAX_LOCAL_UPDATES = 100000;
+  // Once full, the cache starts over rather than growing without bound.
+  static constexpr std::size_t MAX_TRANSITIONS = std::size_t{1} << 18;
+
+  // The hashes xor the tiles' hashes, the checks add up hashes salted
+  // differently.
+  struct Cell {
+    std::vector<std::shared_ptr<GridTile>> tiles;
+    std::uint64_t layoutHash = 0;
+    std::uint64_t layoutCheck = 0;
+    std::uint64_t stateHash = 0;
+    std::uint64_t stateCheck = 0;
+    bool stale = false;
+  };
+
+  struct TransitionKey {
+    std::uint64_t layoutHash;
+    std::uint64_t layoutCheck;
+    std::uint64_t stateHash;
+    std::uint64_t stateCheck;
+    vi2d localPos;  // Tile the signal enters through
+    std::int32_t fromDirection;
+    std::int32_t isActive;
+    bool operator==(const TransitionKey& other) const;
+  };
+  struct TransitionKeyHash {
+    using is_avalanching = void;
+    std::uint64_t operator()(const TransitionKey& key) const noexcept;
+  };
+
+  struct Transition {
+    struct TileState {
+      vi2d localPos;
+      std::uint32_t bits;
+    };
+    std::vector<TileState> finalStates;  // In processing order
+    std::vector<SignalEvent> outputs;    // Source positions are cell-local
+    int updatesProcessed = 0;
+  };
+
+  [[nodiscard]] static vi2d AlignToCell(vi2d pos) noexcept;
+  [[nodiscard]] static std::uint64_t LayoutHash(vi2d localPos,
+                                                const GridTile& tile,
+                                                std::uint32_t salt);
+  [[nodiscard]] static std::uint64_t StateHash(vi2d localPos,
+                                               std::uint32_t bits,
+                                               std::uint32_t salt);
+  // Updates a cell's state hashes for a tile that changed its state bits.
+  static void Restate(Cell& cell, vi2d localPos, std::uint32_t oldBits,
+                      std::uint32_t newBits);
+
+  Cell& Refresh(vi2d cellPos);
+  Transition Simulate(Cell& cell, vi2d cellPos,
+                      const std::shared_ptr<GridTile>& tile,
+                      const SignalEvent& event, const TileMap& tiles);
+
+  using TransitionMap =
+      ankerl::unordered_dense::map<TransitionKey, Transition,
+                                   TransitionKeyHash>;
+
+  ankerl::unordered_dense::map<vi2d, Cell, PositionHash> cells;
+  // Copy-on-write, as forks of a board start out sharing it.
+  std::shared_ptr<TransitionMap> transitions =
+      std::make_shared<TransitionMap>();
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+};
+
+}  // namespace ElecSim
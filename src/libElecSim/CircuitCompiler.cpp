@@ -0,0 +1,462 @@
+#include "CircuitCompiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <format>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+
+#include "CompiledCircuit.h"
+#include "ankerl/unordered_dense.h"
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+namespace ElecSim {
+
+namespace {
+
+// Keeps each generated function small enough for the compiler to optimise
+// in reasonable time.
+constexpr std::size_t STATEMENTS_PER_FUNCTION = 2048;
+
+// A tile standing for another one: the input tile of the group it follows.
+struct Driver {
+  const GridTile* tile;
+  bool negated;
+};
+
+// The body of a statement, or the constant it folded into.
+struct Expression {
+  std::optional<bool> constant;
+  std::string code;
+};
+
+// Runs a program with the given arguments, the first naming it, and waits
+// for it. Nothing goes through a shell, so paths need no escaping.
+// Returns whether it ran and exited with status 0.
+bool RunProgram(const std::vector<std::string>& args) {
+#ifdef _WIN32
+  // The C runtime joins the arguments into one command line, which the
+  // program splits again, so quote them the way it expects.
+  std::vector<std::string> quoted;
+  for (const auto& arg : args) {
+    if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos) {
+      quoted.push_back(arg);
+      continue;
+    }
+    std::string out = "\"";
+    std::size_t backslashes = 0;
+    for (const char c : arg) {
+      if (c == '\\') {
+        ++backslashes;
+        continue;
+      }
+      // Backslashes only escape when a quote follows.
+      out.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+      out.push_back(c);
+      backslashes = 0;
+    }
+    out.append(backslashes * 2, '\\');
+    out.push_back('"');
+    quoted.push_back(std::move(out));
+  }
+  std::vector<const char*> argv;
+  for (const auto& arg : quoted) argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+  return _spawnvp(_P_WAIT, args.front().c_str(), argv.data()) == 0;
+#else
+  std::vector<char*> argv;
+  for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (posix_spawnp(&pid, argv.front(), nullptr, nullptr, argv.data(),
+                   environ) != 0) {
+    return false;
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// Buttons and emitters are read from the board rather than evaluated.
+bool IsInputPort(const GridTile& tile) {
+  const auto type = tile.GetTileType();
+  return type == TileType::Button || type == TileType::Emitter;
+}
+
+// Emits an array definition, returning what to refer to it by.
+template <typename T>
+std::string EmitArray(std::string& out, std::string_view type,
+                      std::string_view name, const std::vector<T>& values) {
+  if (values.empty()) return "nullptr";
+  out += std::format("const {} {}[] = {{", type, name);
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    out += i % 16 == 0 ? "\n    " : " ";
+    out += std::format("{},", values[i]);
+  }
+  out += "\n};\n";
+  return std::string(name);
+}
+
+}  // namespace
+
+CircuitCompiler::CircuitCompiler(Grid& grid) {
+#ifdef SIM_PREPROCESSING
+  grid.SetEngine(SimulationEngine::Preprocessed);
+#endif
+  grid.ResetSimulation();
+  layoutHash = grid.GetLayoutHash();
+  const auto& field = grid.GetTiles();
+  const auto liveTiles = grid.GetLiveTiles();
+  ankerl::unordered_dense::set<const GridTile*> live;
+  for (const auto& tile : liveTiles) live.insert(tile.get());
+
+  ankerl::unordered_dense::map<const GridTile*, Driver> groupDrivers;
+#ifdef SIM_PREPROCESSING
+  for (GroupId group = 0; group < grid.GetGroupCount(); ++group) {
+    const auto [input, inverted] = grid.GetGroupInput(group);
+    for (const auto& tile : grid.GetGroupTiles(group)) {
+      groupDrivers[tile.get()] = {input, inverted};
+    }
+  }
+#endif
+  auto driverOf = [&groupDrivers](const GridTile* tile) {
+    Driver driver{tile, false};
+    if (auto it = groupDrivers.find(tile); it != groupDrivers.end()) {
+      driver = it->second;
+    }
+    return driver;
+  };
+
+  // The live tile sending into a side of a tile, once the signal passed
+  // straight through any pass-through tiles in between.
+  auto inputAt = [&field, &live](const GridTile& tile,
+                                 Direction side) -> const GridTile* {
+    if (!tile.CanReceiveFrom(side)) return nullptr;
+    auto pos = TranslatePosition(tile.GetPos(), side);
+    auto it = field.find(pos);
+    while (it != field.end() && it->second->IsPassThrough()) {
+      pos = TranslatePosition(pos, side);
+      it = field.find(pos);
+    }
+    if (it == field.end() || !it->second->CanOutputTo(FlipDirection(side)) ||
+        !live.contains(it->second.get())) {
+      return nullptr;
+    }
+    return it->second.get();
+  };
+  auto dependencies = [&](const GridTile& tile) {
+    std::vector<const GridTile*> result;
+    if (IsInputPort(tile)) return result;
+    for (const auto side : AllDirections) {
+      if (const auto* input = inputAt(tile, side)) {
+        result.push_back(driverOf(input).tile);
+      }
+    }
+    return result;
+  };
+
+  // Orders the tiles that are evaluated on their own so every one comes
+  // after its inputs. Iterative, as chains of tiles can be long.
+  enum class Mark : std::uint8_t { Open, Done };
+  ankerl::unordered_dense::map<const GridTile*, Mark> marks;
+  std::vector<const GridTile*> order;
+  struct Frame {
+    const GridTile* tile;
+    std::vector<const GridTile*> inputs;
+    std::size_t next = 0;
+  };
+  std::vector<Frame> stack;
+  for (const auto& liveTile : liveTiles) {
+    if (liveTile->IsPassThrough()) continue;
+    const auto* root = driverOf(liveTile.get()).tile;
+    if (!marks.try_emplace(root, Mark::Open).second) continue;
+    stack.push_back({root, dependencies(*root)});
+    while (!stack.empty()) {
+      auto& frame = stack.back();
+      if (frame.next == frame.inputs.size()) {
+        marks[frame.tile] = Mark::Done;
+        order.push_back(frame.tile);
+        stack.pop_back();
+        continue;
+      }
+      const auto* input = frame.inputs[frame.next++];
+      auto [it, inserted] = marks.try_emplace(input, Mark::Open);
+      if (inserted) {
+        stack.push_back({input, dependencies(*input)});
+      } else if (it->second == Mark::Open) {
+        throw std::runtime_error(std::format(
+            "Cannot compile the feedback loop through the tile at {}",
+            input->GetPos()));
+      }
+    }
+  }
+
+  ankerl::unordered_dense::map<const GridTile*, Value> values;
+  std::vector<const GridTile*> sources;
+  auto valueAt = [&](const GridTile& tile, Direction side) {
+    const auto* input = inputAt(tile, side);
+    if (!input) return Value{};
+    const auto driver = driverOf(input);
+    auto value = values.at(driver.tile);
+    value.negated ^= driver.negated;
+    return value;
+  };
+  auto term = [](const Value& value) {
+    return std::format("{}Get(s, {})", value.negated ? "!" : "", value.bit);
+  };
+  auto anyOf = [&term](std::span<const Value> inputs) {
+    Expression expression;
+    for (const auto& input : inputs) {
+      if (input.bit == Value::NO_BIT) {
+        if (input.negated) return Expression{true, {}};
+        continue;
+      }
+      if (!expression.code.empty()) expression.code += " | ";
+      expression.code += term(input);
+    }
+    if (expression.code.empty()) expression.constant = false;
+    return expression;
+  };
+  auto receivedInputs = [&valueAt](const GridTile& tile) {
+    std::vector<Value> inputs;
+    for (const auto side : AllDirections) {
+      if (tile.CanReceiveFrom(side)) inputs.push_back(valueAt(tile, side));
+    }
+    return inputs;
+  };
+
+  for (const auto* tile : order) {
+    Expression expression;
+    const auto facing = tile->GetFacing();
+    switch (tile->GetTileType()) {
+      case TileType::Button:
+      case TileType::Emitter:
+        expression.code = std::format("Get(in, {})", sources.size());
+        sources.push_back(tile);
+        break;
+      case TileType::Wire:
+        expression = anyOf(receivedInputs(*tile));
+        break;
+      case TileType::Junction: {
+        const Value input = valueAt(*tile, FlipDirection(facing));
+        expression = anyOf(std::span(&input, 1));
+        break;
+      }
+      case TileType::Inverter:
+        expression = anyOf(receivedInputs(*tile));
+        if (expression.constant) {
+          expression.constant = !*expression.constant;
+        } else {
+          expression.code = std::format("!({})", expression.code);
+        }
+        break;
+      case TileType::SemiConductor: {
+        // Active while a side and the bottom, relative to its facing, are.
+        const Value sideInputs[] = {
+            valueAt(*tile, DirectionRotate(Direction::Left, facing)),
+            valueAt(*tile, DirectionRotate(Direction::Right, facing))};
+        const Value bottomInput =
+            valueAt(*tile, DirectionRotate(Direction::Bottom, facing));
+        const auto side = anyOf(sideInputs);
+        const auto bottom = anyOf(std::span(&bottomInput, 1));
+        if (side.constant == false || bottom.constant == false) {
+          expression.constant = false;
+        } else if (side.constant == true && bottom.constant == true) {
+          expression.constant = true;
+        } else if (side.constant == true) {
+          expression.code = bottom.code;
+        } else if (bottom.constant == true) {
+          expression.code = side.code;
+        } else {
+          expression.code =
+              side.code.contains(' ')
+                  ? std::format("({}) & {}", side.code, bottom.code)
+                  : std::format("{} & {}", side.code, bottom.code);
+        }
+        break;
+      }
+      default:
+        throw std::runtime_error(std::format(
+            "Cannot compile the {} tile at {}",
+            TileTypeToString(tile->GetTileType()), tile->GetPos()));
+    }
+
+    Value value;
+    if (expression.constant) {
+      value.negated = *expression.constant;
+    } else {
+      value.bit = NewBit();
+      statements.push_back(
+          std::format("Set(s, {}, {});", value.bit, expression.code));
+    }
+    values.emplace(tile, value);
+  }
+
+  // Every tile that can ever be active, including the ones in groups.
+  ankerl::unordered_dense::map<const GridTile*, std::uint32_t> tileIndices;
+  for (const auto& liveTile : liveTiles) {
+    if (liveTile->IsPassThrough()) continue;
+    const auto driver = driverOf(liveTile.get());
+    auto value = values.at(driver.tile);
+    value.negated ^= driver.negated;
+    if (value.bit == Value::NO_BIT) {
+      if (!value.negated) continue;
+      if (trueBit == Value::NO_BIT) {
+        trueBit = NewBit();
+        statements.insert(statements.begin(),
+                          std::format("Set(s, {}, true);", trueBit));
+      }
+      value = {trueBit, false};
+    }
+    tileIndices.emplace(liveTile.get(),
+                        static_cast<std::uint32_t>(tiles.size()));
+    tiles.push_back({liveTile->GetPos(), value});
+  }
+  for (const auto* source : sources) {
+    inputTiles.push_back(tileIndices.at(source));
+  }
+  DebugPrint(
+      "Compiled {} of {} tiles into {} state bits, {} inputs", tiles.size(),
+      field.size(), bitCount, inputTiles.size());
+}
+
+std::string CircuitCompiler::GenerateSource() const {
+  std::string out = std::format(
+      R"(// Generated by circuit_compiler, see CircuitCompiler. Do not edit.
+#include <cstdint>
+
+#ifdef _WIN32
+#define ELECSIM_EXPORT __declspec(dllexport)
+#else
+#define ELECSIM_EXPORT __attribute__((visibility("default")))
+#endif
+
+// Laid out like ElecSim::ElecSimCircuit, ABI version {}
+struct ElecSimCircuit {{
+  std::uint32_t abiVersion;
+  std::uint32_t tileCount;
+  std::uint32_t inputCount;
+  std::uint32_t stateWords;
+  std::uint64_t layoutHash;
+  const std::int32_t* tilePositions;
+  const std::uint32_t* tileBits;
+  const std::uint8_t* tileNegated;
+  const std::uint32_t* inputTiles;
+  void (*step)(const std::uint64_t* inputs, std::uint64_t* state);
+}};
+
+namespace {{
+
+inline bool Get(const std::uint64_t* words, std::uint32_t bit) {{
+  return (words[bit / 64] >> (bit % 64)) & 1;
+}}
+
+inline void Set(std::uint64_t* words, std::uint32_t bit, bool value) {{
+  const std::uint64_t mask = std::uint64_t{{1}} << (bit % 64);
+  words[bit / 64] = (words[bit / 64] & ~mask) | (value ? mask : 0);
+}}
+)",
+      CompiledCircuit::ABI_VERSION);
+
+  // Every bit is written before it is read, in dependency order.
+  const std::size_t functionCount =
+      (statements.size() + STATEMENTS_PER_FUNCTION - 1) /
+      STATEMENTS_PER_FUNCTION;
+  for (std::size_t function = 0; function < functionCount; ++function) {
+    out += std::format(
+        "\nvoid Step{}([[maybe_unused]] const std::uint64_t* in, "
+        "std::uint64_t* s) {{\n",
+        function);
+    const auto first = function * STATEMENTS_PER_FUNCTION;
+    const auto last =
+        std::min(first + STATEMENTS_PER_FUNCTION, statements.size());
+    for (auto i = first; i < last; ++i) {
+      out += std::format("  {}\n", statements[i]);
+    }
+    out += "}\n";
+  }
+  out += "\nvoid Step([[maybe_unused]] const std::uint64_t* in, "
+         "[[maybe_unused]] std::uint64_t* s) {\n";
+  for (std::size_t function = 0; function < functionCount; ++function) {
+    out += std::format("  Step{}(in, s);\n", function);
+  }
+  out += "}\n\n";
+
+  std::vector<std::int32_t> positions;
+  std::vector<std::uint32_t> bits;
+  std::vector<int> negated;  // Formatted as numbers, unlike std::uint8_t
+  for (const auto& [pos, value] : tiles) {
+    positions.push_back(pos.x);
+    positions.push_back(pos.y);
+    bits.push_back(value.bit);
+    negated.push_back(value.negated ? 1 : 0);
+  }
+  const auto positionsName =
+      EmitArray(out, "std::int32_t", "tilePositions", positions);
+  const auto bitsName = EmitArray(out, "std::uint32_t", "tileBits", bits);
+  const auto negatedName =
+      EmitArray(out, "std::uint8_t", "tileNegated", negated);
+  const auto inputsName =
+      EmitArray(out, "std::uint32_t", "inputTiles", inputTiles);
+
+  out += std::format(
+      R"(
+const ElecSimCircuit circuit = {{
+    {}, {}, {}, {}, 0x{:016x}ull,
+    {}, {}, {}, {}, Step}};
+
+}}  // namespace
+
+extern "C" ELECSIM_EXPORT const ElecSimCircuit* {}() {{ return &circuit; }}
+)",
+      CompiledCircuit::ABI_VERSION, tiles.size(), inputTiles.size(),
+      (bitCount + 63) / 64, layoutHash, positionsName, bitsName, negatedName,
+      inputsName, CompiledCircuit::ENTRY_POINT);
+  return out;
+}
+
+void CircuitCompiler::BuildLibrary(const std::filesystem::path& source,
+                                   const std::filesystem::path& library) {
+  // $CXX may well be a launcher followed by the compiler, so it is split
+  // into words like make does.
+  std::vector<std::string> args;
+  if (const char* compiler = std::getenv("CXX")) {
+    std::istringstream words(compiler);
+    for (std::string word; words >> word;) args.push_back(std::move(word));
+  }
+  if (args.empty()) args.emplace_back("c++");
+  for (const char* option :
+       {"-std=c++17", "-O2", "-shared", "-fPIC", "-fvisibility=hidden", "-o"}) {
+    args.emplace_back(option);
+  }
+  args.push_back(library.string());
+  args.push_back(source.string());
+
+  std::string command = args.front();
+  for (const auto& arg : std::span(args).subspan(1)) command += " " + arg;
+  DebugPrint("Building circuit library: {}", command);
+  if (!RunProgram(args)) {
+    throw std::runtime_error(
+        std::format("Could not build circuit library: {}", command));
+  }
+}
+
+}  // namespace ElecSim
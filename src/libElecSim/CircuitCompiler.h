@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Grid.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class CircuitCompiler
+ * @brief Compiles a board ahead of time into a standalone C++ translation
+ * unit, for fixed designs run for so many ticks that interpreting tiles
+ * stops being affordable. See CompiledCircuit for loading the result.
+ *
+ * Between ticks, a board without feedback loops settles into a state that
+ * only depends on its buttons and emitters: every other tile is a function
+ * of its inputs. The generated code evaluates those functions once per tick
+ * in dependency order, as straight-line bit operations on the board state
+ * packed into 64 bit words. Buttons and emitters are the input ports, read
+ * from the board by the host every tick, and any tile can be probed by its
+ * state bit.
+ *
+ * Tiles that follow a deterministic path's input tile, as found by
+ * TileGroupManager, share its state bit instead of getting one of their own.
+ * Tiles no signal source reaches are never active and get no bit at all.
+ */
+class CircuitCompiler {
+ public:
+  /**
+   * @brief Analyses a board. It is reset, and preprocessed if the
+   * preprocessed engine is built in.
+   * @param grid The board
+   * @throws std::runtime_error if the board has a feedback loop
+   */
+  explicit CircuitCompiler(Grid& grid);
+
+  /**
+   * @brief Writes the translation unit implementing the board.
+   * @return The source code
+   */
+  [[nodiscard]] std::string GenerateSource() const;
+
+  /**
+   * @brief Builds a generated translation unit into a circuit library with
+   * the local compiler, `$CXX` or else `c++`. It has to understand GCC style
+   * options.
+   * @param source The source file
+   * @param library The shared library to write
+   * @throws std::runtime_error if the compiler fails
+   */
+  static void BuildLibrary(const std::filesystem::path& source,
+                           const std::filesystem::path& library);
+
+  [[nodiscard]] std::size_t GetTileCount() const noexcept {
+    return tiles.size();
+  }
+  [[nodiscard]] std::size_t GetInputCount() const noexcept {
+    return inputTiles.size();
+  }
+  // The state bits, one per tile evaluated on its own
+  [[nodiscard]] std::uint32_t GetBitCount() const noexcept { return bitCount; }
+
+ private:
+  // A tile's activation: its state bit, possibly negated, or a constant if
+  // it has no bit.
+  struct Value {
+    static constexpr std::uint32_t NO_BIT = ~std::uint32_t{0};
+    std::uint32_t bit = NO_BIT;
+    bool negated = false;  // For a constant, whether it is true
+  };
+  struct Tile {
+    vi2d pos;
+    Value value;
+  };
+
+  std::uint32_t NewBit() noexcept { return bitCount++; }
+
+  std::uint64_t layoutHash;
+  // Every tile that can become active, in tile order
+  std::vector<Tile> tiles;
+  // Indices into tiles
+  std::vector<std::uint32_t> inputTiles;
+  // One statement per state bit, in dependency order
+  std::vector<std::string> statements;
+  std::uint32_t bitCount = 0;
+  std::uint32_t trueBit = Value::NO_BIT;  // Set for tiles that are always on
+};
+
+}  // namespace ElecSim
@@ -1,6 +1,8 @@
 #include "Common.h"
 #include "ankerl/unordered_dense.h"
 
+#include <cstdlib>
+
 namespace ElecSim {
 std::size_t PositionHash::operator()(const vi2d& pos) const {
   using ankerl::unordered_dense::detail::wyhash::hash;
@@ -112,4 +114,13 @@ Direction DirectionFromVectors(vi2d from, vi2d to) {
                   "from: ({}, {}), to: ({}, {}) --> ({}, {})",
                   from.x, from.y, to.x, to.y, diff.x, diff.y));
   }
+
+vi2d AlignToChunk(vi2d pos) {
+  // Floor division, so negative positions land in the chunk to their left.
+  auto align = [](int value) {
+    const auto [quot, rem] = std::div(value, GRID_CHUNK_LENGTH);
+    return (quot - (rem < 0)) * GRID_CHUNK_LENGTH;
+  };
+  return vi2d(align(pos.x), align(pos.y));
+}
 }  // namespace ElecSim
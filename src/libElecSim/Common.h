@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <initializer_list>
 #include <memory>
 #include <tuple>
@@ -49,10 +50,39 @@ struct TileStateChange {
   }
 };
 
+// Identifies a group of tiles that always share one activation, see
+// TileGroupManager. Only valid until the next preprocessing pass.
+using GroupId = std::uint32_t;
+
+struct GroupStateChange {
+  GroupId group;
+  bool newState;
+  bool operator==(const GroupStateChange& other) const {
+    return group == other.group && newState == other.newState;
+  }
+};
+
+// Axis aligned rectangle of tile positions, both corners inclusive.
+struct TileRegion {
+  vi2d topLeft;
+  vi2d bottomRight;
+  // Grows the region to cover another one.
+  void Include(const TileRegion& other) noexcept {
+    topLeft = topLeft.min(other.topLeft);
+    bottomRight = bottomRight.max(other.bottomRight);
+  }
+  bool operator==(const TileRegion& other) const {
+    return topLeft == other.topLeft && bottomRight == other.bottomRight;
+  }
+};
+
 // Forward declaration to avoid circular includes
 class GridTile;
 
 constexpr const static size_t GRIDTILE_COUNT = 7;  // Number of tile types
+// Side length of the square chunks the board is split into for any
+// region-wise bookkeeping. Matches the renderer's chunk size.
+constexpr const int GRID_CHUNK_LENGTH = 64;
 constexpr const int GRIDTILE_BYTESIZE =
     sizeof(int) * 4;  // TileId + Facing + PosX + PosY
 
@@ -153,4 +183,11 @@ vi2d TranslatePosition(vi2d pos, Direction dir);
  */
 Direction DirectionFromVectors(vi2d from, vi2d to);
 
+/**
+ * @brief Finds the origin of the chunk a position lies in.
+ * @param pos Position on the board
+ * @return Top-left position of the containing chunk
+ */
+vi2d AlignToChunk(vi2d pos);
+
 }  // namespace ElecSim
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "CompiledCircuit.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace ElecSim {
+
+namespace {
+
+void* OpenLibrary(const std::filesystem::path& library) {
+#ifdef _WIN32
+  return LoadLibraryW(library.c_str());
+#else
+  // Circuits only export their entry point, so nothing needs to be global.
+  return dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+void* FindSymbol(void* handle, const char* name) {
+#ifdef _WIN32
+  return reinterpret_cast<void*>(
+      GetProcAddress(static_cast<HMODULE>(handle), name));
+#else
+  return dlsym(handle, name);
+#endif
+}
+
+void CloseLibrary(void* handle) {
+#ifdef _WIN32
+  FreeLibrary(static_cast<HMODULE>(handle));
+#else
+  dlclose(handle);
+#endif
+}
+
+std::string LastError() {
+#ifdef _WIN32
+  return std::format("error {}", GetLastError());
+#else
+  const char* error = dlerror();
+  return error ? error : "unknown error";
+#endif
+}
+
+}  // namespace
+
+CompiledCircuit::CompiledCircuit(std::filesystem::path library,
+                                 void* libraryHandle,
+                                 const ElecSimCircuit* exported)
+    : path(std::move(library)), handle(libraryHandle), circuit(exported) {}
+
+CompiledCircuit::~CompiledCircuit() { CloseLibrary(handle); }
+
+std::shared_ptr<const CompiledCircuit> CompiledCircuit::Load(
+    const std::filesystem::path& library) {
+  void* handle = OpenLibrary(library);
+  if (!handle) {
+    throw std::runtime_error(
+        std::format("Could not load circuit library {}: {}", library.string(),
+                    LastError()));
+  }
+  using EntryPoint = const ElecSimCircuit* (*)();
+  const auto entryPoint =
+      reinterpret_cast<EntryPoint>(FindSymbol(handle, ENTRY_POINT));
+  const ElecSimCircuit* exported = entryPoint ? entryPoint() : nullptr;
+  if (!exported || exported->abiVersion != ABI_VERSION) {
+    CloseLibrary(handle);
+    throw std::runtime_error(std::format(
+        "{} is not a circuit library of version {}", library.string(),
+        ABI_VERSION));
+  }
+  DebugPrint("Loaded circuit library {}: {} tiles, {} inputs, {} state words",
+             library.string(), exported->tileCount, exported->inputCount,
+             exported->stateWords);
+  return std::shared_ptr<const CompiledCircuit>(
+      new CompiledCircuit(library, handle, exported));
+}
+
+std::optional<CompiledCircuit::Instance> CompiledCircuit::Bind(
+    const TileMap& tiles, std::uint64_t layoutHash) const {
+  if (layoutHash != circuit->layoutHash) return std::nullopt;
+
+  std::vector<std::shared_ptr<GridTile>> circuitTiles;
+  circuitTiles.reserve(circuit->tileCount);
+  for (std::uint32_t i = 0; i < circuit->tileCount; ++i) {
+    const vi2d pos(circuit->tilePositions[2 * i],
+                   circuit->tilePositions[2 * i + 1]);
+    auto it = tiles.find(pos);
+    if (it == tiles.end()) return std::nullopt;
+    circuitTiles.push_back(it->second);
+  }
+
+  Instance instance;
+  instance.circuit = shared_from_this();
+  instance.inputs.resize((circuit->inputCount + 63) / 64);
+  instance.lastInputs.resize(instance.inputs.size());
+  instance.state.resize(circuit->stateWords);
+  instance.lastState.resize(circuit->stateWords);
+  instance.inputTiles.reserve(circuit->inputCount);
+  for (std::uint32_t i = 0; i < circuit->inputCount; ++i) {
+    instance.inputTiles.push_back(circuitTiles[circuit->inputTiles[i]]);
+  }
+
+  // Bucket the tiles by state bit, counting first.
+  const std::size_t bitCount = std::size_t{circuit->stateWords} * 64;
+  instance.bitOffsets.assign(bitCount + 1, 0);
+  for (std::uint32_t i = 0; i < circuit->tileCount; ++i) {
+    ++instance.bitOffsets[circuit->tileBits[i] + 1];
+  }
+  for (std::size_t bit = 0; bit < bitCount; ++bit) {
+    instance.bitOffsets[bit + 1] += instance.bitOffsets[bit];
+  }
+  instance.bitTiles.resize(circuit->tileCount);
+  auto fill = instance.bitOffsets;
+  for (std::uint32_t i = 0; i < circuit->tileCount; ++i) {
+    instance.bitTiles[fill[circuit->tileBits[i]]++] = {
+        circuitTiles[i], circuit->tileNegated[i] != 0};
+  }
+  return instance;
+}
+
+void CompiledCircuit::Instance::Step(std::vector<GridTile*>& changedTiles) {
+  std::ranges::fill(inputs, 0);
+  for (std::size_t i = 0; i < inputTiles.size(); ++i) {
+    if (inputTiles[i]->GetActivation()) {
+      inputs[i / 64] |= std::uint64_t{1} << (i % 64);
+    }
+  }
+  // The state is a function of the inputs alone.
+  if (synced && inputs == lastInputs) return;
+  circuit->circuit->step(inputs.data(), state.data());
+
+  // Only bits that flipped can have changed a tile, unless the tiles were
+  // set from elsewhere since the last step.
+  for (std::size_t word = 0; word < state.size(); ++word) {
+    std::uint64_t changed = synced ? state[word] ^ lastState[word] : ~0ull;
+    while (changed != 0) {
+      const auto bit = word * 64 + std::countr_zero(changed);
+      changed &= changed - 1;
+      const bool value = (state[word] >> (bit % 64)) & 1;
+      for (auto i = bitOffsets[bit]; i < bitOffsets[bit + 1]; ++i) {
+        const auto& [tile, negated] = bitTiles[i];
+        if (tile->GetActivation() == (value != negated)) continue;
+        tile->SetActivation(value != negated);
+        changedTiles.push_back(tile.get());
+      }
+    }
+  }
+  lastInputs = inputs;
+  lastState = state;
+  synced = true;
+}
+
+}  // namespace ElecSim
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Common.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+// What a circuit library exports, see CircuitCompiler. All fields are plain C
+// so the library need not be built against this header or this compiler.
+extern "C" {
+struct ElecSimCircuit {
+  std::uint32_t abiVersion;
+  std::uint32_t tileCount;   // Tiles that can ever be active
+  std::uint32_t inputCount;  // Buttons and emitters
+  std::uint32_t stateWords;  // 64 bit words of packed state
+  std::uint64_t layoutHash;  // Grid::GetLayoutHash() of the compiled board
+  const std::int32_t* tilePositions;  // x and y of every tile
+  // Per tile, the state bit holding its activation
+  const std::uint32_t* tileBits;
+  // Per tile, whether it holds the opposite of its state bit
+  const std::uint8_t* tileNegated;
+  // Per input port, the tile it reads
+  const std::uint32_t* inputTiles;
+  // Evaluates one tick: the input ports, one bit per port, into the state
+  void (*step)(const std::uint64_t* inputs, std::uint64_t* state);
+};
+}
+
+/**
+ * @class CompiledCircuit
+ * @brief A board compiled to native code by CircuitCompiler, loaded from its
+ * shared library.
+ *
+ * The library only holds the board's logic, so one can drive any number of
+ * boards of the same layout. Bind() hooks it up to one of them.
+ */
+class CompiledCircuit
+    : public std::enable_shared_from_this<CompiledCircuit> {
+ public:
+  using TileMap = ankerl::unordered_dense::map<vi2d, std::shared_ptr<GridTile>,
+                                               PositionHash>;
+
+  static constexpr std::uint32_t ABI_VERSION = 1;
+  static constexpr const char* ENTRY_POINT = "elecsim_circuit";
+
+  /**
+   * @class Instance
+   * @brief A compiled circuit driving the tiles of one board.
+   */
+  class Instance {
+   public:
+    /**
+     * @brief Evaluates one tick from the current activation of the board's
+     * buttons and emitters and writes every other tile's activation back.
+     * Skipped if none of them changed since the last step.
+     * @param changedTiles Receives the tiles whose activation changed
+     */
+    void Step(std::vector<GridTile*>& changedTiles);
+    /**
+     * @brief Has the next Step() compare every tile rather than only the
+     * bits that changed, for when tile states were set from elsewhere.
+     */
+    void Resync() noexcept { synced = false; }
+
+   private:
+    friend class CompiledCircuit;
+
+    struct BitTile {
+      std::shared_ptr<GridTile> tile;
+      bool negated;
+    };
+
+    std::shared_ptr<const CompiledCircuit> circuit;  // Keeps the code loaded
+    std::vector<std::shared_ptr<GridTile>> inputTiles;
+    std::vector<std::uint64_t> inputs;
+    std::vector<std::uint64_t> lastInputs;
+    std::vector<std::uint64_t> state;
+    std::vector<std::uint64_t> lastState;
+    // The tiles of state bit i are bitTiles[bitOffsets[i]..bitOffsets[i+1]]
+    std::vector<std::uint32_t> bitOffsets;
+    std::vector<BitTile> bitTiles;
+    bool synced = false;  // Whether the tiles match lastState
+  };
+
+  /**
+   * @brief Loads a circuit library.
+   * @param library Path of the shared library
+   * @throws std::runtime_error if it cannot be loaded or is no circuit
+   * library of this version
+   */
+  [[nodiscard]] static std::shared_ptr<const CompiledCircuit> Load(
+      const std::filesystem::path& library);
+  ~CompiledCircuit();
+
+  CompiledCircuit(const CompiledCircuit&) = delete;
+  CompiledCircuit& operator=(const CompiledCircuit&) = delete;
+
+  /**
+   * @brief Hooks the circuit up to a board.
+   * @param tiles The board's tiles
+   * @param layoutHash The board's Grid::GetLayoutHash()
+   * @return The instance, or std::nullopt if the circuit was compiled from
+   * another layout
+   */
+  [[nodiscard]] std::optional<Instance> Bind(const TileMap& tiles,
+                                             std::uint64_t layoutHash) const;
+
+  [[nodiscard]] std::uint64_t GetLayoutHash() const noexcept {
+    return circuit->layoutHash;
+  }
+  [[nodiscard]] const std::filesystem::path& GetPath() const noexcept {
+    return path;
+  }
+
+ private:
+  CompiledCircuit(std::filesystem::path library, void* libraryHandle,
+                  const ElecSimCircuit* exported);
+
+  std::filesystem::path path;
+  void* handle;
+  const ElecSimCircuit* circuit;
+};
+
+}  // namespace ElecSim
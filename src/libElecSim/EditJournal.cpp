@@ -0,0 +1,199 @@
+#include "EditJournal.h"
+
+#include <cstring>
+#include <utility>
+
+namespace ElecSim {
+
+// Records follow GridTile::Serialize: type, facing, then the position.
+vi2d EditJournal::RecordPos(const TileRecord& record) noexcept {
+  constexpr std::size_t offset = sizeof(int) + sizeof(Direction);
+  vi2d pos;
+  std::memcpy(&pos.x, record.data() + offset, sizeof(int));
+  std::memcpy(&pos.y, record.data() + offset + sizeof(int), sizeof(int));
+  return pos;
+}
+
+std::size_t EditJournal::EntryBytes(const Entry& entry) noexcept {
+  return ENTRY_OVERHEAD +
+         (entry.removed.size() + entry.added.size()) * sizeof(TileRecord);
+}
+
+Grid::EditResult EditJournal::SetTiles(
+    Grid& grid, std::span<const std::shared_ptr<GridTile>> tiles) {
+  // Later tiles for a position win in Grid::SetTiles. Only those are passed
+  // on, so the entry never mistakes a tile of this very batch for one it
+  // replaced.
+  ankerl::unordered_dense::map<vi2d, std::size_t, PositionHash> lastIndex;
+  lastIndex.reserve(tiles.size());
+  for (std::size_t i = 0; i < tiles.size(); ++i) {
+    lastIndex[tiles[i]->GetPos()] = i;
+  }
+  std::vector<std::shared_ptr<GridTile>> unique;
+  if (lastIndex.size() != tiles.size()) {
+    unique.reserve(lastIndex.size());
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+      if (lastIndex.find(tiles[i]->GetPos())->second == i) {
+        unique.push_back(tiles[i]);
+      }
+    }
+    tiles = unique;
+  }
+
+  auto result = grid.SetTiles(tiles);
+  if (tiles.empty()) return result;
+
+  auto& entry = CurrentEntry();
+  for (const auto& tile : result.replacedTiles) NoteRemoved(entry, *tile);
+  for (const auto& tile : tiles) NoteAdded(entry, *tile);
+  if (!grouping) CloseEntry();
+  TrimToBudget();
+  return result;
+}
+
+Grid::EditResult EditJournal::EraseTiles(Grid& grid,
+                                         std::span<const vi2d> positions) {
+  auto result = grid.EraseTiles(positions);
+  if (result.replacedTiles.empty()) return result;
+
+  auto& entry = CurrentEntry();
+  for (const auto& tile : result.replacedTiles) {
+    NoteRemoved(entry, *tile);
+    NoteErased(entry, tile->GetPos());
+  }
+  if (!grouping) CloseEntry();
+  TrimToBudget();
+  return result;
+}
+
+void EditJournal::BeginGroup() {
+  EndGroup();
+  grouping = true;
+}
+
+void EditJournal::EndGroup() noexcept {
+  grouping = false;
+  if (open) CloseEntry();
+  TrimToBudget();
+}
+
+std::optional<EditJournal::Change> EditJournal::Undo(Grid& grid) {
+  EndGroup();
+  if (!CanUndo()) return std::nullopt;
+  --cursor;
+  return Apply(grid, entries[cursor].added, entries[cursor].removed);
+}
+
+std::optional<EditJournal::Change> EditJournal::Redo(Grid& grid) {
+  EndGroup();
+  if (!CanRedo()) return std::nullopt;
+  auto change = Apply(grid, entries[cursor].removed, entries[cursor].added);
+  ++cursor;
+  return change;
+}
+
+EditJournal::Change EditJournal::Apply(Grid& grid,
+                                       const std::vector<TileRecord>& remove,
+                                       const std::vector<TileRecord>& add) {
+  Change change;
+  change.erased.reserve(remove.size());
+  for (const auto& record : remove) change.erased.push_back(RecordPos(record));
+  grid.EraseTiles(change.erased);
+
+  change.placed.reserve(add.size());
+  for (const auto& record : add) {
+    change.placed.push_back(GridTile::Deserialize(record));
+  }
+  grid.SetTiles(change.placed);
+  return change;
+}
+
+void EditJournal::Clear() noexcept {
+  entries.clear();
+  cursor = 0;
+  open.reset();
+  grouping = false;
+  byteCount = 0;
+}
+
+EditJournal::Entry& EditJournal::CurrentEntry() {
+  if (!open) {
+    // A new entry makes whatever was undone unreachable.
+    for (auto it = entries.begin() + static_cast<std::ptrdiff_t>(cursor);
+         it != entries.end(); ++it) {
+      byteCount -= EntryBytes(*it);
+    }
+    entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(cursor),
+                  entries.end());
+    entries.emplace_back();
+    byteCount += ENTRY_OVERHEAD;
+    cursor = entries.size();
+    open.emplace();
+  }
+  return entries.back();
+}
+
+// Only the first tile seen at a position is what was there before the entry.
+void EditJournal::NoteRemoved(Entry& entry, GridTile& tile) {
+  if (!open->touched.insert(tile.GetPos()).second) return;
+  entry.removed.push_back(tile.Serialize());
+  byteCount += sizeof(TileRecord);
+}
+
+void EditJournal::NoteAdded(Entry& entry, GridTile& tile) {
+  const vi2d pos = tile.GetPos();
+  open->touched.insert(pos);
+  auto [it, inserted] = open->addedIndex.try_emplace(pos, entry.added.size());
+  if (inserted) {
+    entry.added.push_back(tile.Serialize());
+    byteCount += sizeof(TileRecord);
+  } else {
+    entry.added[it->second] = tile.Serialize();
+  }
+}
+
+void EditJournal::NoteErased(Entry& entry, vi2d pos) {
+  auto it = open->addedIndex.find(pos);
+  if (it == open->addedIndex.end()) return;
+  const std::size_t index = it->second;
+  open->addedIndex.erase(it);
+  if (index + 1 != entry.added.size()) {
+    entry.added[index] = entry.added.back();
+    open->addedIndex[RecordPos(entry.added[index])] = index;
+  }
+  entry.added.pop_back();
+  byteCount -= sizeof(TileRecord);
+}
+
+void EditJournal::CloseEntry() noexcept {
+  open.reset();
+  // Everything it did was undone within the entry itself.
+  auto& entry = entries.back();
+  if (entry.removed.empty() && entry.added.empty()) {
+    byteCount -= EntryBytes(entry);
+    entries.pop_back();
+    cursor = entries.size();
+  }
+}
+
+void EditJournal::SetByteBudget(std::size_t bytes) noexcept {
+  byteBudget = bytes;
+  TrimToBudget();
+}
+
+// Undone entries go first, the last one to be redone first, so a long redo
+// tail never costs undo history. The open entry is never dropped, even if it
+// alone exceeds the budget.
+void EditJournal::TrimToBudget() noexcept {
+  while (byteCount > byteBudget && cursor < entries.size()) {
+    byteCount -= EntryBytes(entries.back());
+    entries.pop_back();
+  }
+  while (byteCount > byteBudget && cursor > (open ? 1u : 0u)) {
+    byteCount -= EntryBytes(entries.front());
+    entries.pop_front();
+    --cursor;
+  }
+}
+
+}  // namespace ElecSim
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "Common.h"
+#include "Grid.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class EditJournal
+ * @brief Undo/redo history for edits made to a Grid.
+ *
+ * Edits go through the journal instead of straight to the grid. Each entry
+ * keeps the tiles it removed and the tiles it added as serialized
+ * GRIDTILE_BYTESIZE records, the same ones Grid::Save writes. Since an entry
+ * holds both sides, undoing or redoing it is a single bulk erase and insert
+ * of its own tiles: no replay from a snapshot is needed and the cost is
+ * proportional to the size of the edit, not the board. Memory is
+ * proportional to the edits made. Once the history outgrows its byte
+ * budget, undone entries are dropped first, then the oldest ones.
+ *
+ * Edits made between BeginGroup() and EndGroup() merge into one entry, e.g.
+ * all tiles painted in a single mouse drag.
+ */
+class EditJournal {
+ public:
+  using TileRecord = std::array<char, GRIDTILE_BYTESIZE>;
+
+  // What an undo or redo did to the grid, for mirroring it elsewhere
+  struct Change {
+    std::vector<vi2d> erased;  // Cleared first
+    std::vector<std::shared_ptr<GridTile>> placed;  // Then placed
+  };
+
+  static constexpr std::size_t DEFAULT_BYTE_BUDGET = std::size_t{64} << 20;
+
+  explicit EditJournal(std::size_t byteBudget = DEFAULT_BYTE_BUDGET)
+      : byteBudget(byteBudget) {}
+  ~EditJournal() = default;
+
+  /**
+   * @brief Grid::SetTiles, recorded. A position given more than once only
+   * keeps its last tile.
+   * @param grid The grid to edit
+   * @param tiles The tiles to place, each at its own GetPos()
+   * @return What Grid::SetTiles returned
+   */
+  Grid::EditResult SetTiles(Grid& grid,
+                            std::span<const std::shared_ptr<GridTile>> tiles);
+  /**
+   * @brief Grid::EraseTiles, recorded.
+   * @param grid The grid to edit
+   * @param positions The positions to clear
+   * @return What Grid::EraseTiles returned
+   */
+  Grid::EditResult EraseTiles(Grid& grid, std::span<const vi2d> positions);
+
+  /**
+   * @brief Merges all edits up to the next EndGroup() into one entry. Ends
+   * any group still open.
+   */
+  void BeginGroup();
+  void EndGroup() noexcept;
+
+  /**
+   * @brief Reverts the latest entry.
+   * @param grid The grid the entry was recorded on
+   * @return What was done to the grid, or std::nullopt if there was nothing
+   * to undo
+   */
+  std::optional<Change> Undo(Grid& grid);
+  /**
+   * @brief Reapplies the latest undone entry.
+   * @param grid The grid the entry was recorded on
+   * @return What was done to the grid, or std::nullopt if there was nothing
+   * to redo
+   */
+  std::optional<Change> Redo(Grid& grid);
+
+  [[nodiscard]] bool CanUndo() const noexcept { return cursor > 0; }
+  [[nodiscard]] bool CanRedo() const noexcept {
+    return cursor < entries.size();
+  }
+  [[nodiscard]] std::size_t GetUndoCount() const noexcept { return cursor; }
+  [[nodiscard]] std::size_t GetRedoCount() const noexcept {
+    return entries.size() - cursor;
+  }
+  [[nodiscard]] std::size_t GetMemoryUsage() const noexcept {
+    return byteCount;
+  }
+  /**
+   * @brief Changes the byte budget, dropping entries right away if the
+   * history no longer fits.
+   * @param bytes The new budget
+   */
+  void SetByteBudget(std::size_t bytes) noexcept;
+
+  /**
+   * @brief Forgets the whole history, e.g. after loading another board.
+   */
+  void Clear() noexcept;
+
+ private:
+  struct Entry {
+    std::vector<TileRecord> removed;  // Tiles there before the entry
+    std::vector<TileRecord> added;    // Tiles there after it
+  };
+  // Bookkeeping for the entry edits are merged into; dropped once it closes.
+  struct OpenEntry {
+    ankerl::unordered_dense::set<vi2d, PositionHash> touched;
+    ankerl::unordered_dense::map<vi2d, std::size_t, PositionHash> addedIndex;
+  };
+
+  static constexpr std::size_t ENTRY_OVERHEAD = sizeof(Entry);
+
+  [[nodiscard]] static vi2d RecordPos(const TileRecord& record) noexcept;
+  [[nodiscard]] static std::size_t EntryBytes(const Entry& entry) noexcept;
+
+  Entry& CurrentEntry();
+  void NoteRemoved(Entry& entry, GridTile& tile);
+  void NoteAdded(Entry& entry, GridTile& tile);
+  void NoteErased(Entry& entry, vi2d pos);
+  void CloseEntry() noexcept;
+  void TrimToBudget() noexcept;
+  static Change Apply(Grid& grid, const std::vector<TileRecord>& remove,
+                      const std::vector<TileRecord>& add);
+
+  std::deque<Entry> entries;
+  std::size_t cursor = 0;  // Entries before it are done, from it on undone
+  std::optional<OpenEntry> open;
+  bool grouping = false;
+  std::size_t byteCount = 0;  // Record bytes held by entries
+  std::size_t byteBudget;
+};
+
+}  // namespace ElecSim
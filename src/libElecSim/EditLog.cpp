@@ -0,0 +1,361 @@
+#include "EditLog.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ElecSim {
+
+namespace {
+
+// Each record is a header followed by the erased positions and then the
+// placed tiles' GRIDTILE_BYTESIZE records, all in native byte order.
+constexpr std::uint32_t RECORD_MAGIC = 0x474C4445;  // "EDLG"
+
+struct RecordHeader {
+  std::uint32_t magic;
+  std::uint32_t erasedCount;
+  std::uint32_t placedCount;
+  std::uint32_t reserved;
+  std::uint64_t checksum;  // Of everything after the header
+};
+
+std::uint64_t Checksum(std::span<const char> payload) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  return hash(payload.data(), payload.size());
+}
+
+std::filesystem::path OldLogPath(const std::filesystem::path& logPath) {
+  auto path = logPath;
+  path += ".old";
+  return path;
+}
+
+std::filesystem::path LogPath(const std::string& gridFilename) {
+  return std::filesystem::path(gridFilename + ".log");
+}
+
+// Tile records follow GridTile::Serialize: type, facing, then the position.
+vi2d TileRecordPos(std::span<const char, GRIDTILE_BYTESIZE> record) {
+  constexpr std::size_t offset = sizeof(int) + sizeof(Direction);
+  vi2d pos;
+  std::memcpy(&pos.x, record.data() + offset, sizeof(int));
+  std::memcpy(&pos.y, record.data() + offset + sizeof(int), sizeof(int));
+  return pos;
+}
+
+// Writes or appends to a file and waits for the data to reach the disk, so
+// a rename of the file that follows can never outlive its contents.
+bool WriteDurably(const std::filesystem::path& path,
+                  std::span<const char> data, bool append) {
+#ifdef _WIN32
+  const int fd = _wopen(path.c_str(),
+                        _O_WRONLY | _O_CREAT | _O_BINARY |
+                            (append ? _O_APPEND : _O_TRUNC),
+                        _S_IREAD | _S_IWRITE);
+  if (fd < 0) return false;
+  bool written = true;
+  while (written && !data.empty()) {
+    const auto chunk = static_cast<unsigned>(
+        std::min<std::size_t>(data.size(), INT_MAX));
+    const int count = _write(fd, data.data(), chunk);
+    written = count > 0;
+    if (written) data = data.subspan(static_cast<std::size_t>(count));
+  }
+  written = written && _commit(fd) == 0;
+  return _close(fd) == 0 && written;
+#else
+  const int fd = ::open(path.c_str(),
+                        O_WRONLY | O_CREAT | O_CLOEXEC |
+                            (append ? O_APPEND : O_TRUNC),
+                        0644);
+  if (fd < 0) return false;
+  bool written = true;
+  while (written && !data.empty()) {
+    const auto count = ::write(fd, data.data(), data.size());
+    if (count < 0 && errno == EINTR) continue;
+    written = count > 0;
+    if (written) data = data.subspan(static_cast<std::size_t>(count));
+  }
+  written = written && ::fsync(fd) == 0;
+  return ::close(fd) == 0 && written;
+#endif
+}
+
+// Makes the renames and removals within a directory so far durable.
+void SyncDirectory(const std::filesystem::path& directory) {
+#ifdef _WIN32
+  // NTFS journals renames itself, and directories cannot be flushed.
+  (void)directory;
+#else
+  const int fd = ::open(directory.empty() ? "." : directory.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return;
+  if (::fsync(fd) != 0) {
+    DebugPrint("Error syncing directory {}", directory.string());
+  }
+  ::close(fd);
+#endif
+}
+
+// Applies the records of one log to the grid. A log ending in a torn record
+// is cut back to the last whole one, so new records never end up behind it.
+std::size_t ReplayLog(Grid& grid, const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return 0;
+  const std::vector<char> buffer{std::istreambuf_iterator<char>(file),
+                                 std::istreambuf_iterator<char>()};
+  file.close();
+
+  std::size_t offset = 0;
+  std::size_t records = 0;
+  while (buffer.size() - offset >= sizeof(RecordHeader)) {
+    RecordHeader header;
+    std::memcpy(&header, buffer.data() + offset, sizeof(header));
+    const std::size_t payloadSize =
+        std::size_t{header.erasedCount} * sizeof(vi2d) +
+        std::size_t{header.placedCount} * GRIDTILE_BYTESIZE;
+    if (header.magic != RECORD_MAGIC ||
+        buffer.size() - offset - sizeof(header) < payloadSize) {
+      break;
+    }
+    const std::span<const char> payload(buffer.data() + offset + sizeof(header),
+                                        payloadSize);
+    if (Checksum(payload) != header.checksum) break;
+
+    std::vector<vi2d> erased(header.erasedCount);
+    std::memcpy(erased.data(), payload.data(),
+                erased.size() * sizeof(vi2d));
+    std::vector<std::shared_ptr<GridTile>> placed;
+    placed.reserve(header.placedCount);
+    for (std::size_t i = 0; i < header.placedCount; ++i) {
+      std::array<char, GRIDTILE_BYTESIZE> data;
+      std::memcpy(data.data(),
+                  payload.data() + erased.size() * sizeof(vi2d) +
+                      i * GRIDTILE_BYTESIZE,
+                  data.size());
+      placed.push_back(GridTile::Deserialize(data));
+    }
+    grid.EraseTiles(erased);
+    grid.SetTiles(placed);
+
+    offset += sizeof(header) + payloadSize;
+    ++records;
+  }
+
+  if (offset != buffer.size()) {
+    DebugPrint("Dropping {} bytes of torn edit log at the end of {}",
+               buffer.size() - offset, path.string());
+    std::error_code error;
+    std::filesystem::resize_file(path, offset, error);
+  }
+  return records;
+}
+
+}  // namespace
+
+EditLog::EditLog(const std::string& gridFilename, const Grid& grid)
+    : gridPath(gridFilename),
+      logPath(LogPath(gridFilename)),
+      oldLogPath(OldLogPath(logPath)) {
+  layout.reserve(grid.GetTiles().size());
+  for (const auto& [pos, tile] : grid.GetTiles()) {
+    layout.emplace(pos, tile->Serialize());
+  }
+  std::error_code error;
+  for (const auto& path : {logPath, oldLogPath}) {
+    const auto size = std::filesystem::file_size(path, error);
+    if (!error) logBytes += size;
+  }
+  const auto size = std::filesystem::file_size(gridPath, error);
+  if (!error) snapshotBytes = size;
+
+  log.open(logPath, std::ios::binary | std::ios::app);
+  if (!log) DebugPrint("Error opening file for writing: {}", logPath.string());
+  writer = std::jthread([this](std::stop_token stopToken) { Run(stopToken); });
+}
+
+EditLog::~EditLog() {
+  // The writer drains the queue before it honours the stop request.
+  writer.request_stop();
+  wake.notify_all();
+}
+
+void EditLog::Append(std::span<const vi2d> erased,
+                     std::span<const std::shared_ptr<GridTile>> placed) {
+  if (erased.empty() && placed.empty()) return;
+
+  Job job;
+  job.record.resize(sizeof(RecordHeader));
+  const auto* erasedBytes = reinterpret_cast<const char*>(erased.data());
+  job.record.insert(job.record.end(), erasedBytes,
+                    erasedBytes + erased.size_bytes());
+  for (const auto& tile : placed) {
+    const auto serialized = tile->Serialize();
+    job.record.insert(job.record.end(), serialized.begin(), serialized.end());
+  }
+  const RecordHeader header{
+      RECORD_MAGIC, static_cast<std::uint32_t>(erased.size()),
+      static_cast<std::uint32_t>(placed.size()), 0,
+      Checksum(
+          std::span<const char>(job.record).subspan(sizeof(RecordHeader)))};
+  std::memcpy(job.record.data(), &header, sizeof(header));
+  logBytes += job.record.size();
+
+  {
+    std::lock_guard lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+bool EditLog::ShouldCompact() const noexcept {
+  return logBytes >= std::max(MIN_COMPACT_BYTES, snapshotBytes.load());
+}
+
+void EditLog::Compact() {
+  logBytes = 0;
+  {
+    std::lock_guard lock(mutex);
+    jobs.emplace_back();
+  }
+  wake.notify_one();
+}
+
+void EditLog::Flush() {
+  std::unique_lock lock(mutex);
+  drained.wait(lock, [this] { return jobs.empty() && !writing; });
+}
+
+std::size_t EditLog::Replay(Grid& grid, const std::string& gridFilename) {
+  // Edits moved aside by a compaction that may not have finished come first.
+  const auto logPath = LogPath(gridFilename);
+  const auto records =
+      ReplayLog(grid, OldLogPath(logPath)) + ReplayLog(grid, logPath);
+  if (records > 0) {
+    DebugPrint("Replayed {} edits onto {}", records, gridFilename);
+  }
+  return records;
+}
+
+void EditLog::Discard(const std::string& gridFilename) {
+  std::error_code error;
+  const auto logPath = LogPath(gridFilename);
+  std::filesystem::remove(logPath, error);
+  std::filesystem::remove(OldLogPath(logPath), error);
+}
+
+void EditLog::Run(std::stop_token stopToken) {
+  std::unique_lock lock(mutex);
+  while (true) {
+    wake.wait(lock, stopToken, [this] { return !jobs.empty(); });
+    if (jobs.empty()) break;  // Stopped with nothing left to write
+
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    writing = true;
+    lock.unlock();
+    if (job.record.empty()) {
+      WriteSnapshot();
+    } else {
+      WriteRecord(job.record);
+    }
+    lock.lock();
+    writing = false;
+    if (jobs.empty()) drained.notify_all();
+  }
+  drained.notify_all();
+}
+
+void EditLog::WriteRecord(const std::vector<char>& record) {
+  log.write(record.data(), static_cast<std::streamsize>(record.size()));
+  log.flush();
+  if (!log) {
+    DebugPrint("Error writing to file: {}", logPath.string());
+    log.clear();
+  }
+
+  // The layout follows along either way, so the next snapshot has the edit.
+  RecordHeader header;
+  std::memcpy(&header, record.data(), sizeof(header));
+  const char* in = record.data() + sizeof(header);
+  for (std::uint32_t i = 0; i < header.erasedCount; ++i) {
+    vi2d pos;
+    std::memcpy(&pos, in, sizeof(pos));
+    in += sizeof(pos);
+    layout.erase(pos);
+  }
+  for (std::uint32_t i = 0; i < header.placedCount; ++i) {
+    TileRecord tile;
+    std::memcpy(tile.data(), in, tile.size());
+    in += tile.size();
+    layout.insert_or_assign(TileRecordPos(tile), tile);
+  }
+}
+
+// Every record written so far is part of the snapshot. The log holding them
+// is kept as the old log until the snapshot is safely in place, and records
+// appended meanwhile go to a fresh log.
+void EditLog::WriteSnapshot() {
+  std::error_code error;
+  const auto directory = gridPath.parent_path();
+  log.close();
+  if (std::filesystem::exists(oldLogPath, error)) {
+    // A previous compaction never finished, so its old log is still needed.
+    std::ifstream current(logPath, std::ios::binary);
+    const std::vector<char> records{std::istreambuf_iterator<char>(current),
+                                    std::istreambuf_iterator<char>()};
+    current.close();
+    if (WriteDurably(oldLogPath, records, true)) {
+      std::filesystem::remove(logPath, error);
+    }
+  } else {
+    std::filesystem::rename(logPath, oldLogPath, error);
+  }
+  // The old log must be in place before the grid file changes.
+  SyncDirectory(directory);
+  log.open(logPath, std::ios::binary | std::ios::app);
+  if (!log) DebugPrint("Error opening file for writing: {}", logPath.string());
+
+  std::vector<char> snapshot;
+  snapshot.reserve(layout.size() * GRIDTILE_BYTESIZE);
+  for (const auto& tile : layout | std::views::values) {
+    snapshot.insert(snapshot.end(), tile.begin(), tile.end());
+  }
+  auto tempPath = gridPath;
+  tempPath += ".tmp";
+  if (!WriteDurably(tempPath, snapshot, false)) {
+    DebugPrint("Error writing to file: {}", tempPath.string());
+    std::filesystem::remove(tempPath, error);
+    return;
+  }
+  std::filesystem::rename(tempPath, gridPath, error);
+  if (error) {
+    DebugPrint("Error replacing {}: {}", gridPath.string(), error.message());
+    std::filesystem::remove(tempPath, error);
+    return;
+  }
+  // And the new grid file before the edits it holds are dropped.
+  SyncDirectory(directory);
+  std::filesystem::remove(oldLogPath, error);
+  snapshotBytes = snapshot.size();
+  DebugPrint("Compacted edit log into {}, {} bytes", gridPath.string(),
+             snapshot.size());
+}
+
+}  // namespace ElecSim
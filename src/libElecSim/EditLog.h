@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common.h"
+#include "Grid.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class EditLog
+ * @brief Append-only, crash-safe log of the edits made to a saved grid, so
+ * keeping the file up to date costs bytes proportional to the edits rather
+ * than the board.
+ *
+ * Every SetTiles/EraseTiles batch becomes one record in `<grid>.log`: the
+ * erased positions followed by the placed tiles as GRIDTILE_BYTESIZE
+ * records, behind a header with a checksum. Records are serialized on the
+ * calling thread and written and flushed by a background thread.
+ *
+ * Once the log outgrows the last snapshot, Compact() folds it into a fresh
+ * snapshot in the Grid::Save format. The writer thread keeps its own copy of
+ * the layout up to date with the records it writes, so the snapshot is taken
+ * and written in the background without touching the grid. The log is moved
+ * aside to `<grid>.log.old` first and only deleted once the new snapshot
+ * has replaced the grid file. The snapshot reaches the disk before it
+ * replaces the grid file, and the renames before the old log goes, so even
+ * a power loss at any point leaves a grid file that Replay() can bring up to
+ * date. Replaying a record twice is harmless since both erasing and placing
+ * overwrite. A record torn by a crash fails its checksum and ends the
+ * replay.
+ */
+class EditLog {
+ public:
+  /**
+   * @param gridFilename The grid file the log belongs to. Edits are appended
+   * to any log already there, so Replay() it onto the grid first.
+   * @param grid The grid as the file and its logs describe it, which the
+   * log's copy of the layout starts out from
+   */
+  EditLog(const std::string& gridFilename, const Grid& grid);
+  // Writes out everything appended so far before returning.
+  ~EditLog();
+
+  EditLog(const EditLog&) = delete;
+  EditLog& operator=(const EditLog&) = delete;
+
+  /**
+   * @brief Records one edit batch. Returns as soon as it is serialized.
+   * @param erased The positions that were cleared, first
+   * @param placed The tiles that were placed, after
+   */
+  void Append(std::span<const vi2d> erased,
+              std::span<const std::shared_ptr<GridTile>> placed);
+
+  /**
+   * @brief Whether the log has grown enough for Compact() to pay off.
+   */
+  [[nodiscard]] bool ShouldCompact() const noexcept;
+
+  /**
+   * @brief Replaces the grid file and the log with a snapshot of every edit
+   * appended so far. Returns right away, the snapshot is taken and written
+   * in the background.
+   */
+  void Compact();
+
+  /**
+   * @brief Blocks until everything appended or compacted so far is on disk.
+   */
+  void Flush();
+
+  /**
+   * @brief Brings a grid loaded from its file up to date with the logs
+   * next to it, dropping any torn record at the end of a log.
+   * @param grid The grid, freshly loaded from gridFilename
+   * @param gridFilename The grid file the logs belong to
+   * @return The number of records replayed
+   */
+  static std::size_t Replay(Grid& grid, const std::string& gridFilename);
+
+  /**
+   * @brief Deletes the logs of a grid file, e.g. once it was saved in full.
+   * @param gridFilename The grid file the logs belong to
+   */
+  static void Discard(const std::string& gridFilename);
+
+ private:
+  // A log smaller than this is never worth a snapshot.
+  static constexpr std::size_t MIN_COMPACT_BYTES = std::size_t{1} << 20;
+
+  using TileRecord = std::array<char, GRIDTILE_BYTESIZE>;
+
+  struct Job {
+    std::vector<char> record;  // Empty for a snapshot
+  };
+
+  void Run(std::stop_token stopToken);
+  void WriteRecord(const std::vector<char>& record);
+  void WriteSnapshot();
+
+  std::filesystem::path gridPath;
+  std::filesystem::path logPath;
+  std::filesystem::path oldLogPath;
+
+  std::size_t logBytes = 0;  // Appended since the last snapshot
+  // Size of the last snapshot, if known. Written by the writer thread.
+  std::atomic<std::size_t> snapshotBytes = 0;
+
+  // Shared with the writer thread
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  std::condition_variable_any drained;
+  std::deque<Job> jobs;
+  bool writing = false;
+
+  // Only touched by the writer thread, once it runs
+  std::ofstream log;
+  ankerl::unordered_dense::map<vi2d, TileRecord, PositionHash> layout;
+  // Declared last, so it stops before anything it uses is destroyed.
+  std::jthread writer;
+};
+
+}  // namespace ElecSim
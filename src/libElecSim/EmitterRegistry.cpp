@@ -0,0 +1,198 @@
+#include "EmitterRegistry.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace ElecSim {
+
+void EmitterRegistry::Register(std::shared_ptr<EmitterGridTile> emitter) {
+  const vi2d pos = emitter->GetPos();
+  if (auto it = entries.find(pos); it != entries.end()) {
+    if (it->second.tile != emitter) it->second.tile->SetRegistry(nullptr);
+    entries.erase(it);
+  }
+  emitter->SetRegistry(this);
+  auto [it, _] = entries.emplace(pos, Entry{std::move(emitter)});
+  if (it->second.tile->IsEnabled()) {
+    Schedule(pos, it->second.tile->NextEmitTick(now));
+  }
+}
+
+void EmitterRegistry::Unregister(vi2d pos) {
+  auto it = entries.find(pos);
+  if (it == entries.end()) return;
+  it->second.tile->SetRegistry(nullptr);
+  entries.erase(it);
+}
+
+void EmitterRegistry::Clear() {
+  for (auto& [pos, entry] : entries) entry.tile->SetRegistry(nullptr);
+  entries.clear();
+  ClearWheel();
+  now = 0;
+}
+
+void EmitterRegistry::Reset(int tick) {
+  ClearWheel();
+  now = tick;
+  for (auto& [pos, entry] : entries) {
+    entry.generation = 0;
+    if (entry.tile->IsEnabled()) {
+      Schedule(pos, entry.tile->NextEmitTick(now));
+    }
+  }
+}
+
+void EmitterRegistry::Wake(vi2d pos) {
+  auto it = entries.find(pos);
+  if (it == entries.end() || it->second.generation != 0) return;
+  Schedule(pos, it->second.tile->NextEmitTick(now));
+}
+
+void EmitterRegistry::Schedule(vi2d pos, int dueTick) {
+  auto it = entries.find(pos);
+  if (it == entries.end()) return;
+  auto& entry = it->second;
+  entry.dueTick = std::max(dueTick, now + 1);
+  entry.generation = nextGeneration++;
+  File(SlotEntry{pos, entry.generation}, entry.dueTick);
+}
+
+void EmitterRegistry::CollectDue(
+    int tick, std::vector<std::shared_ptr<EmitterGridTile>>& out) {
+  while (now < tick) {
+    ++now;
+    Tick(out);
+  }
+}
+
+std::optional<int> EmitterRegistry::NextDueTick() const {
+  // Slots at or behind the cursor's own index on each level are empty: they
+  // either were drained or cascaded already. Beyond that, every level holds
+  // strictly later ticks than the one below it, so the first slot with a
+  // live entry has the answer.
+  const auto cur = static_cast<std::uint32_t>(now);
+  for (std::size_t level = 0; level < LEVEL_COUNT; ++level) {
+    const auto curIndex = (cur >> (level * SLOT_BITS)) & SLOT_MASK;
+    for (auto index = curIndex + 1; index < SLOT_COUNT; ++index) {
+      if (auto due = EarliestIn(wheel[level][index])) return due;
+    }
+  }
+  return EarliestIn(overflow);
+}
+
+void EmitterRegistry::SkipTo(int tick) {
+  if (tick <= now) return;
+  Rebase(tick, 0);
+}
+
+void EmitterRegistry::Shift(int ticks) {
+  if (ticks <= 0) return;
+  Rebase(now + ticks, ticks);
+}
+
+// Pulls every live entry off the wheel and files it again relative to the
+// new cursor position.
+void EmitterRegistry::Rebase(int newNow, int dueShift) {
+  std::vector<SlotEntry> live;
+  auto collect = [this, &live](const Slot& slot) {
+    for (const auto& slotEntry : slot) {
+      auto it = entries.find(slotEntry.pos);
+      if (it != entries.end() &&
+          it->second.generation == slotEntry.generation) {
+        live.push_back(slotEntry);
+      }
+    }
+  };
+  for (const auto& level : wheel) {
+    for (const auto& slot : level) collect(slot);
+  }
+  collect(overflow);
+
+  ClearWheel();
+  now = newNow;
+  for (const auto& slotEntry : live) {
+    auto& entry = entries.find(slotEntry.pos)->second;
+    entry.dueTick += dueShift;
+    File(slotEntry, entry.dueTick);
+  }
+}
+
+// Files an entry into the lowest level whose slot range still contains both
+// the current tick and the due tick. That way a slot at level n only has to
+// be looked at once the wheel crosses into its range, at which point it is
+// cascaded down into level n-1.
+void EmitterRegistry::File(const SlotEntry& slotEntry, int dueTick) {
+  const auto due = static_cast<std::uint32_t>(dueTick);
+  const auto cur = static_cast<std::uint32_t>(now);
+  for (std::size_t level = 0; level < LEVEL_COUNT; ++level) {
+    const unsigned shift = static_cast<unsigned>(level + 1) * SLOT_BITS;
+    if ((due >> shift) == (cur >> shift)) {
+      const auto slot = (due >> (level * SLOT_BITS)) & SLOT_MASK;
+      wheel[level][slot].push_back(slotEntry);
+      return;
+    }
+  }
+  overflow.push_back(slotEntry);
+}
+
+void EmitterRegistry::Cascade(Slot& slot) {
+  Slot pending;
+  std::swap(pending, slot);
+  for (const auto& slotEntry : pending) {
+    auto it = entries.find(slotEntry.pos);
+    if (it == entries.end() || it->second.generation != slotEntry.generation)
+      continue;  // Stale, the emitter was removed or rescheduled since.
+    File(slotEntry, it->second.dueTick);
+  }
+}
+
+void EmitterRegistry::Tick(std::vector<std::shared_ptr<EmitterGridTile>>& out) {
+  const auto cur = static_cast<std::uint32_t>(now);
+
+  // Crossing into a new range on some level means that range's slot now has
+  // to be broken down further. Highest level first, so entries can trickle
+  // all the way down within a single tick.
+  if ((cur & ((std::uint32_t{1} << (LEVEL_COUNT * SLOT_BITS)) - 1)) == 0) {
+    Cascade(overflow);
+  }
+  for (std::size_t level = LEVEL_COUNT - 1; level > 0; --level) {
+    const unsigned shift = static_cast<unsigned>(level) * SLOT_BITS;
+    if ((cur & ((std::uint32_t{1} << shift) - 1)) == 0) {
+      Cascade(wheel[level][(cur >> shift) & SLOT_MASK]);
+    }
+  }
+
+  // Nothing gets filed into the slot being drained, so it can be reused as is.
+  auto& due = wheel[0][cur & SLOT_MASK];
+  for (const auto& slotEntry : due) {
+    auto it = entries.find(slotEntry.pos);
+    if (it == entries.end() || it->second.generation != slotEntry.generation)
+      continue;
+    it->second.generation = 0;
+    out.push_back(it->second.tile);
+  }
+  due.clear();
+}
+
+std::optional<int> EmitterRegistry::EarliestIn(const Slot& slot) const {
+  std::optional<int> earliest;
+  for (const auto& slotEntry : slot) {
+    auto it = entries.find(slotEntry.pos);
+    if (it == entries.end() || it->second.generation != slotEntry.generation)
+      continue;
+    if (!earliest || it->second.dueTick < *earliest) {
+      earliest = it->second.dueTick;
+    }
+  }
+  return earliest;
+}
+
+void EmitterRegistry::ClearWheel() noexcept {
+  for (auto& level : wheel) {
+    for (auto& slot : level) slot.clear();
+  }
+  overflow.clear();
+}
+
+}  // namespace ElecSim
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Common.h"
+#include "GridTileTypes.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class EmitterRegistry
+ * @brief Owns the grid's emitters and schedules them on a hierarchical timer
+ * wheel keyed on the tick they next fire at.
+ *
+ * Emitters are deduplicated by position, so overwriting a tile never leaves a
+ * stale entry behind. Each tick only touches the wheel slot for that tick, so
+ * the cost of a tick is proportional to the emitters that actually fire rather
+ * than to every emitter on the board. Disabled emitters are parked off the
+ * wheel entirely until EmitterGridTile::Interact wakes them up again.
+ */
+class EmitterRegistry {
+ public:
+  EmitterRegistry() = default;
+  ~EmitterRegistry() = default;
+  // Emitters hold a back pointer to us, so we must stay put.
+  EmitterRegistry(const EmitterRegistry&) = delete;
+  EmitterRegistry& operator=(const EmitterRegistry&) = delete;
+
+  /**
+   * @brief Registers an emitter, replacing whatever was registered at its
+   * position, and schedules it relative to the current tick.
+   * @param emitter The emitter to register
+   */
+  void Register(std::shared_ptr<EmitterGridTile> emitter);
+
+  /**
+   * @brief Removes the emitter at the given position, if there is one.
+   * @param pos Position of the emitter
+   */
+  void Unregister(vi2d pos);
+
+  /**
+   * @brief Drops every emitter and rewinds the wheel to tick 0.
+   */
+  void Clear();
+
+  /**
+   * @brief Takes over another registry's schedule, wheel position included,
+   * with each emitter swapped for its counterpart on a copy of the board.
+   * Both registries fire in lockstep from then on.
+   * @param other The registry to copy
+   * @param counterpart Returns the emitter to file in place of the one at a
+   * given position
+   */
+  template <typename Lookup>
+  void CopyFrom(const EmitterRegistry& other, Lookup&& counterpart) {
+    Clear();
+    entries = other.entries;
+    for (auto& [pos, entry] : entries) {
+      entry.tile = counterpart(pos);
+      entry.tile->SetRegistry(this);
+    }
+    wheel = other.wheel;
+    overflow = other.overflow;
+    now = other.now;
+    nextGeneration = other.nextGeneration;
+  }
+
+  /**
+   * @brief Rewinds the wheel to the given tick and reschedules every enabled
+   * emitter from its current state. Call after the emitters were reset.
+   * @param tick The tick the simulation restarts at
+   */
+  void Reset(int tick);
+
+  /**
+   * @brief Puts a parked emitter back on the wheel. Called by the emitter
+   * itself when it gets re-enabled.
+   * @param pos Position of the emitter
+   */
+  void Wake(vi2d pos);
+
+  /**
+   * @brief Schedules the emitter at the given position to fire at a tick.
+   * Any earlier schedule of the same emitter is dropped.
+   * @param pos Position of the emitter
+   * @param dueTick The tick to fire at. Clamped to the next tick.
+   */
+  void Schedule(vi2d pos, int dueTick);
+
+  /**
+   * @brief Advances the wheel to the given tick and collects every emitter
+   * that is due at it. Collected emitters are off the wheel until they are
+   * scheduled again.
+   * @param tick The tick being simulated; must not lie in the past
+   * @param out Receives the due emitters
+   */
+  void CollectDue(int tick, std::vector<std::shared_ptr<EmitterGridTile>>& out);
+
+  /**
+   * @brief Looks up the earliest tick any emitter is scheduled for. Only the
+   * wheel slots ahead of the cursor are inspected, so the cost does not depend
+   * on how far away that tick is.
+   * @return The tick, or std::nullopt if no emitter is scheduled at all
+   */
+  [[nodiscard]] std::optional<int> NextDueTick() const;
+
+  /**
+   * @brief Moves the wheel to the given tick without firing anything. The
+   * caller guarantees nothing is due up to and including that tick (see
+   * NextDueTick). Costs one refile per scheduled emitter, regardless of how
+   * many ticks are skipped.
+   * @param tick The tick to skip to
+   */
+  void SkipTo(int tick);
+
+  /**
+   * @brief Moves the wheel and every scheduled emitter forward by the same
+   * number of ticks, so the schedule looks exactly as it did relative to the
+   * cursor. Used to jump over whole periods of a periodic board.
+   * @param ticks Number of ticks to shift by
+   */
+  void Shift(int ticks);
+
+  [[nodiscard]] std::size_t Size() const noexcept { return entries.size(); }
+  [[nodiscard]] bool Empty() const noexcept { return entries.empty(); }
+
+ private:
+  // 4 levels of 64 slots cover 2^24 ticks ahead; anything further out waits
+  // in the overflow list until the wheel wraps around.
+  static constexpr unsigned SLOT_BITS = 6;
+  static constexpr std::size_t SLOT_COUNT = std::size_t{1} << SLOT_BITS;
+  static constexpr std::size_t LEVEL_COUNT = 4;
+  static constexpr std::uint32_t SLOT_MASK = SLOT_COUNT - 1;
+
+  struct Entry {
+    std::shared_ptr<EmitterGridTile> tile;
+    int dueTick = -1;
+    // 0 means "not on the wheel". Wheel slots are never scrubbed when an
+    // emitter is rescheduled or removed, instead every slot entry carries the
+    // generation it was filed under and is ignored once that went stale.
+    std::uint32_t generation = 0;
+  };
+  struct SlotEntry {
+    vi2d pos;
+    std::uint32_t generation;
+  };
+  using Slot = std::vector<SlotEntry>;
+
+  ankerl::unordered_dense::map<vi2d, Entry, PositionHash> entries;
+  std::array<std::array<Slot, SLOT_COUNT>, LEVEL_COUNT> wheel;
+  Slot overflow;
+  int now = 0;  // Last tick the wheel was advanced to
+  std::uint32_t nextGeneration = 1;
+
+  void File(const SlotEntry& slotEntry, int dueTick);
+  void Cascade(Slot& slot);
+  void Tick(std::vector<std::shared_ptr<EmitterGridTile>>& out);
+  [[nodiscard]] std::optional<int> EarliestIn(const Slot& slot) const;
+  void ClearWheel() noexcept;
+  void Rebase(int newNow, int dueShift);
+};
+
+}  // namespace ElecSim
@@ -1,15 +1,49 @@
 #include "Grid.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <ranges>
 #include <stdexcept>
+#include <utility>
 #include "Common.h"
 
 namespace ElecSim {
 
+bool IsEngineAvailable(SimulationEngine engine) noexcept {
+#ifdef SIM_PREPROCESSING
+  (void)engine;
+  return true;
+#else
+  return engine != SimulationEngine::Preprocessed;
+#endif
+}
+
+std::string_view EngineToString(SimulationEngine engine) noexcept {
+  switch (engine) {
+    case SimulationEngine::Legacy:
+      return "legacy";
+    case SimulationEngine::Preprocessed:
+      return "preprocessed";
+    case SimulationEngine::Compiled:
+      return "compiled";
+  }
+  return "unknown";
+}
+
+std::optional<SimulationEngine> ParseEngine(std::string_view name) noexcept {
+  for (const auto engine :
+       {SimulationEngine::Legacy, SimulationEngine::Preprocessed,
+        SimulationEngine::Compiled}) {
+    if (name == EngineToString(engine)) return engine;
+  }
+  return std::nullopt;
+}
+
 bool SignalEdge::operator==(const SignalEdge& other) const {
   return sourcePos == other.sourcePos && targetPos == other.targetPos;
 }
@@ -19,9 +53,133 @@ std::size_t SignalEdgeHash::operator()(const SignalEdge& edge) const {
   return hash(&edge, sizeof(SignalEdge));
 }
 
+namespace {
+
+// A grid file may end in a section holding the preprocessed topology. It
+// starts with a header the size of a tile record, whose tile id no tile
+// type uses.
+constexpr std::int32_t TOPOLOGY_MARKER = -1;
+// Version 2 added the tiles and outputs behind folded inverters.
+constexpr std::uint32_t TOPOLOGY_VERSION = 2;
+
+struct TopologyHeader {
+  std::int32_t marker;
+  std::uint32_t version;
+  std::uint64_t layoutHash;
+};
+static_assert(sizeof(TopologyHeader) == GRIDTILE_BYTESIZE);
+
+// State checkpoints are a header followed by one record per tile and one per
+// pending update, all in native byte order like the layout files.
+constexpr std::array<char, 4> STATE_MAGIC{'E', 'S', 'S', 'T'};
+constexpr std::uint32_t STATE_VERSION = 1;
+
+struct StateHeader {
+  std::array<char, 4> magic;
+  std::uint32_t version;
+  std::uint64_t layoutHash;
+  std::int32_t currentTick;
+  std::uint32_t tileCount;
+  std::uint32_t updateCount;
+  std::uint32_t reserved;
+};
+struct TileStateRecord {
+  vi2d pos;
+  TileState state;
+};
+struct UpdateRecord {
+  vi2d tilePos;
+  vi2d sourcePos;
+  std::int32_t fromDirection;
+  std::int32_t isActive;
+  std::uint32_t updateCycleId;
+};
+
+// Collects the tiles a signal can ever reach, starting from the signal
+// sources. Crossings only pass a signal on to their opposite side, so they
+// are walked straight through rather than spreading it to every side.
+template <typename TileField>
+std::vector<std::shared_ptr<GridTile>> FindLiveTiles(const TileField& tiles) {
+  ankerl::unordered_dense::segmented_set<const GridTile*> live;
+  std::vector<const GridTile*> pending;
+  for (const auto& [pos, tile] : tiles) {
+    if (tile->IsSignalSource() && live.insert(tile.get()).second) {
+      pending.push_back(tile.get());
+    }
+  }
+  while (!pending.empty()) {
+    const auto* tile = pending.back();
+    pending.pop_back();
+    for (const auto& dir : AllDirections) {
+      if (!tile->CanOutputTo(dir)) continue;
+      auto pos = TranslatePosition(tile->GetPos(), dir);
+      for (auto it = tiles.find(pos); it != tiles.end();
+           it = tiles.find(pos = TranslatePosition(pos, dir))) {
+        const auto* target = it->second.get();
+        if (!target->CanReceiveFrom(FlipDirection(dir))) break;
+        if (!target->IsPassThrough()) {
+          if (live.insert(target).second) pending.push_back(target);
+          break;
+        }
+        live.insert(target);
+      }
+    }
+  }
+
+  std::vector<std::shared_ptr<GridTile>> liveTiles;
+  liveTiles.reserve(live.size());
+  for (const auto& [pos, tile] : tiles) {
+    if (live.contains(tile.get())) liveTiles.push_back(tile);
+  }
+  return liveTiles;
+}
+
+// Identifies a layout regardless of tile order, so saved topologies and
+// checkpoints can tell whether they belong to the board at hand.
+template <typename TileField>
+std::uint64_t HashLayout(const TileField& tiles) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  std::uint64_t layoutHash = hash(tiles.size());
+  for (const auto& [pos, tile] : tiles) {
+    const auto data = tile->Serialize();
+    layoutHash ^= hash(data.data(), data.size());
+  }
+  return layoutHash;
+}
+
+}  // namespace
+
 void Grid::QueueUpdate(std::shared_ptr<GridTile> tile,
                        const SignalEvent& event) noexcept {
-  updateQueue.push(UpdateEvent(tile, event, currentTick));
+  // The caller may have changed the tile before queueing it.
+  if (chunkMemoisation) chunkMemo.MarkStale(tile->GetPos());
+  NoteOutsideChange(*tile);
+  PushUpdate(std::move(tile), event);
+}
+
+void Grid::PushUpdate(std::shared_ptr<GridTile> tile,
+                      const SignalEvent& event) {
+  updateQueue.push(UpdateEvent(std::move(tile), event, currentTick));
+}
+
+void Grid::NoteOutsideChange(const GridTile& tile) {
+  if (resetRevision != editRevision || prunedTileCount == 0) return;
+  if (liveRevision != editRevision || !liveTileSet.contains(&tile)) {
+    resetRevision.reset();
+  }
+}
+
+void Grid::QueueSignal(const SignalEvent& signal) {
+  auto targetPos =
+      TranslatePosition(signal.sourcePos, FlipDirection(signal.fromDirection));
+  auto targetTileIt = tiles.find(targetPos);
+  if (targetTileIt != tiles.end() &&
+      targetTileIt->second->CanReceiveFrom(signal.fromDirection)) {
+    PushUpdate(targetTileIt->second,
+               SignalEvent(signal.sourcePos,
+                           FlipDirection(signal.fromDirection),
+                           signal.isActive));
+  }
 }
 
 void Grid::ProcessUpdateEvent(const UpdateEvent& updateEvent) {
@@ -41,9 +199,9 @@ void Grid::ProcessUpdateEvent(const UpdateEvent& updateEvent) {
     if (targetTile->CanReceiveFrom(signal.fromDirection)) {
       currentTickVisitedEdges.insert(edge);
       // Create a simpler signal event (no visited positions)
-      QueueUpdate(targetTile,
-                  SignalEvent(targetPos, FlipDirection(signal.fromDirection),
-                              signal.isActive));
+      PushUpdate(targetTile,
+                 SignalEvent(targetPos, FlipDirection(signal.fromDirection),
+                             signal.isActive));
     }
   }
 }
@@ -63,31 +221,44 @@ Grid::SimulationResult Grid::Simulate() {
 
   // Dirty bit on the tile dedups affected tiles without hashing; touchedTiles
   // remembers who to clear it from below, without a second lookup by pos.
-  std::vector<std::shared_ptr<GridTile>> touchedTiles;
-  auto markAffected = [&simResult, &touchedTiles](const std::shared_ptr<GridTile>& tile) {
-    if (tile->GetDirtyThisTick()) return;
-    tile->SetDirtyThisTick(true);
+  // The field owns the tiles for the whole tick, so plain pointers do.
+  std::vector<GridTile*> touchedTiles;
+  auto markAffected = [&simResult, &touchedTiles](GridTile& tile) {
+    if (tile.GetDirtyThisTick()) return;
+    tile.SetDirtyThisTick(true);
     simResult.affectedTiles.push_back(
-        TileStateChange{tile->GetPos(), tile->GetActivation()});
-    touchedTiles.push_back(tile);
+        TileStateChange{tile.GetPos(), tile.GetActivation()});
+    touchedTiles.push_back(&tile);
   };
 
-  // Queue updates from emitters first
-  for (auto it = emitters.begin(); it != emitters.end();) {
-    if (it->expired()) {
-      it = emitters.erase(it);
-      continue;
-    }
-
-    auto tile = std::dynamic_pointer_cast<EmitterGridTile>(it->lock());
-    if (tile && tile->ShouldEmit(currentTick)) {
+  // Queue updates from emitters first. Only the ones due this tick come off
+  // the wheel; disabled ones stay parked until they are interacted with.
+  dueEmitters.clear();
+  emitters.CollectDue(currentTick, dueEmitters);
+  for (const auto& tile : dueEmitters) {
+    if (tile->ShouldEmit(currentTick)) {
+      const auto oldBits = tile->GetStateBits();
       tile->SetActivation(!tile->GetActivation());
+      if (chunkMemoisation) chunkMemo.NoteChange(*tile, oldBits);
       // Now using the simpler SignalEvent constructor
-      QueueUpdate(tile, SignalEvent(tile->GetPos(), tile->GetFacing(),
-                                    tile->GetActivation()));
-      markAffected(tile);
+      PushUpdate(tile, SignalEvent(tile->GetPos(), tile->GetFacing(),
+                                   tile->GetActivation()));
+      markAffected(*tile);
     }
-    ++it;
+    if (tile->IsEnabled()) {
+      emitters.Schedule(tile->GetPos(), tile->NextEmitTick(currentTick));
+    }
+  }
+
+  // A compiled circuit evaluates the whole board from the buttons and
+  // emitters, which already hold what their queued updates would pass on.
+  if (engine == SimulationEngine::Compiled && !chunkMemoisation &&
+      BindCircuit()) {
+    updatesProcessed = static_cast<int>(updateQueue.size());
+    updateQueue = std::queue<UpdateEvent>();
+    circuitChanges.clear();
+    circuitInstance->Step(circuitChanges);
+    for (auto* tile : circuitChanges) markAffected(*tile);
   }
 
   constexpr int MAX_UPDATES = 100000;
@@ -121,44 +292,68 @@ Grid::SimulationResult Grid::Simulate() {
       }
     }
 
+    if (chunkMemoisation) {
+      auto memoResult = chunkMemo.Process(update.tile, update.event, tiles);
+      for (const auto& tile : memoResult.touchedTiles) markAffected(*tile);
+      for (const auto& newSignal : memoResult.newSignals) {
+        auto targetPos = TranslatePosition(
+            newSignal.sourcePos, FlipDirection(newSignal.fromDirection));
+        auto targetTileIt = tiles.find(targetPos);
+        if (targetTileIt != tiles.end() &&
+            targetTileIt->second->CanReceiveFrom(newSignal.fromDirection)) {
+          PushUpdate(targetTileIt->second,
+                     SignalEvent(targetPos,
+                                 FlipDirection(newSignal.fromDirection),
+                                 newSignal.isActive));
+        }
+      }
+      // Count the cascade, not the chunk, so the update limit keeps its
+      // meaning.
+      updatesProcessed += memoResult.updatesProcessed - 1;
+    }
 #ifdef SIM_PREPROCESSING
-    if (auto* simObj = update.tile->GetCachedSimObject()) {
+    else if (auto* simObj = engine == SimulationEngine::Preprocessed
+                                ? update.tile->GetCachedSimObject()
+                                : nullptr) {
       auto processResult = simObj->ProcessSignal(update.event);
 
       for (const auto& change : processResult.affectedTiles) {
         if (auto tileIt = tiles.find(change.pos); tileIt != tiles.end()) {
-          markAffected(tileIt->second);
+          markAffected(*tileIt->second);
+        }
+      }
+      for (const auto& change : processResult.affectedGroups) {
+        simResult.affectedGroups.push_back(change);
+        if (!trackingPeriod) continue;
+        for (const auto& tile : tileManager.GetGroupTiles(change.group)) {
+          periodDetector.Update(*tile);
         }
       }
 
+      // Queue the new signal events
       for (const auto& newSignal : processResult.newSignals) {
-        // Queue the new signal events
-        auto targetPos = TranslatePosition(
-            newSignal.sourcePos, FlipDirection(newSignal.fromDirection));
-        auto targetTileIt = tiles.find(targetPos);
-        if (targetTileIt != tiles.end()) {
-          auto& targetTile = targetTileIt->second;
-          if (targetTile->CanReceiveFrom(newSignal.fromDirection)) {
-            QueueUpdate(targetTile,
-                        SignalEvent(newSignal.sourcePos,
-                                    FlipDirection(newSignal.fromDirection),
-                                    newSignal.isActive));
-          }
-        }
+        QueueSignal(newSignal);
       }
     } else {
       // It's just a single object (probably a logic tile, but not necessarily)
-      DebugPrint("Warning: Processing update for unprocessed tile: {}->{}",
-               update.tile->GetPos(),
-               update.event.isActive ? "Active" : "Inactive");
+      if (engine == SimulationEngine::Preprocessed &&
+          deferredRevision != editRevision) {
+        DebugPrint("Warning: Processing update for unprocessed tile: {}->{}",
+                   update.tile->GetPos(),
+                   update.event.isActive ? "Active" : "Inactive");
+      }
       ProcessUpdateEvent(update);
-      markAffected(update.tile);
+      markAffected(*update.tile);
     }
 
 #else
-    ProcessUpdateEvent(update);
-    markAffected(update.tile);
+    else {
+      ProcessUpdateEvent(update);
+      markAffected(*update.tile);
+    }
 #endif
+    // Inputs can change without the tile reporting an activation change.
+    if (trackingPeriod) periodDetector.Update(*update.tile);
     if (enableEdgeCheck) {
       currentTickVisitedEdges.insert(
           SignalEdge{update.tile->GetPos(), update.event.sourcePos});
@@ -168,56 +363,472 @@ Grid::SimulationResult Grid::Simulate() {
   }
 
   // Dirty bits are only valid for this tick.
-  for (const auto& tile : touchedTiles) tile->SetDirtyThisTick(false);
+  for (auto* tile : touchedTiles) tile->SetDirtyThisTick(false);
+  if (trackingPeriod) {
+    for (const auto* tile : touchedTiles) periodDetector.Update(*tile);
+  }
 
   simResult.updatesProcessed = updatesProcessed;
   return simResult;
 }
 
+std::optional<int> Grid::NextEventTick() const {
+  if (fieldIsDirty || !updateQueue.empty()) return currentTick + 1;
+  return emitters.NextDueTick();
+}
+
+int Grid::AdvanceTo(int tick) {
+  if (tick <= currentTick) return currentTick;
+  if (auto next = NextEventTick()) {
+    tick = std::min(tick, *next - 1);
+  }
+  if (tick > currentTick) {
+    emitters.SkipTo(tick);
+    currentTick = tick;
+  }
+  return currentTick;
+}
+
+Grid::SimulationResult Grid::SimulateUntil(int tick) {
+  SimulationResult result{{}, 0, {}};
+  // Tiles can change several times over the run, only their last state is
+  // of interest to the caller.
+  ankerl::unordered_dense::map<vi2d, std::size_t, PositionHash> changeIndex;
+  ankerl::unordered_dense::map<GroupId, std::size_t> groupChangeIndex;
+
+  // A dirty field restarts the clock, so get that out of the way first.
+  if (fieldIsDirty) ResetSimulation();
+
+  if (periodDetection && currentTick < tick) {
+    periodDetector.Rebuild(tiles);
+    trackingPeriod = true;
+  }
+
+  while (AdvanceTo(tick) < tick) {
+    auto stepResult = Simulate();
+    result.updatesProcessed += stepResult.updatesProcessed;
+    for (const auto& change : stepResult.affectedTiles) {
+      auto [it, inserted] =
+          changeIndex.try_emplace(change.pos, result.affectedTiles.size());
+      if (inserted) {
+        result.affectedTiles.push_back(change);
+      } else {
+        result.affectedTiles[it->second] = change;
+      }
+    }
+    for (const auto& change : stepResult.affectedGroups) {
+      auto [it, inserted] = groupChangeIndex.try_emplace(
+          change.group, result.affectedGroups.size());
+      if (inserted) {
+        result.affectedGroups.push_back(change);
+      } else {
+        result.affectedGroups[it->second] = change;
+      }
+    }
+
+    // Simulate() always drains the update queue, so the tile states are all
+    // there is to the board at this point.
+    if (!trackingPeriod) continue;
+    if (auto firstSeen = periodDetector.Record(currentTick)) {
+      const int period = currentTick - *firstSeen;
+      const int skipped = (tick - currentTick) / period * period;
+      DebugPrint("Board state at tick {} repeats tick {}, skipping {} ticks.",
+                 currentTick, *firstSeen, skipped);
+      if (skipped > 0) {
+        currentTick += skipped;
+        emitters.Shift(skipped);
+      }
+      // What is left is shorter than a period, just simulate it.
+      trackingPeriod = false;
+    }
+  }
+  if (periodDetection) {
+    trackingPeriod = false;
+    periodDetector.Clear();
+  }
+  return result;
+}
+
 void Grid::ResetSimulation() {
   currentTick = 0;
+  trackingPeriod = false;
   if (!updateQueue.empty()) {
     updateQueue = std::queue<UpdateEvent>();
   }
   currentTickVisitedEdges.clear();
 
-  // Reset all tiles
-  for (auto& [pos, tile] : tiles) {
-    tile->ResetActivation();
+  // Tiles no source reaches never leave their reset state, so they only
+  // need resetting once per layout.
+  UpdateLiveTiles();
+  if (resetRevision != editRevision) {
+    for (auto& [pos, tile] : tiles) tile->ResetActivation();
+    resetRevision = editRevision;
+  } else {
+    for (const auto& tile : liveTiles) tile->ResetActivation();
+  }
+#ifdef SIM_PREPROCESSING
+  if (deferredPreprocessing && NeedsPreprocessing()) {
+    // The old groups may refer to erased tiles, so tiles step alone until
+    // the new ones are adopted.
+    tileManager.Clear();
+    for (const auto& [pos, tile] : tiles) tile->SetCachedSimObject(nullptr);
+    deferredRevision = editRevision;
+  } else {
+    Preprocess();
+  }
+#endif
+
+#ifdef SIM_PREPROCESSING
+  // Inverters folded into groups are set up by their group instead, unless
+  // the chunk memo bypasses the groups or there are none yet.
+  const bool initGroups = engine == SimulationEngine::Preprocessed &&
+                          !chunkMemoisation &&
+                          deferredRevision != editRevision;
+  if (initGroups) {
+    for (const auto& signal : tileManager.InitGroups()) QueueSignal(signal);
+  }
+#endif
+  for (const auto& tile : liveTiles) {
+#ifdef SIM_PREPROCESSING
+    if (initGroups && tileManager.IsFoldedIntoGroup(*tile)) continue;
+#endif
     auto initState = tile->Init();
     if (initState.empty()) continue;  // No initial state to process
     for (const auto& event : initState) {
-      QueueUpdate(tile, event);
+      PushUpdate(tile, event);
     }
   }
+  emitters.Reset(currentTick);
+  if (circuitInstance) circuitInstance->Resync();
+  fieldIsDirty = false;
+  dirtyRegion.reset();
+  // Tile states were reset, so every chunk has to be rehashed.
+  if (chunkMemoisation) chunkMemo.Rebuild(tiles);
+}
+
+std::unique_ptr<Grid> Grid::Fork() const {
+  auto fork = std::make_unique<Grid>();
+  fork->currentTick = currentTick;
+  fork->fieldIsDirty = fieldIsDirty;
+  fork->engine = engine;
+  fork->editRevision = editRevision;
+  fork->preprocessedRevision = preprocessedRevision;
+  fork->deferredPreprocessing = deferredPreprocessing;
+  fork->deferredRevision = deferredRevision;
+  fork->dirtyRegion = dirtyRegion;
+  // The clones share the tiles' states, live or not, but the live tiles are
+  // found again on demand.
+  fork->resetRevision = resetRevision;
+  fork->prunedTileCount = prunedTileCount;
+  fork->periodDetection = periodDetection;
+  // The fork binds the circuit to its own tiles when it first needs it.
+  fork->compiledCircuit = compiledCircuit;
+
+  fork->tiles.reserve(tiles.size());
+  for (const auto& [pos, tile] : tiles) fork->tiles.emplace(pos, tile->Clone());
+  fork->tileIndex = tileIndex;
+  fork->emitters.CopyFrom(emitters, [&fork](vi2d pos) {
+    return std::static_pointer_cast<EmitterGridTile>(
+        fork->tiles.find(pos)->second);
+  });
+
 #ifdef SIM_PREPROCESSING
-  if (fieldIsDirty) {
-    tileManager.Clear();
-    tileManager.PreprocessTiles(tiles);
-    fieldIsDirty = false;
+  // Preprocessing an edited fork, e.g. in the background, still replays and
+  // adds to the same cache.
+  fork->tileManager.ShareCache(tileManager);
+#endif
+  // An edited field throws its groups and queue away on the next step, and
+  // they may still refer to tiles that are gone by now.
+  if (!fieldIsDirty) {
+#ifdef SIM_PREPROCESSING
+    fork->tileManager.CopyFrom(tileManager, fork->tiles);
+#endif
+    auto pending = updateQueue;
+    while (!pending.empty()) {
+      const auto& update = pending.front();
+      std::shared_ptr<GridTile> tile;
+      if (update.tile) tile = fork->tiles.find(update.tile->GetPos())->second;
+      fork->updateQueue.emplace(std::move(tile), update.event,
+                                static_cast<int>(update.updateCycleId));
+      pending.pop();
+    }
   }
+
+  fork->chunkMemoisation = chunkMemoisation;
+  if (chunkMemoisation) fork->chunkMemo.CopyFrom(chunkMemo, fork->tiles);
+  return fork;
+}
+
+void Grid::Preprocess(std::atomic<float>* progress) {
+#ifdef SIM_PREPROCESSING
+  if (!NeedsPreprocessing()) return;
+  UpdateLiveTiles();
+  tileManager.Clear();
+  tileManager.PreprocessTiles(tiles, liveTiles, progress);
+  preprocessedRevision = editRevision;
+  // Clearing the field for a load resets it too, with nothing to trace.
+  if (!liveTiles.empty()) ++preprocessingPasses;
+#else
+  (void)progress;
 #endif
 }
 
+bool Grid::AdoptPreprocessing(const Grid& fork) {
+#ifdef SIM_PREPROCESSING
+  if (!NeedsPreprocessing() || fork.editRevision != editRevision ||
+      fork.preprocessedRevision != editRevision) {
+    return false;
+  }
+  tileManager.CopyFrom(fork.tileManager, tiles);
+  preprocessedRevision = editRevision;
+  return true;
+#else
+  (void)fork;
+  return false;
+#endif
+}
+
+bool Grid::NeedsPreprocessing() const noexcept {
+#ifdef SIM_PREPROCESSING
+  return engine == SimulationEngine::Preprocessed &&
+         (fieldIsDirty || deferredRevision == editRevision) &&
+         preprocessedRevision != editRevision;
+#else
+  return false;
+#endif
+}
+
+void Grid::SetEngine(SimulationEngine newEngine) {
+  if (!IsEngineAvailable(newEngine)) {
+    throw std::invalid_argument(
+        std::format("The {} simulation engine is not built in",
+                    EngineToString(newEngine)));
+  }
+  if (newEngine == engine) return;
+  engine = newEngine;
+#ifdef SIM_PREPROCESSING
+  // The legacy engine keeps no groups, and the preprocessed one builds them
+  // afresh on the reset below.
+  tileManager.Clear();
+  for (const auto& [pos, tile] : tiles) tile->SetCachedSimObject(nullptr);
+#endif
+  preprocessedRevision.reset();
+  fieldIsDirty = true;
+}
+
+std::optional<vi2d> Grid::FindDivergence(const Grid& other) const {
+  for (const auto& [pos, tile] : tiles) {
+    auto it = other.tiles.find(pos);
+    if (it == other.tiles.end() ||
+        it->second->GetTileType() != tile->GetTileType()) {
+      return pos;
+    }
+    // Groups only keep their tiles' activation up to date, not which sides
+    // they were fed from, so the rest of the state bits are left out.
+    if (tile->GetActivation() != it->second->GetActivation() ||
+        tile->GetState().extra != it->second->GetState().extra) {
+      return pos;
+    }
+  }
+  if (other.tiles.size() != tiles.size()) {
+    for (const auto& [pos, tile] : other.tiles) {
+      if (!tiles.contains(pos)) return pos;
+    }
+  }
+  return std::nullopt;
+}
+
+void Grid::SetChunkMemoisation(bool enabled) {
+  if (enabled == chunkMemoisation) return;
+  chunkMemoisation = enabled;
+  if (enabled) {
+    chunkMemo.Rebuild(tiles);
+  } else {
+    chunkMemo.Clear();
+  }
+}
+
 void ElecSim::Grid::SetTile(vi2d pos, std::shared_ptr<GridTile> tile) {
   tile->SetPos(pos);
   auto [mapElement, inserted] = tiles.insert_or_assign(pos, tile);
+  if (inserted) tileIndex.Insert(pos);
   if (mapElement->second->IsEmitter()) {
-    emitters.push_back(mapElement->second);
+    emitters.Register(
+        std::static_pointer_cast<EmitterGridTile>(mapElement->second));
+  } else if (!inserted) {
+    emitters.Unregister(pos);
   }
-  fieldIsDirty = true;  // Mark the field as modified
+  MarkFieldDirty({pos, pos});
+}
+
+Grid::EditResult Grid::SetTiles(
+    std::span<const std::shared_ptr<GridTile>> newTiles) {
+  EditResult result;
+  if (newTiles.empty()) return result;
+  tiles.reserve(tiles.size() + newTiles.size());
+
+  TileRegion region{newTiles.front()->GetPos(), newTiles.front()->GetPos()};
+  for (const auto& tile : newTiles) {
+    const vi2d pos = tile->GetPos();
+    region.Include({pos, pos});
+    auto [it, inserted] = tiles.try_emplace(pos, tile);
+    if (inserted) {
+      tileIndex.Insert(pos);
+      continue;
+    }
+    if (it->second->IsEmitter()) emitters.Unregister(pos);
+    result.replacedTiles.push_back(std::exchange(it->second, tile));
+  }
+
+  // Emitters are registered once all tiles are in, and only if nothing later
+  // in the batch took their position again.
+  for (const auto& tile : newTiles) {
+    if (!tile->IsEmitter()) continue;
+    if (tiles.find(tile->GetPos())->second != tile) continue;
+    emitters.Register(std::static_pointer_cast<EmitterGridTile>(tile));
+  }
+
+  MarkFieldDirty(region);
+  result.region = region;
+  return result;
+}
+
+Grid::EditResult Grid::EraseTiles(std::span<const vi2d> positions) {
+  EditResult result;
+  for (const auto& pos : positions) {
+    auto it = tiles.find(pos);
+    if (it == tiles.end()) continue;
+    if (it->second->IsEmitter()) emitters.Unregister(pos);
+    result.replacedTiles.push_back(std::move(it->second));
+    tiles.erase(it);
+    tileIndex.Erase(pos);
+    if (result.region) {
+      result.region->Include({pos, pos});
+    } else {
+      result.region = TileRegion{pos, pos};
+    }
+  }
+  if (result.region) MarkFieldDirty(*result.region);
+  return result;
+}
+
+void Grid::MarkFieldDirty(const TileRegion& region) noexcept {
+  fieldIsDirty = true;
+  ++editRevision;
+  if (dirtyRegion) {
+    dirtyRegion->Include(region);
+  } else {
+    dirtyRegion = region;
+  }
+}
+
+void Grid::UpdateLiveTiles() {
+  if (liveRevision == editRevision) return;
+  liveTiles = FindLiveTiles(tiles);
+  liveTileSet.clear();
+  for (const auto& tile : liveTiles) liveTileSet.insert(tile.get());
+  liveRevision = editRevision;
+  prunedTileCount = tiles.size() - liveTiles.size();
+  if (prunedTileCount > 0) {
+    DebugPrint("Pruned {} of {} tiles that no signal source can reach",
+               prunedTileCount, tiles.size());
+  }
+}
+
+bool Grid::BindCircuit() {
+  if (!compiledCircuit) return false;
+  if (circuitRevision != editRevision) {
+    circuitRevision = editRevision;
+    circuitInstance = compiledCircuit->Bind(tiles, HashLayout(tiles));
+    if (!circuitInstance) {
+      DebugPrint("Circuit {} was compiled from another layout, simulating "
+                 "tile by tile",
+                 compiledCircuit->GetPath().string());
+    }
+  }
+  return circuitInstance.has_value();
+}
+
+void Grid::SetCompiledCircuit(std::shared_ptr<const CompiledCircuit> circuit) {
+  compiledCircuit = std::move(circuit);
+  circuitInstance.reset();
+  circuitRevision.reset();
+  fieldIsDirty = true;
 }
 
 void Grid::InteractWithTile(vi2d pos) noexcept {
   if (std::optional tileOpt = GetTile(pos)) {
     auto tile = tileOpt.value();
     auto newSignals = tile->Interact();
+    // Interacting can change the tile without queueing anything.
+    if (chunkMemoisation) chunkMemo.MarkStale(pos);
+    NoteOutsideChange(*tile);
     for (const auto& signal : newSignals) {
       QueueUpdate(tile, signal);
     }
   }
 }
 
+const std::vector<std::shared_ptr<GridTile>>& Grid::GetGroupTiles(
+    GroupId group) const noexcept {
+#ifdef SIM_PREPROCESSING
+  return tileManager.GetGroupTiles(group);
+#else
+  (void)group;
+  static const std::vector<std::shared_ptr<GridTile>> noTiles;
+  return noTiles;
+#endif
+}
+
+void Grid::SetPreprocessCache(const std::string& directory) {
+#ifdef SIM_PREPROCESSING
+  tileManager.SetCache(directory.empty()
+                           ? nullptr
+                           : std::make_shared<PreprocessCache>(directory));
+#else
+  (void)directory;
+#endif
+}
+
+std::pair<std::size_t, std::size_t> Grid::GetPreprocessCacheStats()
+    const noexcept {
+#ifdef SIM_PREPROCESSING
+  if (const auto* cache = tileManager.GetCache()) {
+    return {cache->GetHits(), cache->GetMisses()};
+  }
+#endif
+  return {0, 0};
+}
+
+std::uint32_t Grid::GetGroupRevision() const noexcept {
+#ifdef SIM_PREPROCESSING
+  return tileManager.GetGroupRevision();
+#else
+  return 0;
+#endif
+}
+
+std::size_t Grid::GetGroupCount() const noexcept {
+#ifdef SIM_PREPROCESSING
+  return tileManager.GetGroupCount();
+#else
+  return 0;
+#endif
+}
+
+std::pair<const GridTile*, bool> Grid::GetGroupInput(
+    GroupId group) const noexcept {
+#ifdef SIM_PREPROCESSING
+  return {tileManager.GetGroupInputTile(group),
+          tileManager.IsInvertedGroup(group)};
+#else
+  (void)group;
+  return {nullptr, false};
+#endif
+}
+
+std::uint64_t Grid::GetLayoutHash() const { return HashLayout(tiles); }
+
 vi2d Grid::AlignToGrid(const vf2d& pos) noexcept {
   return vi2d(static_cast<int>(std::floor(pos.x)),
               static_cast<int>(std::floor(pos.y)));
@@ -230,20 +841,24 @@ std::optional<std::shared_ptr<GridTile> const> Grid::GetTile(vi2d pos) {
 
 std::vector<std::weak_ptr<GridTile>> Grid::GetSelection(vi2d startPos,
                                                         vi2d endPos) {
-  vi2d topLeft = startPos.min(endPos);
-  vi2d bottomRight = startPos.max(endPos);
-
-  // Replace this complex view chain with a simple loop
   std::vector<std::weak_ptr<GridTile>> result;
-  for (const auto& [pos, tile] : tiles) {
-    if (pos.x >= topLeft.x && pos.x <= bottomRight.x && pos.y >= topLeft.y &&
-        pos.y <= bottomRight.y) {
-      result.emplace_back(tile);
-    }
-  }
+  tileIndex.ForEachIn(startPos.min(endPos), startPos.max(endPos),
+                      [this, &result](vi2d pos) {
+                        result.emplace_back(tiles.find(pos)->second);
+                      });
   return result;
 }
 
+std::vector<vi2d> Grid::GetTilePositions(vi2d startPos, vi2d endPos) const {
+  return tileIndex.Query(startPos.min(endPos), startPos.max(endPos));
+}
+
+std::vector<vi2d> Grid::EraseSelection(vi2d startPos, vi2d endPos) {
+  auto positions = GetTilePositions(startPos, endPos);
+  EraseTiles(positions);
+  return positions;
+}
+
 void Grid::Save(const std::string& filename) {
   std::ofstream file(filename, std::ios::binary);
   if (!file) {
@@ -251,24 +866,55 @@ void Grid::Save(const std::string& filename) {
     return;
   }
 
-  size_t dataSize = 0;
-  auto serializedTileData =
-      tiles | std::views::values | std::views::transform([](const auto& tile) {
-        return tile->Serialize();
-      }) |
-      std::views::transform([](const auto& data) -> std::vector<char> {
-        return std::vector<char>(data.begin(), data.end());
-      }) |
-      std::views::chunk(1000);
-  for (const auto& chunk : serializedTileData) {
-    auto chunkData =
-        chunk | std::views::join | std::ranges::to<std::vector<char>>();
-    file.write(chunkData.data(),
-               static_cast<std::streamsize>(chunkData.size()));
-    dataSize += chunkData.size();
-  }
-  DebugPrint("Saved {} bytes to {}, total tiles: {}", dataSize, filename, tiles.size());
-  (void)dataSize; // Silence unused variable warning in release mode
+  const auto data = Serialize();
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+  DebugPrint("Saved {} bytes to {}, total tiles: {}", data.size(), filename,
+             tiles.size());
+  file.close();
+}
+
+std::vector<char> Grid::Serialize() {
+  std::vector<char> data;
+  data.reserve(tiles.size() * GRIDTILE_BYTESIZE);
+  for (const auto& tile : tiles | std::views::values) {
+    const auto serialized = tile->Serialize();
+    data.insert(data.end(), serialized.begin(), serialized.end());
+  }
+#ifdef SIM_PREPROCESSING
+  // Preprocessing is only current as long as the field is untouched.
+  if (engine == SimulationEngine::Preprocessed && !fieldIsDirty &&
+      !NeedsPreprocessing()) {
+    const TopologyHeader header{TOPOLOGY_MARKER, TOPOLOGY_VERSION,
+                                HashLayout(tiles)};
+    const auto* bytes = reinterpret_cast<const char*>(&header);
+    data.insert(data.end(), bytes, bytes + sizeof(header));
+    tileManager.SaveTopology(data);
+  }
+#endif
+  return data;
+}
+
+void Grid::Save(const std::string& filename, vi2d startPos, vi2d endPos) {
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    DebugPrint("Error opening file for writing: {}", filename);
+    return;
+  }
+
+  std::vector<char> data;
+  std::size_t tileCount = 0;
+  tileIndex.ForEachIn(startPos.min(endPos), startPos.max(endPos),
+                      [&](vi2d pos) {
+                        const auto serialized =
+                            tiles.find(pos)->second->Serialize();
+                        data.insert(data.end(), serialized.begin(),
+                                    serialized.end());
+                        ++tileCount;
+                      });
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+  DebugPrint("Saved {} bytes to {}, total tiles: {}", data.size(), filename,
+             tileCount);
+  (void)tileCount; // Silence unused variable warning in release mode
   file.close();
 }
 
@@ -281,6 +927,8 @@ void Grid::Load(const std::string& filename) {
 
   Clear();
   size_t dataSize = 0;
+  std::optional<TopologyHeader> topologyHeader;
+  std::vector<char> topology;
   while (file) {
     std::array<char, GRIDTILE_BYTESIZE> data;
     file.read(data.data(), data.size());
@@ -292,10 +940,26 @@ void Grid::Load(const std::string& filename) {
     dataSize += static_cast<size_t>(file.gcount());
     if (file.gcount() == 0) break;
 
+    if (file.gcount() == GRIDTILE_BYTESIZE &&
+        *reinterpret_cast<int*>(data.data()) == TOPOLOGY_MARKER) {
+      // The rest of the file is the saved topology.
+      topologyHeader.emplace();
+      std::memcpy(&*topologyHeader, data.data(), sizeof(TopologyHeader));
+      topology.assign(std::istreambuf_iterator<char>(file),
+                      std::istreambuf_iterator<char>());
+      dataSize += topology.size();
+      break;
+    }
+
     std::unique_ptr<GridTile> tile = GridTile::Deserialize(data);
-    auto [mapPair, _] = tiles.insert_or_assign(tile->GetPos(), std::move(tile));
+    auto [mapPair, inserted] =
+        tiles.insert_or_assign(tile->GetPos(), std::move(tile));
+    if (inserted) tileIndex.Insert(mapPair->first);
     if (mapPair->second->IsEmitter()) {
-      emitters.push_back(mapPair->second);
+      emitters.Register(
+          std::static_pointer_cast<EmitterGridTile>(mapPair->second));
+    } else if (!inserted) {
+      emitters.Unregister(mapPair->first);
     }
   }
 
@@ -303,7 +967,153 @@ void Grid::Load(const std::string& filename) {
   DebugPrint("Loaded {} bytes from {}, total {} tiles", dataSize, filename, tiles.size());
   (void)dataSize; // Silence unused variable warning in release mode
   fieldIsDirty = true;  // Mark the field as modified
-  ResetSimulation();    // So that this preprocesses the tiles
+  ++editRevision;
+#ifdef SIM_PREPROCESSING
+  // A topology saved for this very layout spares preprocessing it again.
+  if (engine == SimulationEngine::Preprocessed && topologyHeader &&
+      topologyHeader->version == TOPOLOGY_VERSION &&
+      topologyHeader->layoutHash == HashLayout(tiles) &&
+      tileManager.LoadTopology(topology, tiles)) {
+    fieldIsDirty = false;
+  }
+#endif
+  ResetSimulation();    // So that this preprocesses the tiles if needed
+}
+
+void Grid::SaveState(const std::string& filename) {
+  // The state of an edited field is thrown away on the next step anyway.
+  if (fieldIsDirty) ResetSimulation();
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    DebugPrint("Error opening file for writing: {}", filename);
+    return;
+  }
+
+  std::vector<UpdateRecord> updates;
+  updates.reserve(updateQueue.size());
+  for (auto pending = updateQueue; !pending.empty(); pending.pop()) {
+    const auto& update = pending.front();
+    // Simulate() skips updates without a tile, so they need not be kept.
+    if (!update.tile) continue;
+    updates.push_back({update.tile->GetPos(), update.event.sourcePos,
+                       static_cast<std::int32_t>(update.event.fromDirection),
+                       update.event.isActive ? 1 : 0, update.updateCycleId});
+  }
+
+  const StateHeader header{STATE_MAGIC,
+                           STATE_VERSION,
+                           HashLayout(tiles),
+                           currentTick,
+                           static_cast<std::uint32_t>(tiles.size()),
+                           static_cast<std::uint32_t>(updates.size()),
+                           0};
+  std::vector<char> data(sizeof(StateHeader) +
+                         tiles.size() * sizeof(TileStateRecord) +
+                         updates.size() * sizeof(UpdateRecord));
+  char* out = data.data();
+  auto append = [&out](const auto& record) {
+    std::memcpy(out, &record, sizeof(record));
+    out += sizeof(record);
+  };
+  append(header);
+  for (const auto& [pos, tile] : tiles) {
+    append(TileStateRecord{pos, tile->GetState()});
+  }
+  for (const auto& update : updates) append(update);
+
+  file.write(data.data(), static_cast<std::streamsize>(data.size()));
+  DebugPrint("Saved simulation state at tick {} to {}, {} bytes", currentTick,
+             filename, data.size());
+  file.close();
+}
+
+bool Grid::LoadState(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file) {
+    DebugPrint("Error opening file for reading: {}", filename);
+    return false;
+  }
+  std::vector<char> data(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(data.data(), static_cast<std::streamsize>(data.size()));
+  if (!file) {
+    throw std::runtime_error(
+        std::format("Error reading simulation state from file: {}", filename));
+  }
+
+  StateHeader header;
+  if (data.size() < sizeof(header)) {
+    throw std::runtime_error(std::format(
+        "Invalid simulation state in {}: file is too short", filename));
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic != STATE_MAGIC || header.version != STATE_VERSION) {
+    throw std::runtime_error(std::format(
+        "Invalid simulation state in {}: unknown format", filename));
+  }
+  const std::size_t expectedSize = sizeof(StateHeader) +
+                                   header.tileCount * sizeof(TileStateRecord) +
+                                   header.updateCount * sizeof(UpdateRecord);
+  if (data.size() != expectedSize) {
+    throw std::runtime_error(std::format(
+        "Invalid simulation state in {}: expected {} bytes, got {}", filename,
+        expectedSize, data.size()));
+  }
+  if (header.tileCount != tiles.size() ||
+      header.layoutHash != HashLayout(tiles)) {
+    DebugPrint("Simulation state in {} belongs to a different layout",
+               filename);
+    return false;
+  }
+
+  // Preprocess an edited field now, so that does not reset the state later.
+  if (fieldIsDirty) ResetSimulation();
+  const char* in = data.data() + sizeof(StateHeader);
+  auto next = [&in](auto& record) {
+    std::memcpy(&record, in, sizeof(record));
+    in += sizeof(record);
+  };
+  auto tileAt = [this,
+                 &filename](vi2d pos) -> const std::shared_ptr<GridTile>& {
+    auto it = tiles.find(pos);
+    if (it == tiles.end()) {
+      throw std::runtime_error(std::format(
+          "Invalid simulation state in {}: no tile at {}", filename, pos));
+    }
+    return it->second;
+  };
+
+  for (std::uint32_t i = 0; i < header.tileCount; ++i) {
+    TileStateRecord record;
+    next(record);
+    tileAt(record.pos)->SetState(record.state);
+  }
+  currentTick = header.currentTick;
+  updateQueue = std::queue<UpdateEvent>();
+  for (std::uint32_t i = 0; i < header.updateCount; ++i) {
+    UpdateRecord record;
+    next(record);
+    updateQueue.emplace(
+        tileAt(record.tilePos),
+        SignalEvent(record.sourcePos,
+                    static_cast<Direction>(record.fromDirection),
+                    record.isActive != 0),
+        static_cast<int>(record.updateCycleId));
+  }
+
+  trackingPeriod = false;
+  currentTickVisitedEdges.clear();
+  // The state may have taken tiles that are not live out of their reset state.
+  resetRevision.reset();
+  // Emitters schedule themselves from their own timing state, which is
+  // restored by now.
+  emitters.Reset(currentTick);
+  if (chunkMemoisation) chunkMemo.Rebuild(tiles);
+  if (circuitInstance) circuitInstance->Resync();
+  DebugPrint("Loaded simulation state at tick {} from {}", currentTick,
+             filename);
+  return true;
 }
 
 }  // namespace ElecSim
\ No newline at end of file
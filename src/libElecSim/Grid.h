@@ -1,13 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <queue>
+#include <span>
 #include <string>
+#include <string_view>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "ChunkMemo.h"
+#include "CompiledCircuit.h"
+#include "EmitterRegistry.h"
 #include "GridTileTypes.h"  // Include this for derived tile types
+#include "PeriodDetector.h"
+#include "SpatialIndex.h"
 #include "ankerl/unordered_dense.h"
 #include "v2d.h"
 #ifdef SIM_PREPROCESSING
@@ -16,6 +26,29 @@
 
 namespace ElecSim {
 
+/**
+ * @brief How Grid::Simulate() processes updates. All give the same
+ * results, which lets one check another.
+ */
+enum class SimulationEngine {
+  Legacy,        // Tile by tile, following every signal
+  Preprocessed,  // Whole deterministic paths at once, see TileGroupManager
+  Compiled,      // Natively, see Grid::SetCompiledCircuit()
+};
+
+// Preprocessed is only built in with SIM_PREPROCESSING, and preferred then.
+#ifdef SIM_PREPROCESSING
+inline constexpr SimulationEngine DEFAULT_ENGINE =
+    SimulationEngine::Preprocessed;
+#else
+inline constexpr SimulationEngine DEFAULT_ENGINE = SimulationEngine::Legacy;
+#endif
+[[nodiscard]] bool IsEngineAvailable(SimulationEngine engine) noexcept;
+[[nodiscard]] std::string_view EngineToString(SimulationEngine engine) noexcept;
+// Accepts the names EngineToString() gives, in lower case.
+[[nodiscard]] std::optional<SimulationEngine> ParseEngine(
+    std::string_view name) noexcept;
+
 struct SignalEdge {
   vi2d sourcePos;
   vi2d targetPos;
@@ -36,12 +69,55 @@ class Grid {
 
   int currentTick = 0;        // Current game tick (used by emitters)
   bool fieldIsDirty = false;  // Flag to indicate if the field has been modified
+  std::uint64_t editRevision = 0;  // Bumped on every change to the layout
+  // Layout revision the groups were built for ahead of the next reset, see
+  // Preprocess()
+  std::optional<std::uint64_t> preprocessedRevision;
+  bool deferredPreprocessing = false;  // See SetDeferredPreprocessing()
+  // Layout revision a reset left without groups, for AdoptPreprocessing()
+  std::optional<std::uint64_t> deferredRevision;
+  std::size_t preprocessingPasses = 0;  // See GetPreprocessingPasses()
+  // Bounding box of every edit since the field was last preprocessed
+  std::optional<TileRegion> dirtyRegion;
+  // The tiles a signal source can reach, in tile order, as found for the
+  // layout revision in liveRevision. See UpdateLiveTiles().
+  std::vector<std::shared_ptr<GridTile>> liveTiles;
+  ankerl::unordered_dense::set<const GridTile*> liveTileSet;
+  std::optional<std::uint64_t> liveRevision;
+  std::size_t prunedTileCount = 0;
+  // Layout revision all tiles were last reset for. The others keep their
+  // reset state, so later resets of the same layout only reset live tiles.
+  // Cleared when a tile that is not live is changed from outside.
+  std::optional<std::uint64_t> resetRevision;
 
   TileField tiles;
+  SpatialIndex tileIndex;  // Occupied positions by chunk, for region queries
 #ifdef SIM_PREPROCESSING
   TileGroupManager tileManager;  // Tile manager for simulation caching
 #endif
-  std::vector<std::weak_ptr<GridTile>> emitters;
+  EmitterRegistry emitters;
+  // Scratch buffer for the emitters due in the current tick
+  std::vector<std::shared_ptr<EmitterGridTile>> dueEmitters;
+
+  // Periodic steady state detection, see SetPeriodDetection(). The detector
+  // is only fed while SimulateUntil() is tracking a run.
+  bool periodDetection = false;
+  bool trackingPeriod = false;
+  PeriodDetector periodDetector;
+
+  SimulationEngine engine = DEFAULT_ENGINE;  // See SetEngine()
+
+  // See SetCompiledCircuit(). The instance is bound to the tiles lazily,
+  // once per layout revision, which circuitRevision holds.
+  std::shared_ptr<const CompiledCircuit> compiledCircuit;
+  std::optional<CompiledCircuit::Instance> circuitInstance;
+  std::optional<std::uint64_t> circuitRevision;
+  // Scratch buffer for the tiles a compiled step changed
+  std::vector<GridTile*> circuitChanges;
+
+  // Memoised chunk transitions, see SetChunkMemoisation().
+  bool chunkMemoisation = false;
+  ChunkMemo chunkMemo;
 
   // Using a segmented set here because we are inserting a lot of things
 
@@ -49,11 +125,37 @@ class Grid {
   std::queue<UpdateEvent> updateQueue;
 
   void ProcessUpdateEvent(const UpdateEvent& updateEvent);
+  // Queues a signal sent out by a tile or group for the tile it is sent to,
+  // if that one receives from that side.
+  void QueueSignal(const SignalEvent& signal);
+  // Queues without telling the chunk memo; only for updates that come out of
+  // the simulation itself, which the memo already accounts for.
+  void PushUpdate(std::shared_ptr<GridTile> tile, const SignalEvent& event);
+  // Notes a change from outside the simulation, which may take a tile that
+  // is not live out of its reset state.
+  void NoteOutsideChange(const GridTile& tile);
+  // Flags the field as modified within a region.
+  void MarkFieldDirty(const TileRegion& region) noexcept;
+  // Finds the live tiles again if the layout changed since they were found.
+  void UpdateLiveTiles();
+  // Binds the compiled circuit to the tiles if it was not yet for this
+  // layout. Tells whether there is a circuit for the layout.
+  bool BindCircuit();
 
  public:
   struct SimulationResult {
     std::vector<TileStateChange> affectedTiles;
     int updatesProcessed;
+    // Tile groups that changed as a whole, in the order they did. Their
+    // tiles (see GetGroupTiles()) are not repeated in affectedTiles.
+    std::vector<GroupStateChange> affectedGroups;
+  };
+
+  struct EditResult {
+    // Tiles that were overwritten or erased, in the order they went
+    std::vector<std::shared_ptr<GridTile>> replacedTiles;
+    // Bounding box of the positions written to, if there were any
+    std::optional<TileRegion> region;
   };
 
   Grid() {};
@@ -72,22 +174,119 @@ class Grid {
    * @return SimulationResult containing affected tiles and update count
    */
   SimulationResult Simulate();
+
+  /**
+   * @brief Finds the next tick at which anything on the board can change.
+   * Pending updates or an edited field mean the very next tick, otherwise
+   * it is the next tick an emitter is scheduled to fire at.
+   * @return The tick, or std::nullopt if the board is idle for good
+   */
+  [[nodiscard]] std::optional<int> NextEventTick() const;
+
+  /**
+   * @brief Skips the clock ahead over ticks in which nothing can happen,
+   * without simulating them. Stops right before the next event.
+   * @param tick The tick to advance to
+   * @return The tick the clock was actually advanced to
+   */
+  int AdvanceTo(int tick);
+
+  /**
+   * @brief Simulates up to and including the given tick, skipping idle
+   * stretches in between. The cost is proportional to the ticks in which
+   * something happens, not to the number of ticks passed. An edited field
+   * restarts the clock at tick 0 first, like Simulate() does. With period
+   * detection on, the run also stops simulating once the board state
+   * repeats and jumps over all remaining whole periods.
+   * @param tick The tick to simulate until
+   * @return SimulationResult with the final state of every tile that changed
+   * along the way and the total update count
+   */
+  SimulationResult SimulateUntil(int tick);
   
   /**
    * @brief Resets the simulation state to initial conditions.
    */
   void ResetSimulation();
 
+  /**
+   * @brief Makes an independent copy of the board in its current state, to
+   * try a button sequence or a circuit variant on and throw away after.
+   * Tile states, queued updates, the emitter schedule and the clock carry
+   * over, and so does the preprocessing: the fork gets the same groups over
+   * its own tiles instead of tracing them again. The chunk memo's cache is
+   * shared until either side adds to it.
+   * @return The fork; simulating or editing it leaves this grid untouched
+   */
+  [[nodiscard]] std::unique_ptr<Grid> Fork() const;
+
+  /**
+   * @brief Preprocesses an edited field ahead of the next reset, which then
+   * skips it. Meant to run on a Fork() in the background, see
+   * AdoptPreprocessing(). Does nothing if there is nothing to preprocess.
+   * @param progress If given, kept updated with the fraction of tiles done
+   */
+  void Preprocess(std::atomic<float>* progress = nullptr);
+  /**
+   * @brief Makes resets of an edited field skip preprocessing and drop the
+   * old groups, so the preprocessed engine steps the tiles one by one until
+   * AdoptPreprocessing() hands it the groups of a fork preprocessed in the
+   * background. Simulating then never waits for preprocessing.
+   * @param deferred Whether to leave preprocessing to a fork
+   */
+  void SetDeferredPreprocessing(bool deferred) noexcept {
+    deferredPreprocessing = deferred;
+  }
+  /**
+   * @brief Takes over the groups a fork built in Preprocess(), so the next
+   * reset need not preprocess at all. With deferred preprocessing, the
+   * groups take over mid-run from the tiles stepping one by one.
+   * @param fork A Fork() of this grid, preprocessed since
+   * @return false if this grid was edited after the fork was made, in which
+   * case it is left alone
+   */
+  bool AdoptPreprocessing(const Grid& fork);
+  /**
+   * @brief Tells whether the next reset would have to preprocess, or the
+   * last one deferred preprocessing.
+   */
+  [[nodiscard]] bool NeedsPreprocessing() const noexcept;
+  /**
+   * @brief Tells when the layout last changed, to notice edits by polling.
+   * @return A counter bumped on every edit
+   */
+  [[nodiscard]] std::uint64_t GetEditRevision() const noexcept {
+    return editRevision;
+  }
+
   // Grid manipulation
   void EraseTile(vi2d pos) {
-    tiles.erase(pos);
-    fieldIsDirty = true;
+    if (tiles.erase(pos) == 0) return;
+    tileIndex.Erase(pos);
+    emitters.Unregister(pos);
+    MarkFieldDirty({pos, pos});
   }
   void EraseTile(int x, int y) { EraseTile(vi2d(x, y)); }
 
   // Sets a tile at the given position, overwriting the position is currently
   // has stored internally.
   void SetTile(vi2d pos, std::shared_ptr<GridTile> tile);
+
+  /**
+   * @brief Places many tiles at once, each at its own GetPos(). Reserves map
+   * space once, registers each emitter once even if a position repeats (the
+   * last tile for a position wins) and flags the field dirty once.
+   * @param newTiles The tiles to place
+   * @return The tiles that were overwritten and the region written to
+   */
+  EditResult SetTiles(std::span<const std::shared_ptr<GridTile>> newTiles);
+  /**
+   * @brief Erases many tiles at once, flagging the field dirty once.
+   * Positions without a tile are skipped.
+   * @param positions The positions to clear
+   * @return The tiles that were erased and the region they covered
+   */
+  EditResult EraseTiles(std::span<const vi2d> positions);
   // Expects a container of buffer tiles, which have coordinates relative to the
   // buffer system they are in. Supports any iterable container holding
   // std::unique_ptr<GridTile> or types convertible to it (e.g.,
@@ -100,11 +299,17 @@ class Grid {
       } -> std::same_as<std::unique_ptr<GridTile>>;
     }
   void SetSelection(vi2d startPos, Range&& bufferTiles) {
+    std::vector<std::shared_ptr<GridTile>> placed;
+    if constexpr (std::ranges::sized_range<Range>) {
+      placed.reserve(std::ranges::size(bufferTiles));
+    }
     for (auto tile : bufferTiles) {
       auto pos = tile->GetPos() + startPos;
       std::unique_ptr<GridTile> converted = std::move(tile);
-      SetTile(pos, std::move(converted));
+      converted->SetPos(pos);
+      placed.push_back(std::move(converted));
     }
+    SetTiles(placed);
   }
 
   void InteractWithTile(vi2d pos) noexcept;
@@ -122,19 +327,210 @@ class Grid {
 
   [[nodiscard]] const auto& GetTiles() const noexcept { return tiles; }
 
+  /**
+   * @brief Looks up the tiles behind a GroupStateChange.
+   * @param group Id of the group
+   * @return The tiles sharing the group's activation, empty for an unknown id
+   */
+  [[nodiscard]] const std::vector<std::shared_ptr<GridTile>>& GetGroupTiles(
+      GroupId group) const noexcept;
+  /**
+   * @brief Tells when group ids were last reassigned. Any id obtained under
+   * an older revision is meaningless now.
+   * @return A counter bumped on every preprocessing pass
+   */
+  [[nodiscard]] std::uint32_t GetGroupRevision() const noexcept;
+  /**
+   * @brief Tells how many group ids the last preprocessing pass handed out.
+   * Ids run from 0 to just below it.
+   */
+  [[nodiscard]] std::size_t GetGroupCount() const noexcept;
+  /**
+   * @brief Looks up the tile a group's tiles take their activation from.
+   * @param group Id of the group
+   * @return The group's input tile, nullptr for an unknown id, and whether
+   * the group's tiles hold the opposite of its activation
+   */
+  [[nodiscard]] std::pair<const GridTile*, bool> GetGroupInput(
+      GroupId group) const noexcept;
+  /**
+   * @brief Tells how often this grid traced its tiles in a preprocessing
+   * pass. Groups loaded with a saved topology or adopted from a fork do not
+   * count, so this tells whether those spared the work.
+   * @return The number of passes
+   */
+  [[nodiscard]] std::size_t GetPreprocessingPasses() const noexcept {
+    return preprocessingPasses;
+  }
+
+  /**
+   * @brief Tells which part of the field was edited since it was last
+   * preprocessed, for consumers that only want to redo that part.
+   * @return Bounding box of the edits, or std::nullopt if there were none
+   */
+  [[nodiscard]] const std::optional<TileRegion>& GetDirtyRegion()
+      const noexcept {
+    return dirtyRegion;
+  }
+
   std::vector<std::weak_ptr<GridTile>> GetSelection(vi2d startPos, vi2d endPos);
+  /**
+   * @brief Lists the occupied positions within a rectangle. Costs time
+   * proportional to the tiles in it, not to its area.
+   * @param startPos One corner of the rectangle, inclusive
+   * @param endPos The opposite corner, inclusive
+   * @return The positions of the tiles in the rectangle
+   */
+  [[nodiscard]] std::vector<vi2d> GetTilePositions(vi2d startPos,
+                                                   vi2d endPos) const;
+  /**
+   * @brief Erases every tile within a rectangle.
+   * @param startPos One corner of the rectangle, inclusive
+   * @param endPos The opposite corner, inclusive
+   * @return The positions that were erased
+   */
+  std::vector<vi2d> EraseSelection(vi2d startPos, vi2d endPos);
   std::size_t GetTileCount() { return tiles.size(); }
+  /**
+   * @brief Tells how many tiles no signal source can reach. Those never
+   * change state, so resets and preprocessing leave them out.
+   * @return The count as of the last reset or preprocessing pass
+   */
+  [[nodiscard]] std::size_t GetPrunedTileCount() const noexcept {
+    return prunedTileCount;
+  }
+  /**
+   * @brief Lists the tiles a signal source can reach, in tile order.
+   * @return The tiles as of the last reset or preprocessing pass
+   */
+  [[nodiscard]] std::span<const std::shared_ptr<GridTile>> GetLiveTiles()
+      const noexcept {
+    return liveTiles;
+  }
+  /**
+   * @brief Identifies the layout regardless of tile order, like the hash
+   * saved topologies and checkpoints are checked against.
+   */
+  [[nodiscard]] std::uint64_t GetLayoutHash() const;
+
+  /**
+   * @brief Enables hashing the board state every tick of SimulateUntil() to
+   * detect periodic steady states and extrapolate over them. Costs one pass
+   * over all tiles per SimulateUntil() call plus a rehash of the tiles each
+   * tick touches.
+   * @param enabled Whether to detect periods
+   */
+  void SetPeriodDetection(bool enabled) noexcept { periodDetection = enabled; }
+  [[nodiscard]] bool GetPeriodDetection() const noexcept {
+    return periodDetection;
+  }
+  [[nodiscard]] int GetCurrentTick() const noexcept { return currentTick; }
+
+  /**
+   * @brief Selects how updates are processed. The choice takes effect from
+   * scratch: the next step resets the simulation, like after an edit.
+   * Chunk memoisation, when on, takes precedence over either engine.
+   * @param newEngine The engine to use
+   * @throws std::invalid_argument if the engine was not built in
+   */
+  void SetEngine(SimulationEngine newEngine);
+  [[nodiscard]] SimulationEngine GetEngine() const noexcept { return engine; }
+
+  /**
+   * @brief Gives the compiled engine the board's logic compiled to native
+   * code by CircuitCompiler. It only applies to the layout it was compiled
+   * from: once the board is edited, the compiled engine falls back to
+   * simulating tile by tile. Takes effect from scratch, like SetEngine().
+   * Only the tiles' activations are kept up to date by the circuit, and
+   * signals written into tiles from outside are dropped, as it evaluates
+   * the whole board from its buttons and emitters.
+   * @param circuit The circuit, or nullptr to drop it
+   */
+  void SetCompiledCircuit(std::shared_ptr<const CompiledCircuit> circuit);
+  [[nodiscard]] const std::shared_ptr<const CompiledCircuit>&
+  GetCompiledCircuit() const noexcept {
+    return compiledCircuit;
+  }
+
+  /**
+   * @brief Compares every tile's activation, and any state beyond the state
+   * bits, with a board of the same layout, e.g. the same board run on
+   * another engine.
+   * @param other The board to compare with
+   * @return The position of the first tile that differs or is missing from
+   * the other board, in this board's tile order, or std::nullopt
+   */
+  [[nodiscard]] std::optional<vi2d> FindDivergence(const Grid& other) const;
+
+  /**
+   * @brief Switches signal processing over to memoised cell transitions:
+   * the cascade a signal causes within an 8x8 cell is simulated once per
+   * cell layout and state and replayed from a cache from then on. Pays off
+   * over the legacy engine on boards repeating the same circuits or
+   * revisiting the same states, but is slower than preprocessed groups, see
+   * ChunkMemo. Turning it off drops the cache.
+   * @param enabled Whether to memoise chunk transitions
+   */
+  void SetChunkMemoisation(bool enabled);
+  [[nodiscard]] bool GetChunkMemoisation() const noexcept {
+    return chunkMemoisation;
+  }
+  [[nodiscard]] const ChunkMemo& GetChunkMemo() const noexcept {
+    return chunkMemo;
+  }
+
+  /**
+   * @brief Keeps the deterministic paths preprocessing traces in a cache
+   * directory, keyed by the contents of the chunk they lie in, and reuses
+   * them on any board holding an identical chunk. Takes effect on the next
+   * preprocessing pass.
+   * @param directory The cache directory, or an empty string to turn the
+   * cache off
+   */
+  void SetPreprocessCache(const std::string& directory);
+  /**
+   * @brief Reports how many traces were replayed from the cache and how
+   * many had to be traced, over the cache's lifetime.
+   * @return Hits and misses, both 0 without a cache
+   */
+  [[nodiscard]] std::pair<std::size_t, std::size_t> GetPreprocessCacheStats()
+      const noexcept;
 
   // Configuration  }
   void Clear() {
     tiles.clear();
-    emitters.clear();
+    tileIndex.Clear();
+    dirtyRegion.reset();
+    liveTiles.clear();
+    liveTileSet.clear();
+    liveRevision.reset();
+    emitters.Clear();
     ResetSimulation();
   }
 
   // Save/load
   void Save(const std::string& filename);
+  // The bytes Save() writes, for writing them elsewhere or later.
+  [[nodiscard]] std::vector<char> Serialize();
+  // Saves only the tiles within a rectangle, in the same format.
+  void Save(const std::string& filename, vi2d startPos, vi2d endPos);
   void Load(const std::string& filename);
+
+  /**
+   * @brief Writes a checkpoint of the simulation state to go with the layout
+   * Save() writes: every tile's state, the clock and the pending updates, in
+   * a single write. An edited field is reset first, like a step would.
+   * @param filename The checkpoint file
+   */
+  void SaveState(const std::string& filename);
+  /**
+   * @brief Resumes the simulation from a checkpoint written by SaveState(),
+   * exactly where it left off. Load the matching layout first.
+   * @param filename The checkpoint file
+   * @return false if there is no such file or it belongs to another layout,
+   * in which case the simulation is left alone
+   */
+  bool LoadState(const std::string& filename);
 };
 
 }  // namespace ElecSim
\ No newline at end of file
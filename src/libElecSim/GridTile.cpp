@@ -126,6 +126,21 @@ void GridTile::SetFacing(Direction newFacing) {
   }
 }
 
+std::uint32_t GridTile::GetStateBits() const noexcept {
+  std::uint32_t bits = activated ? 1u : 0u;
+  for (const auto& dir : AllDirections) {
+    if (inputStates[dir]) bits |= 2u << static_cast<int>(dir);
+  }
+  return bits;
+}
+
+void GridTile::SetStateBits(std::uint32_t bits) noexcept {
+  activated = (bits & 1u) != 0;
+  for (const auto& dir : AllDirections) {
+    inputStates[dir] = (bits & (2u << static_cast<int>(dir))) != 0;
+  }
+}
+
 std::string GridTile::GetTileInformation() const {
   std::stringstream stream;
   // All in one line
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,16 @@ class SimulationObject;  // Defined in TileGroupManager.h
 
   const std::string_view TileTypeToString(TileType type);
 
+/**
+ * @struct TileState
+ * @brief Everything simulation can change about a tile, as stored in state
+ * checkpoints: the state bits plus one tile specific value they do not cover.
+ */
+struct TileState {
+  std::uint32_t bits = 0;
+  std::int32_t extra = 0;
+};
+
 /**
  * @class GridTile
  * @brief Base class for all tile types in the simulation.
@@ -104,6 +115,37 @@ class GridTile {
   SimulationObject* GetCachedSimObject() const noexcept { return cachedSimObject; }
   void SetCachedSimObject(SimulationObject* simObj) noexcept { cachedSimObject = simObj; }
 
+  /**
+   * @brief Packs everything that decides the tile's future behaviour into a
+   * bit field: bit 0 is the activation, bits 1-4 the input states. Derived
+   * tiles with more state append it above that.
+   * @return The tile's state bits
+   */
+  virtual std::uint32_t GetStateBits() const noexcept;
+  /**
+   * @brief Restores the part of GetStateBits() that signal processing can
+   * change, i.e. the activation and the input states. Anything above bit 4
+   * is ignored.
+   * @param bits State bits as returned by GetStateBits()
+   */
+  void SetStateBits(std::uint32_t bits) noexcept;
+  /**
+   * @brief Captures the tile's full simulation state for a checkpoint. Unlike
+   * GetStateBits(), this includes state that does not decide the tile's
+   * future behaviour, like an emitter's last emit tick.
+   * @return The tile's state
+   */
+  virtual TileState GetState() const noexcept {
+    return {GetStateBits(), 0};
+  }
+  /**
+   * @brief Restores a state captured by GetState() on a tile of the same type.
+   * @param state The state to restore
+   */
+  virtual void SetState(const TileState& state) noexcept {
+    SetStateBits(state.bits);
+  }
+
   bool GetDirtyThisTick() const noexcept { return dirtyThisTick; }
   void SetDirtyThisTick(bool dirty) noexcept { dirtyThisTick = dirty; }
   std::string GetTileInformation() const;
@@ -113,6 +155,24 @@ class GridTile {
 
   virtual bool IsEmitter() const = 0;
   virtual bool IsDeterministic() const = 0;
+  /**
+   * @brief Whether the tile passes every signal on to its opposite side
+   * without reacting to it, so preprocessing can trace paths straight
+   * through it and leave it out of their groups.
+   */
+  virtual bool IsPassThrough() const { return false; }
+  /**
+   * @brief Whether the tile is active exactly when none of its inputs are.
+   * With a single input that makes it a negated wire, which preprocessing
+   * folds into the wire's group.
+   */
+  virtual bool InvertsSignal() const { return false; }
+  /**
+   * @brief Whether the tile can send a signal without being sent one first:
+   * on its own, from Init() or when interacted with. A tile no source can
+   * reach never leaves its reset state.
+   */
+  virtual bool IsSignalSource() const { return false; }
   virtual TileType GetTileType() const = 0;
 
   /**
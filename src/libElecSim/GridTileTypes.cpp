@@ -1,7 +1,10 @@
 #include "GridTileTypes.h"
 
+#include <algorithm>
 #include <ranges>
 
+#include "EmitterRegistry.h"
+
 namespace ElecSim {
 
 // --- WireGridTile Implementation ---
@@ -110,6 +113,7 @@ std::vector<SignalEvent> EmitterGridTile::Interact() {
     activated = false;
     return {SignalEvent(pos, facing, false)};
   }
+  if (registry) registry->Wake(pos);
   return {};
 }
 
@@ -123,6 +127,24 @@ bool EmitterGridTile::ShouldEmit(int currentTick) const {
   return enabled && (currentTick - lastEmitTick >= EMIT_INTERVAL);
 }
 
+std::uint32_t EmitterGridTile::GetStateBits() const noexcept {
+  return GridTile::GetStateBits() | (enabled ? 1u << 5 : 0u);
+}
+
+int EmitterGridTile::NextEmitTick(int currentTick) const {
+  return std::max(currentTick + 1, lastEmitTick + EMIT_INTERVAL);
+}
+
+TileState EmitterGridTile::GetState() const noexcept {
+  return {GetStateBits(), lastEmitTick};
+}
+
+void EmitterGridTile::SetState(const TileState& state) noexcept {
+  SetStateBits(state.bits);
+  enabled = (state.bits & (1u << 5)) != 0;
+  lastEmitTick = state.extra;
+}
+
 // --- SemiConductorGridTile Implementation ---
 
 SemiConductorGridTile::SemiConductorGridTile(vi2d newPos, Direction newFacing)
@@ -160,6 +182,15 @@ std::vector<SignalEvent> SemiConductorGridTile::ProcessSignal(
   return {};
 }
 
+TileState SemiConductorGridTile::GetState() const noexcept {
+  return {GetStateBits(), internalState};
+}
+
+void SemiConductorGridTile::SetState(const TileState& state) noexcept {
+  SetStateBits(state.bits);
+  internalState = state.extra;
+}
+
 // --- ButtonGridTile Implementation ---
 
 ButtonGridTile::ButtonGridTile(vi2d newPos, Direction newFacing)
@@ -233,6 +264,12 @@ std::vector<SignalEvent> CrossingGridTile::ProcessSignal(
   return {SignalEvent(pos, outputDir, signal.isActive)};
 }
 
+std::vector<SignalEvent> CrossingGridTile::PreprocessSignal(
+    const SignalEvent incomingSignal) {
+  return {SignalEvent(pos, FlipDirection(incomingSignal.fromDirection),
+                      incomingSignal.isActive)};
+}
+
 // --- Clone Implementations ---
 // I know, this is tedious but really, this is the best way to ensure a clone
 // ends up in the valid state.
@@ -252,6 +289,8 @@ std::unique_ptr<GridTile> EmitterGridTile::Clone() const {
   // Copy EmitterGridTile-specific state
   clone->enabled = this->enabled;
   clone->lastEmitTick = this->lastEmitTick;
+  // The clone is not filed anywhere until a grid registers it.
+  clone->registry = nullptr;
   return clone;
 }
 
@@ -4,6 +4,8 @@
 
 namespace ElecSim {
 
+class EmitterRegistry;  // Defined in EmitterRegistry.h
+
 /**
  * @class WireGridTile
  * @brief Basic signal conductor that propagates signals in one direction.
@@ -48,6 +50,10 @@ class EmitterGridTile : public LogicTile {
   static constexpr int EMIT_INTERVAL = 3;
   int lastEmitTick;
 
+  // Non-owning; set by the EmitterRegistry this emitter is filed in, so that
+  // re-enabling the emitter can put it back on the registry's timer wheel.
+  EmitterRegistry* registry = nullptr;
+
  public:
   explicit EmitterGridTile(vi2d pos = vi2d(0, 0),
                   Direction facing = Direction::Top);
@@ -56,8 +62,25 @@ class EmitterGridTile : public LogicTile {
   std::vector<SignalEvent> Interact() override;
   void ResetActivation() override;
   bool ShouldEmit(int currentTick) const;
+  /**
+   * @brief Earliest tick after the given one at which ShouldEmit can hold.
+   * @param currentTick The tick to look ahead from
+   * @return The next tick this emitter wants to fire at
+   */
+  int NextEmitTick(int currentTick) const;
+  bool IsEnabled() const noexcept { return enabled; }
+  // An enabled emitter is always rescheduled for the next tick it may fire
+  // at, so its enable flag covers its timing as well.
+  std::uint32_t GetStateBits() const noexcept override;
+  TileState GetState() const noexcept override;
+  void SetState(const TileState& state) noexcept override;
+
+  void SetRegistry(EmitterRegistry* newRegistry) noexcept {
+    registry = newRegistry;
+  }
 
   bool IsEmitter() const override { return true; }
+  bool IsSignalSource() const override { return true; }
   TileType GetTileType() const override { return TileType::Emitter; }
   
   [[nodiscard]] std::unique_ptr<GridTile> Clone() const override;
@@ -69,13 +92,15 @@ class EmitterGridTile : public LogicTile {
  */
 class SemiConductorGridTile : public LogicTile {
  protected:
-  int internalState;  // bit 0: side inputs, bit 1: bottom input
+  int internalState = 0;  // bit 0: side inputs, bit 1: bottom input
 
  public:
   explicit SemiConductorGridTile(vi2d pos = vi2d(0, 0),
                         Direction facing = Direction::Top);
 
   std::vector<SignalEvent> ProcessSignal(const SignalEvent& signal) override;
+  TileState GetState() const noexcept override;
+  void SetState(const TileState& state) noexcept override;
 
   bool IsEmitter() const override { return false; }
   TileType GetTileType() const override { return TileType::SemiConductor; }
@@ -96,6 +121,7 @@ class ButtonGridTile : public LogicTile {
   std::vector<SignalEvent> Interact() override;
 
   bool IsEmitter() const override { return false; }
+  bool IsSignalSource() const override { return true; }
   TileType GetTileType() const override { return TileType::Button; }
   
   [[nodiscard]] std::unique_ptr<GridTile> Clone() const override;
@@ -112,6 +138,9 @@ class InverterGridTile : public LogicTile {
   std::vector<SignalEvent> Init() override;
   std::vector<SignalEvent> ProcessSignal(const SignalEvent& signal) override;
   bool IsEmitter() const override { return false; }
+  bool InvertsSignal() const override { return true; }
+  // Sends its first signal from Init()
+  bool IsSignalSource() const override { return true; }
   TileType GetTileType() const override { return TileType::Inverter; }
   
   [[nodiscard]] std::unique_ptr<GridTile> Clone() const override;
@@ -120,6 +149,10 @@ class InverterGridTile : public LogicTile {
 /**
  * @class CrossingGridTile
  * @brief Allows signals to cross without interference.
+ *
+ * Each axis is an independent channel passing signals straight on, so
+ * preprocessing traces wires through crossings instead of ending groups
+ * there, see IsPassThrough().
  */
 class CrossingGridTile : public LogicTile {
  public:
@@ -127,8 +160,12 @@ class CrossingGridTile : public LogicTile {
                   Direction facing = Direction::Top);
 
   std::vector<SignalEvent> ProcessSignal(const SignalEvent& signal) override;
-  
+  // Each axis is its own channel, so this is the same pass-through.
+  std::vector<SignalEvent> PreprocessSignal(
+      const SignalEvent incomingSignal) override;
+
   bool IsEmitter() const override { return false; }
+  bool IsPassThrough() const override { return true; }
   TileType GetTileType() const override { return TileType::Crossing; }
   
   [[nodiscard]] std::unique_ptr<GridTile> Clone() const override;
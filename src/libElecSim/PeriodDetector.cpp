@@ -0,0 +1,64 @@
+#include "PeriodDetector.h"
+
+namespace ElecSim {
+
+std::uint64_t PeriodDetector::TileHash(vi2d pos, std::uint32_t bits) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  struct {
+    vi2d pos;
+    std::uint32_t bits;
+  } key{pos, bits};
+  return hash(&key, sizeof(key));
+}
+
+void PeriodDetector::Rebuild(const TileMap& tiles) {
+  Clear();
+  stateBits.reserve(tiles.size());
+  for (const auto& [pos, tile] : tiles) {
+    const auto bits = tile->GetStateBits();
+    stateBits.emplace(pos, bits);
+    hash ^= TileHash(pos, bits);
+  }
+}
+
+void PeriodDetector::Update(const GridTile& tile) {
+  const auto pos = tile.GetPos();
+  const auto bits = tile.GetStateBits();
+  auto [it, inserted] = stateBits.try_emplace(pos, bits);
+  if (!inserted) {
+    if (it->second == bits) return;
+    hash ^= TileHash(pos, it->second);
+    it->second = bits;
+  }
+  hash ^= TileHash(pos, bits);
+}
+
+std::optional<int> PeriodDetector::Record(int tick) {
+  if (candidate) {
+    const int confirmAt = candidate->tick + candidate->period;
+    if (tick < confirmAt) return std::nullopt;
+    // The simulation is deterministic, so one exact repetition proves the
+    // period. Otherwise the hashes merely collided.
+    const bool repeats =
+        tick == confirmAt && stateBits == candidate->stateBits;
+    const int firstSeen = candidate->tick;
+    candidate.reset();
+    if (repeats) return firstSeen;
+  }
+  if (seenAt.size() >= MAX_HISTORY) seenAt.clear();
+  auto [it, inserted] = seenAt.try_emplace(hash, tick);
+  if (!inserted) {
+    candidate = Candidate{tick, tick - it->second, stateBits};
+    it->second = tick;
+  }
+  return std::nullopt;
+}
+
+void PeriodDetector::Clear() {
+  stateBits.clear();
+  seenAt.clear();
+  candidate.reset();
+  hash = 0;
+}
+
+}  // namespace ElecSim
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "Common.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class PeriodDetector
+ * @brief Keeps a running hash of the whole board's simulation state and
+ * remembers at which tick each state was seen.
+ *
+ * The hash is the XOR of a per-tile hash over position and
+ * GridTile::GetStateBits(), so it can be kept up to date by rehashing only the
+ * tiles a tick touched. Once a state recurs, the board is periodic from there
+ * on and the caller can skip whole periods without simulating them.
+ *
+ * A matching hash alone is not trusted, as two different states can share
+ * one. It only nominates a period, and the recurrence is reported once the
+ * exact tile states repeat one period later.
+ */
+class PeriodDetector {
+ public:
+  using TileMap = ankerl::unordered_dense::map<vi2d, std::shared_ptr<GridTile>,
+                                               PositionHash>;
+
+  PeriodDetector() = default;
+  ~PeriodDetector() = default;
+
+  /**
+   * @brief Hashes every tile from scratch and forgets all recorded ticks.
+   * @param tiles All tiles of the board
+   */
+  void Rebuild(const TileMap& tiles);
+
+  /**
+   * @brief Rehashes a single tile after its state may have changed. Calling
+   * this for an unchanged tile is harmless.
+   * @param tile The tile to rehash
+   */
+  void Update(const GridTile& tile);
+
+  /**
+   * @brief Records the current board state as seen at the given tick.
+   * @param tick The tick the board is at
+   * @return The tick the current state was confirmed to repeat, one period
+   * ago, or std::nullopt while no recurrence is confirmed
+   */
+  std::optional<int> Record(int tick);
+
+  /**
+   * @brief Drops all per-tile state and recorded ticks.
+   */
+  void Clear();
+
+  [[nodiscard]] std::uint64_t GetHash() const noexcept { return hash; }
+
+ private:
+  // Bounds the history on boards that take very long to settle, if ever.
+  // Once full, recording starts over from the current state.
+  static constexpr std::size_t MAX_HISTORY = std::size_t{1} << 20;
+
+  using StateMap =
+      ankerl::unordered_dense::map<vi2d, std::uint32_t, PositionHash>;
+
+  // A state whose hash was seen before, waiting for the tick that tells
+  // whether it really repeats.
+  struct Candidate {
+    int tick;
+    int period;
+    StateMap stateBits;
+  };
+
+  [[nodiscard]] static std::uint64_t TileHash(vi2d pos, std::uint32_t bits);
+
+  StateMap stateBits;
+  ankerl::unordered_dense::map<std::uint64_t, int> seenAt;
+  std::optional<Candidate> candidate;
+  std::uint64_t hash = 0;
+};
+
+}  // namespace ElecSim
@@ -0,0 +1,265 @@
+#include "PreprocessCache.h"
+
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <span>
+#include <system_error>
+
+namespace ElecSim {
+#ifdef SIM_PREPROCESSING
+
+namespace {
+
+// Cache files are plain native byte order fields: a version, the chunk's
+// check hash, the number of traces, then per trace its input, path,
+// inverted and output counts followed by the positions as chunk-local
+// indices. An inverted output has the top bit of its index set. Version 2
+// traces run through crossings, and version 3 ones through inverters.
+constexpr std::uint32_t CACHE_VERSION = 3;
+constexpr std::uint16_t INVERTED_BIT = 0x8000;
+static_assert(GRID_CHUNK_LENGTH * GRID_CHUNK_LENGTH <= INVERTED_BIT);
+
+// Kept apart so a tile inside a chunk never hashes like the same tile in the
+// ring around it. The check hash uses salts of its own as well.
+constexpr std::uint32_t CHUNK_SALT = 0;
+constexpr std::uint32_t RING_SALT = 1;
+constexpr std::uint32_t CHUNK_CHECK_SALT = 2;
+constexpr std::uint32_t RING_CHECK_SALT = 3;
+
+std::uint64_t TileHash(vi2d localPos, const GridTile& tile,
+                       std::uint32_t salt) {
+  using ankerl::unordered_dense::detail::wyhash::hash;
+  struct {
+    vi2d localPos;
+    std::int32_t type;
+    std::int32_t facing;
+    std::uint32_t salt;
+  } key{localPos, static_cast<std::int32_t>(tile.GetTileType()),
+        static_cast<std::int32_t>(tile.GetFacing()), salt};
+  return hash(&key, sizeof(key));
+}
+
+template <typename T>
+void AppendRaw(std::vector<char>& out, const T& value) {
+  const auto* bytes = reinterpret_cast<const char*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+bool ReadRaw(std::span<const char>& data, T& value) {
+  if (data.size() < sizeof(T)) return false;
+  std::memcpy(&value, data.data(), sizeof(T));
+  data = data.subspan(sizeof(T));
+  return true;
+}
+
+}  // namespace
+
+PreprocessCache::PreprocessCache(std::filesystem::path cacheDirectory)
+    : directory(std::move(cacheDirectory)) {}
+
+// The key xors the tile hashes, while the check adds up hashes salted
+// differently, so layouts that collide in one are unlikely to in the other.
+PreprocessCache::ChunkKeys PreprocessCache::KeyChunks(const TileMap& tiles) {
+  ChunkKeys keys;
+  for (const auto& [pos, tile] : tiles) {
+    const vi2d chunkPos = AlignToChunk(pos);
+    auto& key = keys[chunkPos];
+    key.key ^= TileHash(pos - chunkPos, *tile, CHUNK_SALT);
+    key.check += TileHash(pos - chunkPos, *tile, CHUNK_CHECK_SALT);
+  }
+  // Only the ring's edge-adjacent tiles can touch a chunk tile, so the
+  // corners are left out.
+  for (auto& [chunkPos, key] : keys) {
+    auto addRing = [&tiles, &chunkPos, &key](vi2d localPos) {
+      if (auto it = tiles.find(chunkPos + localPos); it != tiles.end()) {
+        key.key ^= TileHash(localPos, *it->second, RING_SALT);
+        key.check += TileHash(localPos, *it->second, RING_CHECK_SALT);
+      }
+    };
+    for (int i = 0; i < GRID_CHUNK_LENGTH; ++i) {
+      addRing({i, -1});
+      addRing({i, GRID_CHUNK_LENGTH});
+      addRing({-1, i});
+      addRing({GRID_CHUNK_LENGTH, i});
+    }
+  }
+  return keys;
+}
+
+std::uint16_t PreprocessCache::LocalIndex(vi2d localPos) noexcept {
+  return static_cast<std::uint16_t>(localPos.y * GRID_CHUNK_LENGTH +
+                                    localPos.x);
+}
+
+vi2d PreprocessCache::LocalPos(std::uint16_t index) noexcept {
+  return {index % GRID_CHUNK_LENGTH, index / GRID_CHUNK_LENGTH};
+}
+
+std::filesystem::path PreprocessCache::PathOf(std::uint64_t key) const {
+  return directory / std::format("{:016x}.trace", key);
+}
+
+// The trace is copied out, as another board may add to the entry meanwhile.
+std::optional<PreprocessCache::Trace> PreprocessCache::Find(
+    const ChunkKey& key, vi2d localInput) {
+  std::lock_guard lock(mutex);
+  if (const auto* entry = Load(key)) {
+    auto it = entry->traces.find(LocalIndex(localInput));
+    if (it != entry->traces.end()) {
+      ++hits;
+      return it->second;
+    }
+  }
+  ++misses;
+  return std::nullopt;
+}
+
+void PreprocessCache::Add(const ChunkKey& key, vi2d localInput, Trace trace) {
+  std::lock_guard lock(mutex);
+  auto* entry = Load(key);
+  if (entry &&
+      entry->traces.try_emplace(LocalIndex(localInput), std::move(trace))
+          .second) {
+    entry->dirty = true;
+  }
+}
+
+std::size_t PreprocessCache::GetHits() const {
+  std::lock_guard lock(mutex);
+  return hits;
+}
+
+std::size_t PreprocessCache::GetMisses() const {
+  std::lock_guard lock(mutex);
+  return misses;
+}
+
+// Reads a key's cache file. A missing or unreadable file, or one written for
+// another layout, simply means no traces are cached for the key yet.
+PreprocessCache::Entry* PreprocessCache::Load(const ChunkKey& key) {
+  auto [it, inserted] = entries.try_emplace(key.key);
+  auto& entry = it->second;
+  if (!inserted) return entry.check == key.check ? &entry : nullptr;
+  entry.check = key.check;
+
+  std::ifstream file(PathOf(key.key), std::ios::binary);
+  if (!file) return &entry;
+  const std::vector<char> buffer{std::istreambuf_iterator<char>(file),
+                                 std::istreambuf_iterator<char>()};
+  std::span<const char> data(buffer);
+
+  std::uint32_t version = 0;
+  std::uint64_t check = 0;
+  std::uint32_t traceCount = 0;
+  if (!ReadRaw(data, version) || version != CACHE_VERSION ||
+      !ReadRaw(data, check) || !ReadRaw(data, traceCount)) {
+    DebugPrint("Ignoring unreadable preprocessing cache file {}",
+               PathOf(key.key).string());
+    return &entry;
+  }
+  if (check != key.check) {
+    DebugPrint("Ignoring preprocessing cache file {} of another layout",
+               PathOf(key.key).string());
+    return &entry;
+  }
+  for (std::uint32_t i = 0; i < traceCount; ++i) {
+    std::uint16_t input = 0;
+    std::uint32_t pathCount = 0;
+    std::uint32_t invertedCount = 0;
+    std::uint32_t outputCount = 0;
+    if (!ReadRaw(data, input) || !ReadRaw(data, pathCount) ||
+        !ReadRaw(data, invertedCount) || !ReadRaw(data, outputCount) ||
+        data.size() < (std::size_t{pathCount} + invertedCount +
+                       2 * std::size_t{outputCount}) *
+                          sizeof(std::uint16_t)) {
+      DebugPrint("Ignoring truncated preprocessing cache file {}",
+                 PathOf(key.key).string());
+      entry.traces.clear();
+      return &entry;
+    }
+    Trace trace;
+    trace.pathTiles.reserve(pathCount);
+    for (std::uint32_t j = 0; j < pathCount; ++j) {
+      std::uint16_t index = 0;
+      ReadRaw(data, index);
+      trace.pathTiles.push_back(LocalPos(index));
+    }
+    trace.invertedTiles.reserve(invertedCount);
+    for (std::uint32_t j = 0; j < invertedCount; ++j) {
+      std::uint16_t index = 0;
+      ReadRaw(data, index);
+      trace.invertedTiles.push_back(LocalPos(index));
+    }
+    trace.outputTiles.reserve(outputCount);
+    for (std::uint32_t j = 0; j < outputCount; ++j) {
+      std::uint16_t tileIndex = 0;
+      std::uint16_t inputterIndex = 0;
+      ReadRaw(data, tileIndex);
+      ReadRaw(data, inputterIndex);
+      trace.outputTiles.push_back(
+          {LocalPos(tileIndex & ~INVERTED_BIT), LocalPos(inputterIndex),
+           (tileIndex & INVERTED_BIT) != 0});
+    }
+    entry.traces.try_emplace(input, std::move(trace));
+  }
+  return &entry;
+}
+
+void PreprocessCache::Flush() {
+  std::lock_guard lock(mutex);
+  std::error_code error;
+  for (auto& [key, entry] : entries) {
+    if (!entry.dirty) continue;
+    if (!std::filesystem::is_directory(directory, error)) {
+      std::filesystem::create_directories(directory, error);
+    }
+
+    std::vector<char> data;
+    AppendRaw(data, CACHE_VERSION);
+    AppendRaw(data, entry.check);
+    AppendRaw(data, static_cast<std::uint32_t>(entry.traces.size()));
+    for (const auto& [input, trace] : entry.traces) {
+      AppendRaw(data, input);
+      AppendRaw(data, static_cast<std::uint32_t>(trace.pathTiles.size()));
+      AppendRaw(data, static_cast<std::uint32_t>(trace.invertedTiles.size()));
+      AppendRaw(data, static_cast<std::uint32_t>(trace.outputTiles.size()));
+      for (const auto& pos : trace.pathTiles) AppendRaw(data, LocalIndex(pos));
+      for (const auto& pos : trace.invertedTiles) {
+        AppendRaw(data, LocalIndex(pos));
+      }
+      for (const auto& [tilePos, inputterPos, inverted] : trace.outputTiles) {
+        const auto flags = inverted ? INVERTED_BIT : 0;
+        AppendRaw(data,
+                  static_cast<std::uint16_t>(LocalIndex(tilePos) | flags));
+        AppendRaw(data, LocalIndex(inputterPos));
+      }
+    }
+
+    // Written aside and renamed into place, so a concurrent reader never
+    // sees half a file.
+    const auto path = PathOf(key);
+    auto tempPath = path;
+    tempPath += std::format(".{:08x}.tmp", std::random_device{}());
+    {
+      std::ofstream file(tempPath, std::ios::binary);
+      if (!file) {
+        DebugPrint("Error opening file for writing: {}", tempPath.string());
+        continue;
+      }
+      file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+      std::filesystem::remove(tempPath, error);
+      continue;
+    }
+    entry.dirty = false;
+  }
+}
+
+#endif  // SIM_PREPROCESSING
+}  // namespace ElecSim
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "Common.h"
+#include "GridTile.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+#ifdef SIM_PREPROCESSING
+
+/**
+ * @class PreprocessCache
+ * @brief On-disk store of deterministic path traces, keyed by the contents
+ * of the chunk they lie in.
+ *
+ * A trace only depends on the tiles it visits, including the crossings it
+ * passes through, and their direct neighbours. So a trace that stays within
+ * one chunk is fully decided by the chunk's layout plus the ring of tiles
+ * right around it. Both are hashed with chunk-local positions into the
+ * chunk's key, which makes a trace reusable by every copy of the same module
+ * on any board. Traces leaving their
+ * chunk are never cached and always traced for real.
+ *
+ * Each key is one file in the cache directory, read on first use and
+ * written back by Flush(). Since different layouts can share a key, every
+ * file also holds a second, independently computed hash of its layout, and
+ * a file whose check hash does not match the chunk is ignored.
+ *
+ * One cache can serve several boards at once, from any thread.
+ */
+class PreprocessCache {
+ public:
+  using TileMap = ankerl::unordered_dense::map<vi2d, std::shared_ptr<GridTile>,
+                                               PositionHash>;
+  // A chunk's layout, hashed twice over.
+  struct ChunkKey {
+    std::uint64_t key;    // Names the cache file
+    std::uint64_t check;  // Tells layouts sharing a key apart
+  };
+  using ChunkKeys = ankerl::unordered_dense::map<vi2d, ChunkKey,
+                                                 PositionHash>;
+
+  // A trace in chunk-local positions.
+  struct Trace {
+    struct Output {
+      vi2d tile;
+      vi2d inputter;  // The path tile or crossing feeding it
+      bool inverted;
+    };
+    std::vector<vi2d> pathTiles;
+    std::vector<vi2d> invertedTiles;
+    // In the order they were found
+    std::vector<Output> outputTiles;
+  };
+
+  /**
+   * @param cacheDirectory Where to keep the cache files. Created on the first
+   * Flush() that has anything to write.
+   */
+  explicit PreprocessCache(std::filesystem::path cacheDirectory);
+  ~PreprocessCache() = default;
+
+  /**
+   * @brief Hashes the layout of every occupied chunk and its surrounding
+   * ring of tiles.
+   * @param tiles All tiles of the board
+   * @return The key of every occupied chunk, by chunk position
+   */
+  [[nodiscard]] static ChunkKeys KeyChunks(const TileMap& tiles);
+
+  /**
+   * @brief Looks up the trace starting at a tile, loading the chunk's cache
+   * file if this is the first lookup for its key.
+   * @param key Key of the chunk holding the input tile
+   * @param localInput Chunk-local position of the input tile
+   * @return The trace, or std::nullopt if it was never cached for this
+   * layout
+   */
+  [[nodiscard]] std::optional<Trace> Find(const ChunkKey& key,
+                                          vi2d localInput);
+
+  /**
+   * @brief Caches a trace. It is written to disk by the next Flush().
+   * @param key Key of the chunk holding the whole trace
+   * @param localInput Chunk-local position of the input tile
+   * @param trace The trace
+   */
+  void Add(const ChunkKey& key, vi2d localInput, Trace trace);
+
+  /**
+   * @brief Writes every key that gained traces since it was loaded.
+   * Failing to write is not an error, the traces just stay in memory.
+   */
+  void Flush();
+
+  [[nodiscard]] std::size_t GetHits() const;
+  [[nodiscard]] std::size_t GetMisses() const;
+
+ private:
+  struct Entry {
+    // Keyed by the input tile's chunk-local index, see LocalIndex()
+    ankerl::unordered_dense::map<std::uint16_t, Trace> traces;
+    std::uint64_t check = 0;  // ChunkKey::check of the layout it holds
+    bool dirty = false;
+  };
+
+  [[nodiscard]] static std::uint16_t LocalIndex(vi2d localPos) noexcept;
+  [[nodiscard]] static vi2d LocalPos(std::uint16_t index) noexcept;
+  [[nodiscard]] std::filesystem::path PathOf(std::uint64_t key) const;
+  // Null if the key is taken by another layout.
+  Entry* Load(const ChunkKey& key);
+
+  mutable std::mutex mutex;  // Guards everything below
+  std::filesystem::path directory;
+  ankerl::unordered_dense::map<std::uint64_t, Entry> entries;
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+};
+
+#endif  // SIM_PREPROCESSING
+}  // namespace ElecSim
@@ -0,0 +1,49 @@
+#include "SpatialIndex.h"
+
+namespace ElecSim {
+
+namespace {
+std::uint64_t ColumnBit(vi2d pos, vi2d chunkPos) {
+  return std::uint64_t{1} << (pos.x - chunkPos.x);
+}
+std::size_t Row(vi2d pos, vi2d chunkPos) {
+  return static_cast<std::size_t>(pos.y - chunkPos.y);
+}
+}  // namespace
+
+void SpatialIndex::Insert(vi2d pos) {
+  const vi2d chunkPos = AlignToChunk(pos);
+  auto& chunk = chunks[chunkPos];
+  auto& row = chunk.rows[Row(pos, chunkPos)];
+  const auto bit = ColumnBit(pos, chunkPos);
+  if (row & bit) return;
+  row |= bit;
+  ++chunk.count;
+}
+
+void SpatialIndex::Erase(vi2d pos) {
+  const vi2d chunkPos = AlignToChunk(pos);
+  auto it = chunks.find(chunkPos);
+  if (it == chunks.end()) return;
+  auto& row = it->second.rows[Row(pos, chunkPos)];
+  const auto bit = ColumnBit(pos, chunkPos);
+  if (!(row & bit)) return;
+  row &= ~bit;
+  if (--it->second.count == 0) chunks.erase(it);
+}
+
+bool SpatialIndex::Contains(vi2d pos) const {
+  const vi2d chunkPos = AlignToChunk(pos);
+  auto it = chunks.find(chunkPos);
+  return it != chunks.end() &&
+         (it->second.rows[Row(pos, chunkPos)] & ColumnBit(pos, chunkPos)) != 0;
+}
+
+std::vector<vi2d> SpatialIndex::Query(vi2d topLeft, vi2d bottomRight) const {
+  std::vector<vi2d> result;
+  ForEachIn(topLeft, bottomRight,
+            [&result](vi2d pos) { result.push_back(pos); });
+  return result;
+}
+
+}  // namespace ElecSim
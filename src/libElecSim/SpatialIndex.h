@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "Common.h"
+#include "ankerl/unordered_dense.h"
+#include "v2d.h"
+
+namespace ElecSim {
+
+/**
+ * @class SpatialIndex
+ * @brief Records which positions of the board are occupied, bucketed into
+ * chunks of GRID_CHUNK_LENGTH x GRID_CHUNK_LENGTH tiles.
+ *
+ * Every chunk keeps one bitmask per row, so a rectangle query only visits the
+ * chunks overlapping it and, within them, only the set bits of the rows it
+ * covers. Its cost is proportional to the occupied positions in the
+ * rectangle, not to the rectangle's area or the size of the board.
+ */
+class SpatialIndex {
+ public:
+  SpatialIndex() = default;
+  ~SpatialIndex() = default;
+
+  void Insert(vi2d pos);
+  void Erase(vi2d pos);
+  void Clear() noexcept { chunks.clear(); }
+  [[nodiscard]] bool Contains(vi2d pos) const;
+
+  /**
+   * @brief Calls visit(pos) for every occupied position within a rectangle.
+   * Positions come in row-major order within each chunk, chunks in no
+   * particular order.
+   * @param topLeft Top left corner of the rectangle, inclusive
+   * @param bottomRight Bottom right corner of the rectangle, inclusive
+   * @param visit Called with each position
+   */
+  template <typename Visit>
+  void ForEachIn(vi2d topLeft, vi2d bottomRight, Visit&& visit) const;
+
+  /**
+   * @brief Collects the occupied positions within a rectangle.
+   * @param topLeft Top left corner of the rectangle, inclusive
+   * @param bottomRight Bottom right corner of the rectangle, inclusive
+   * @return The positions, in ForEachIn() order
+   */
+  [[nodiscard]] std::vector<vi2d> Query(vi2d topLeft, vi2d bottomRight) const;
+
+ private:
+  static_assert(GRID_CHUNK_LENGTH == 64,
+                "Chunk rows are stored as 64 bit masks.");
+
+  struct Chunk {
+    std::array<std::uint64_t, GRID_CHUNK_LENGTH> rows{};
+    std::uint32_t count = 0;
+  };
+
+  template <typename Visit>
+  static void VisitChunk(vi2d chunkPos, const Chunk& chunk, vi2d topLeft,
+                         vi2d bottomRight, Visit& visit);
+
+  ankerl::unordered_dense::map<vi2d, Chunk, PositionHash> chunks;
+};
+
+template <typename Visit>
+void SpatialIndex::ForEachIn(vi2d topLeft, vi2d bottomRight,
+                             Visit&& visit) const {
+  if (bottomRight.x < topLeft.x || bottomRight.y < topLeft.y) return;
+  const vi2d firstChunk = AlignToChunk(topLeft);
+  const vi2d lastChunk = AlignToChunk(bottomRight);
+  const auto columns =
+      (std::int64_t{lastChunk.x} - firstChunk.x) / GRID_CHUNK_LENGTH + 1;
+  const auto rows =
+      (std::int64_t{lastChunk.y} - firstChunk.y) / GRID_CHUNK_LENGTH + 1;
+
+  // A huge, mostly empty rectangle spans more chunk positions than there are
+  // chunks, in which case walking the chunks is the cheaper way around.
+  if (static_cast<std::uint64_t>(columns * rows) > chunks.size()) {
+    for (const auto& [chunkPos, chunk] : chunks) {
+      if (chunkPos.x >= firstChunk.x && chunkPos.x <= lastChunk.x &&
+          chunkPos.y >= firstChunk.y && chunkPos.y <= lastChunk.y) {
+        VisitChunk(chunkPos, chunk, topLeft, bottomRight, visit);
+      }
+    }
+    return;
+  }
+
+  for (std::int64_t row = 0; row < rows; ++row) {
+    for (std::int64_t column = 0; column < columns; ++column) {
+      const vi2d chunkPos(
+          static_cast<int>(firstChunk.x + column * GRID_CHUNK_LENGTH),
+          static_cast<int>(firstChunk.y + row * GRID_CHUNK_LENGTH));
+      if (auto it = chunks.find(chunkPos); it != chunks.end()) {
+        VisitChunk(chunkPos, it->second, topLeft, bottomRight, visit);
+      }
+    }
+  }
+}
+
+template <typename Visit>
+void SpatialIndex::VisitChunk(vi2d chunkPos, const Chunk& chunk, vi2d topLeft,
+                              vi2d bottomRight, Visit& visit) {
+  constexpr int last = GRID_CHUNK_LENGTH - 1;
+  const auto clamp = [](std::int64_t value) {
+    return static_cast<int>(
+        std::clamp(value, std::int64_t{0}, std::int64_t{last}));
+  };
+  const int x0 = clamp(std::int64_t{topLeft.x} - chunkPos.x);
+  const int x1 = clamp(std::int64_t{bottomRight.x} - chunkPos.x);
+  const int y0 = clamp(std::int64_t{topLeft.y} - chunkPos.y);
+  const int y1 = clamp(std::int64_t{bottomRight.y} - chunkPos.y);
+
+  const std::uint64_t mask = (~std::uint64_t{0} >> (last - (x1 - x0))) << x0;
+  for (int y = y0; y <= y1; ++y) {
+    for (auto bits = chunk.rows[static_cast<std::size_t>(y)] & mask; bits != 0;
+         bits &= bits - 1) {
+      visit(chunkPos + vi2d(std::countr_zero(bits), y));
+    }
+  }
+}
+
+}  // namespace ElecSim
@@ -1,7 +1,11 @@
 #include "TileGroupManager.h"
 
+#include <algorithm>
+#include <cstring>
 #include <format>
+#include <iterator>
 #include <ranges>
+#include <stdexcept>
 
 #include "Common.h"
 
@@ -9,39 +13,183 @@ namespace ElecSim {
 
 #ifdef SIM_PREPROCESSING
 
-// Processes the signal of a group. This yields a vector of new signals by
-// only simulating the input tile and simply cycling the state of the tiles
-// inbetween the start and end.
+namespace {
+
+// Saved topologies are plain native byte order fields, like the layout files
+// they are stored in.
+enum class TopologyKind : std::int32_t { Tile, Group };
+
+template <typename T>
+void AppendRaw(std::vector<char>& out, const T& value) {
+  const auto* bytes = reinterpret_cast<const char*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads fields off the front of the data, failing once it runs out.
+class TopologyReader {
+ public:
+  explicit TopologyReader(std::span<const char> topology) : data(topology) {}
+  template <typename T>
+  bool Read(T& value) {
+    if (data.size() < sizeof(T)) return false;
+    std::memcpy(&value, data.data(), sizeof(T));
+    data = data.subspan(sizeof(T));
+    return true;
+  }
+  bool AtEnd() const noexcept { return data.empty(); }
+
+ private:
+  std::span<const char> data;
+};
+
+}  // namespace
+
+// Finds the counterpart of a tile on another board.
+static const std::shared_ptr<GridTile>& CounterpartOf(
+    const std::shared_ptr<GridTile>& tile,
+    const SimulationObject::TileMap& tiles) {
+  auto it = tiles.find(tile->GetPos());
+  if (it == tiles.end()) {
+    throw std::runtime_error(std::format(
+        "Cannot copy simulation object: no tile at {} on the target board",
+        tile->GetPos()));
+  }
+  return it->second;
+}
+
+std::unique_ptr<SimulationObject>
+TileGroupManager::SimulationTile::CloneOnto(const TileMap& tiles) const {
+  return std::make_unique<SimulationTile>(CounterpartOf(tile, tiles));
+}
+
+std::unique_ptr<SimulationObject>
+TileGroupManager::SimulationGroup::CloneOnto(const TileMap& tiles) const {
+  std::vector<std::shared_ptr<GridTile>> inbetween;
+  inbetween.reserve(inbetweenTiles.size());
+  for (const auto& tile : inbetweenTiles) {
+    inbetween.push_back(CounterpartOf(tile, tiles));
+  }
+  std::vector<std::shared_ptr<GridTile>> inverted;
+  inverted.reserve(invertedTiles.size());
+  for (const auto& tile : invertedTiles) {
+    inverted.push_back(CounterpartOf(tile, tiles));
+  }
+  std::vector<OutputTile> outputs;
+  outputs.reserve(outputTiles.size());
+  for (const auto& output : outputTiles) {
+    outputs.push_back({CounterpartOf(output.tile, tiles),
+                       CounterpartOf(output.inputterTile, tiles),
+                       output.inverted});
+  }
+  return std::make_unique<SimulationGroup>(
+      id, invertedId, CounterpartOf(inputTile, tiles), std::move(inbetween),
+      std::move(inverted), std::move(outputs));
+}
+
+// Processes the signal of a group along with every group it feeds through
+// a merge node, so a whole merge tree is a single dispatch. A merge node is a
+// wire with several inputs, and its own ProcessSignal() already ORs them
+// from the input states it keeps per side. A group is evaluated at most once
+// per dispatch, so anything feeding back into one, like a loop through a
+// merge node, goes through the grid's queue as a plain signal.
 TileGroupProcessResult TileGroupManager::SimulationGroup::ProcessSignal(
     const SignalEvent& signal) {
-  std::vector<TileStateChange> affectedTiles;
-  auto newSignals = inputTile->ProcessSignal(signal);
-  if (newSignals.empty()) {
-    return {};  // No new signals produced
+  TileGroupProcessResult result;
+  std::vector<SimulationGroup*> evaluatedGroups{this};
+  MergeQueue mergeQueue;
+  evaluated = true;
+  Evaluate(signal, false, result, mergeQueue);
+  while (!mergeQueue.empty()) {
+    auto [group, event] = mergeQueue.back();
+    mergeQueue.pop_back();
+    if (group->evaluated) {
+      result.newSignals.push_back(event);
+      continue;
+    }
+    group->evaluated = true;
+    evaluatedGroups.push_back(group);
+    group->Evaluate(event, true, result, mergeQueue);
+  }
+  for (auto* group : evaluatedGroups) group->evaluated = false;
+  return result;
+}
+
+// Only simulates the input tile and simply cycles the state of the tiles
+// inbetween the start and end. Tiles and outputs behind a folded inverter get
+// the opposite state.
+void TileGroupManager::SimulationGroup::Evaluate(
+    const SignalEvent& signal, bool merged, TileGroupProcessResult& result,
+    MergeQueue& mergeQueue) {
+  const bool changed = !inputTile->ProcessSignal(signal).empty();
+  // A merge node's input states changed even if its activation did not.
+  if (changed || merged) {
+    result.affectedTiles.push_back(
+        TileStateChange{inputTile->GetPos(), inputTile->GetActivation()});
   }
-  affectedTiles.push_back(
-      TileStateChange{inputTile->GetPos(), inputTile->GetActivation()});
+  if (!changed) return;
 
-  // Cycle the activation state of all inbetween tiles
+  // Cycle the activation state of all inbetween tiles. They are reported as
+  // one group change per polarity, so a long wire is a single entry rather
+  // than one per tile.
+  const bool active = inputTile->GetActivation();
   for (const auto& tile : inbetweenTiles) {
-    tile->SetActivation(inputTile->GetActivation());
-    affectedTiles.push_back(
-        TileStateChange{tile->GetPos(), tile->GetActivation()});
+    tile->SetActivation(active);
+  }
+  for (const auto& tile : invertedTiles) {
+    tile->SetActivation(!active);
+  }
+  if (!inbetweenTiles.empty()) {
+    result.affectedGroups.push_back(GroupStateChange{id, active});
+  }
+  if (!invertedTiles.empty()) {
+    result.affectedGroups.push_back(GroupStateChange{invertedId, !active});
   }
 
-  // Now, apply updates to the output tiles
-  std::vector<SignalEvent> outputSignals;
+  // Now, apply updates to the output tiles. The inputter may be a crossing,
+  // which never changes its own activation, so the state is the group's.
   for (const auto& output : outputTiles) {
     Direction outputDir = DirectionFromVectors(output.inputterTile->GetPos(),
                                                output.tile->GetPos());
     auto signalEvent = SignalEvent(output.inputterTile->GetPos(), outputDir,
-                                   output.inputterTile->GetActivation());
-    affectedTiles.push_back(
+                                   active != output.inverted);
+    // The signal is built like the grid would queue it, so it can be handed
+    // to the merge node's group as is.
+    if (output.merge) {
+      mergeQueue.emplace_back(output.merge, signalEvent);
+      continue;
+    }
+    result.affectedTiles.push_back(
         TileStateChange{output.tile->GetPos(), output.tile->GetActivation()});
-    outputSignals.push_back(signalEvent);
+    result.newSignals.push_back(signalEvent);
+  }
+}
+
+std::vector<SignalEvent> TileGroupManager::SimulationGroup::Init() {
+  const bool active = inputTile->GetActivation();
+  for (const auto& tile : inbetweenTiles) tile->SetActivation(active);
+  for (const auto& tile : invertedTiles) tile->SetActivation(!active);
+
+  std::vector<SignalEvent> outputSignals;
+  for (const auto& output : outputTiles) {
+    if (active == output.inverted) continue;
+    outputSignals.emplace_back(
+        output.inputterTile->GetPos(),
+        DirectionFromVectors(output.inputterTile->GetPos(),
+                             output.tile->GetPos()),
+        true);
+  }
+  return outputSignals;
+}
+
+void TileGroupManager::SimulationGroup::LinkMergeNodes() {
+  for (auto& output : outputTiles) {
+    // Path tiles only end a path when they have several inputs, and those
+    // always start a group of their own unless they lead nowhere.
+    output.merge =
+        output.tile->IsDeterministic()
+            ? dynamic_cast<SimulationGroup*>(output.tile->GetCachedSimObject())
+            : nullptr;
   }
-  return TileGroupProcessResult{
-      std::move(outputSignals), std::move(affectedTiles)};
 }
 
 std::string TileGroupManager::SimulationGroup::GetObjectInfo() const {
@@ -51,9 +199,17 @@ std::string TileGroupManager::SimulationGroup::GetObjectInfo() const {
   for (const auto& tile : inbetweenTiles) {
     info += "    " + tile->GetTileInformation() + '\n';
   }
+  if (!invertedTiles.empty()) {
+    info += "  Inverted Tiles:\n";
+    for (const auto& tile : invertedTiles) {
+      info += "    " + tile->GetTileInformation() + '\n';
+    }
+  }
   info += "  Output Tiles:\n";
   for (const auto& output : outputTiles) {
-    info += "    " + output.tile->GetTileInformation() + '\n';
+    info += "    " + output.tile->GetTileInformation() +
+            (output.inverted ? " (inverted)" : "") +
+            (output.merge ? " (merge node)" : "") + '\n';
   }  // cut last newline
   if (!info.empty() && info.back() == '\n') {
     info.pop_back();
@@ -62,6 +218,23 @@ std::string TileGroupManager::SimulationGroup::GetObjectInfo() const {
 }
 
 // Helper functions for tile preprocessing
+TileGroupManager::ChannelEnd TileGroupManager::FollowChannel(
+    const std::shared_ptr<GridTile>& tile, Direction dir,
+    const TileMap& tiles) const {
+  ChannelEnd end{nullptr, tile, {}};
+  auto pos = TranslatePosition(tile->GetPos(), dir);
+  for (auto it = tiles.find(pos); it != tiles.end();
+       it = tiles.find(pos = TranslatePosition(pos, dir))) {
+    if (!it->second->IsPassThrough()) {
+      end.tile = it->second;
+      break;
+    }
+    end.inputterTile = it->second;
+    end.crossedTiles.push_back(it->second);
+  }
+  return end;
+}
+
 bool TileGroupManager::HasOutputConnection(
     const std::shared_ptr<GridTile>& tile, const TileMap& tiles) const {
   return std::ranges::any_of(AllDirections, [&](const Direction& dir) {
@@ -76,18 +249,19 @@ bool TileGroupManager::HasOutputConnection(
 bool TileGroupManager::HasDeterministicInputs(
     const std::shared_ptr<GridTile>& tile, const TileMap& tiles) const {
   return std::ranges::any_of(AllDirections, [&](const Direction& dir) {
-    auto neighborPos = TranslatePosition(tile->GetPos(), dir);
-    auto neighborIt = tiles.find(neighborPos);
-    if (neighborIt == tiles.end()) return false;
+    // A tile fed through crossings is fed by whatever feeds the crossings.
+    auto source = FollowChannel(tile, dir, tiles).tile;
+    if (!source) return false;
 
     // Only consider connections where neighbor can output to this tile
-    if (!neighborIt->second->CanOutputTo(FlipDirection(dir)) ||
+    if (!source->CanOutputTo(FlipDirection(dir)) ||
         !tile->CanReceiveFrom(dir)) {
       return false;
     }
 
-    // For start tile detection, only deterministic tiles matter
-    return neighborIt->second->IsDeterministic();
+    // For start tile detection, only tiles that are part of a path matter.
+    // Inverters always are, either folded in or as the input tile.
+    return source->IsDeterministic() || source->InvertsSignal();
   });
 }
 
@@ -107,9 +281,10 @@ bool TileGroupManager::IsValidStartTile(const std::shared_ptr<GridTile>& tile,
 }
 
 std::vector<std::shared_ptr<GridTile>> TileGroupManager::FindInitialStartTiles(
-    const TileMap& tiles) const {
+    const TileMap& tiles,
+    std::span<const std::shared_ptr<GridTile>> liveTiles) const {
   std::vector<std::shared_ptr<GridTile>> startTiles;
-  for (const auto& [pos, tile] : tiles) {
+  for (const auto& tile : liveTiles) {
     if (IsValidStartTile(tile, tiles)) {
       startTiles.push_back(tile);
     }
@@ -167,41 +342,50 @@ void TileGroupManager::QueueNeighborsAsStartTiles(
 }
 
 void TileGroupManager::ProcessDeterministicTileNeighbors(
-    const std::shared_ptr<GridTile>& current, const TileMap& tiles,
-    std::queue<std::shared_ptr<GridTile>>& pathQueue,
+    const std::shared_ptr<GridTile>& current, bool inverted, bool foldInverters,
+    const TileMap& tiles, std::queue<PathEntry>& pathQueue,
     std::vector<SimulationGroup::OutputTile>& outputTiles,
+    std::vector<std::shared_ptr<GridTile>>& crossedTiles,
     std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
     const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
         globalVisited) const {
   for (const auto& dir : AllDirections) {
     if (!current->CanOutputTo(dir)) continue;
 
-    auto neighborPos = TranslatePosition(current->GetPos(), dir);
-    auto neighborIt = tiles.find(neighborPos);
-    if (neighborIt == tiles.end()) continue;
+    // Crossings are passed straight through, so the path continues at the
+    // first tile past them, fed by the last one.
+    auto end = FollowChannel(current, dir, tiles);
+    crossedTiles.insert(crossedTiles.end(), end.crossedTiles.begin(),
+                        end.crossedTiles.end());
+    if (!end.tile) continue;
 
-    auto& neighbor = neighborIt->second;
+    auto& neighbor = end.tile;
+    auto& inputter = end.inputterTile;
     if (!neighbor->CanReceiveFrom(FlipDirection(dir))) continue;
 
     int inputCount = CountInputsToTile(neighbor, tiles);
 
     if (inputCount > 1) {
 // Multiple inputs - treat the tile pushing into it as an output tile and
-// push the new tile as a start tile
+// push the new tile as a start tile. Path tiles become merge nodes, which
+// LinkMergeNodes() ties back into this group.
       DebugPrint("TileGroupManager::ProcessDeterministicTileNeighbors: "
                 "Tile at {} has multiple inputs, treating as output "
                 "tile with inputter {}.",
-                neighbor->GetPos(), current->GetPos());
-      outputTiles.emplace_back(neighbor, current);
+                neighbor->GetPos(), inputter->GetPos());
+      outputTiles.emplace_back(neighbor, inputter, inverted);
       if (!globalVisited.contains(neighbor)) {
         pendingStartTiles.push(neighbor);
       }
     } else if (neighbor->IsDeterministic()) {
       // Single input deterministic tile - continue path
-      pathQueue.push(neighbor);
+      pathQueue.emplace(neighbor, inverted);
+    } else if (foldInverters && neighbor->InvertsSignal()) {
+      // Single input inverter - continue path with the opposite polarity
+      pathQueue.emplace(neighbor, !inverted);
     } else {
       // Single input non-deterministic tile - end path here
-      outputTiles.emplace_back(neighbor, current);
+      outputTiles.emplace_back(neighbor, inputter, inverted);
       if (!globalVisited.contains(neighbor)) {
         pendingStartTiles.push(neighbor);
       }
@@ -213,20 +397,31 @@ TileGroupManager::PathTraceResult TileGroupManager::TraceDeterministicPath(
     const std::shared_ptr<GridTile>& inputTile, const TileMap& tiles,
     std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
     const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
-        globalVisited) const {
+        globalVisited,
+    bool foldInverters) const {
   PathTraceResult result;
-  std::queue<std::shared_ptr<GridTile>> pathQueue;
-  pathQueue.push(inputTile);
+  // Only handed on once the trace is known to be kept
+  std::queue<std::shared_ptr<GridTile>> startTiles;
+  std::queue<PathEntry> pathQueue;
+  pathQueue.emplace(inputTile, false);
 
   while (!pathQueue.empty()) {
-    auto current = pathQueue.front();
+    auto [current, inverted] = pathQueue.front();
     pathQueue.pop();
 
-    if (result.pathVisited.contains(current)) continue;
+    // Path tiles have a single input, so only a loop leads back to one.
+    if (result.pathVisited.contains(current)) {
+      result.closesLoop = true;
+      continue;
+    }
     result.pathVisited.insert(current);
 
-    // If this is not a deterministic tile, handle it as a path endpoint
-    if (!current->IsDeterministic()) {
+    // If this is not a deterministic tile, handle it as a path endpoint.
+    // Inverters only get queued to be folded in, and an inverter input tile
+    // acts as a deterministic one, since the group simulates it for real.
+    const bool folded = current != inputTile && current->InvertsSignal();
+    result.foldedInverter = result.foldedInverter || folded;
+    if (!current->IsDeterministic() && !current->InvertsSignal()) {
       if (current != inputTile) {
         // This is an endpoint of our deterministic path
         auto inputterTile =
@@ -237,30 +432,125 @@ TileGroupManager::PathTraceResult TileGroupManager::TraceDeterministicPath(
       }
 
       // Queue up neighbors as potential new start tiles
-      QueueNeighborsAsStartTiles(current, tiles, pendingStartTiles,
-                                 globalVisited);
+      QueueNeighborsAsStartTiles(current, tiles, startTiles, globalVisited);
       continue;
     }
 
-    // This is a deterministic tile - add to path
+    // This is a deterministic or folded tile - add to path
     if (current != inputTile) {
-      result.pathTiles.push_back(current);
+      (inverted ? result.invertedTiles : result.pathTiles).push_back(current);
     }
 
     // Process neighbors
-    ProcessDeterministicTileNeighbors(current, tiles, pathQueue,
-                                      result.outputTiles, pendingStartTiles,
+    ProcessDeterministicTileNeighbors(current, inverted, foldInverters, tiles,
+                                      pathQueue, result.outputTiles,
+                                      result.crossedTiles, startTiles,
                                       globalVisited);
   }
 
+  // An inverter feeding back into its own path makes it oscillate or latch,
+  // which a group cannot follow, so the inverters stay objects of their own.
+  if (result.foldedInverter && result.closesLoop) {
+    return TraceDeterministicPath(inputTile, tiles, pendingStartTiles,
+                                  globalVisited, false);
+  }
+  for (; !startTiles.empty(); startTiles.pop()) {
+    pendingStartTiles.push(std::move(startTiles.front()));
+  }
+  return result;
+}
+
+// A trace only looks at the tiles it visits and their direct neighbours, and
+// it only pushes start tiles for its outputs. So replaying a cached trace
+// amounts to pushing those outputs the way the trace would have.
+TileGroupManager::PathTraceResult TileGroupManager::TraceCachedPath(
+    const std::shared_ptr<GridTile>& inputTile, const TileMap& tiles,
+    const PreprocessCache::ChunkKeys& chunkKeys,
+    std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
+    const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
+        globalVisited) {
+  // Logic input tiles do not trace anything worth caching, except for
+  // inverters, which trace like deterministic ones.
+  if (!inputTile->IsDeterministic() && !inputTile->InvertsSignal()) {
+    return TraceDeterministicPath(inputTile, tiles, pendingStartTiles,
+                                  globalVisited);
+  }
+  const vi2d chunkPos = AlignToChunk(inputTile->GetPos());
+  const auto key = chunkKeys.find(chunkPos)->second;
+
+  if (const auto trace = cache->Find(key, inputTile->GetPos() - chunkPos)) {
+    PathTraceResult result;
+    auto tileAt = [&tiles, &chunkPos](vi2d localPos) {
+      auto it = tiles.find(chunkPos + localPos);
+      return it != tiles.end() ? it->second : nullptr;
+    };
+    bool complete = true;
+    for (const auto& localPos : trace->pathTiles) {
+      auto tile = tileAt(localPos);
+      complete = complete && tile;
+      result.pathTiles.push_back(std::move(tile));
+    }
+    for (const auto& localPos : trace->invertedTiles) {
+      auto tile = tileAt(localPos);
+      complete = complete && tile;
+      result.invertedTiles.push_back(std::move(tile));
+    }
+    for (const auto& [tilePos, inputterPos, inverted] : trace->outputTiles) {
+      auto tile = tileAt(tilePos);
+      auto inputter = tileAt(inputterPos);
+      complete = complete && tile && inputter;
+      result.outputTiles.emplace_back(std::move(tile), std::move(inputter),
+                                      inverted);
+    }
+    // Only a damaged cache file can point at empty positions.
+    if (complete) {
+      for (const auto& output : result.outputTiles) {
+        if (!globalVisited.contains(output.tile)) {
+          pendingStartTiles.push(output.tile);
+        }
+      }
+      return result;
+    }
+  }
+
+  auto result = TraceDeterministicPath(inputTile, tiles, pendingStartTiles,
+                                       globalVisited);
+  auto inChunk = [&chunkPos](const std::shared_ptr<GridTile>& tile) {
+    return AlignToChunk(tile->GetPos()) == chunkPos;
+  };
+  // Crossings decide where the trace goes without being part of it, but
+  // they must still lie where the key covers the tiles past them.
+  if (std::ranges::all_of(result.pathTiles, inChunk) &&
+      std::ranges::all_of(result.invertedTiles, inChunk) &&
+      std::ranges::all_of(result.crossedTiles, inChunk) &&
+      std::ranges::all_of(result.outputTiles, inChunk,
+                          &SimulationGroup::OutputTile::tile)) {
+    PreprocessCache::Trace trace;
+    trace.pathTiles.reserve(result.pathTiles.size());
+    for (const auto& tile : result.pathTiles) {
+      trace.pathTiles.push_back(tile->GetPos() - chunkPos);
+    }
+    trace.invertedTiles.reserve(result.invertedTiles.size());
+    for (const auto& tile : result.invertedTiles) {
+      trace.invertedTiles.push_back(tile->GetPos() - chunkPos);
+    }
+    trace.outputTiles.reserve(result.outputTiles.size());
+    for (const auto& output : result.outputTiles) {
+      trace.outputTiles.push_back({output.tile->GetPos() - chunkPos,
+                                   output.inputterTile->GetPos() - chunkPos,
+                                   output.inverted});
+    }
+    cache->Add(key, inputTile->GetPos() - chunkPos, std::move(trace));
+  }
   return result;
 }
 
 void TileGroupManager::CreateSimulationObject(
     const std::shared_ptr<GridTile>& inputTile,
     std::vector<std::shared_ptr<GridTile>> pathTiles,
+    std::vector<std::shared_ptr<GridTile>> invertedTiles,
     std::vector<SimulationGroup::OutputTile> outputTiles) {
-  if (pathTiles.empty() && outputTiles.empty()) {
+  if (pathTiles.empty() && invertedTiles.empty() && outputTiles.empty()) {
     // Single tile with no deterministic path - create a SimulationTile
     auto [it, inserted] = simulationObjects.emplace(
         inputTile->GetPos(), std::make_unique<SimulationTile>(inputTile));
@@ -269,14 +559,21 @@ void TileGroupManager::CreateSimulationObject(
                inputTile->GetPos());
   } else {
     // Create simulation group
+    const auto groupId = static_cast<GroupId>(groups.size());
+    const bool hasInverted = !invertedTiles.empty();
     auto simGroup = std::make_unique<SimulationGroup>(
-        inputTile, std::move(pathTiles), std::move(outputTiles));
+        groupId, hasInverted ? groupId + 1 : groupId, inputTile,
+        std::move(pathTiles), std::move(invertedTiles),
+        std::move(outputTiles));
+    const auto* groupPtr = simGroup.get();
 
     auto [it, inserted] =
         simulationObjects.emplace(inputTile->GetPos(), std::move(simGroup));
 
     if (inserted) {
       inputTile->SetCachedSimObject(it->second.get());
+      groups.push_back(groupPtr);
+      if (hasInverted) groups.push_back(groupPtr);
     } else {
 #ifdef DEBUG
       std::cerr << "Warning: Tile Group starting at (" << inputTile->GetPos().x
@@ -289,10 +586,11 @@ void TileGroupManager::CreateSimulationObject(
 }
 
 void TileGroupManager::CoverRemainingTiles(
-    const TileMap& tiles,
+    std::span<const std::shared_ptr<GridTile>> liveTiles,
     ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
         globalVisited) {
-  for (const auto& [pos, tile] : tiles) {
+  for (const auto& tile : liveTiles) {
+    const auto pos = tile->GetPos();
     if (!globalVisited.contains(tile) && !simulationObjects.contains(pos)) {
       // This tile wasn't processed in any group - create a single tile
       // simulation object
@@ -304,17 +602,33 @@ void TileGroupManager::CoverRemainingTiles(
   }
 }
 
+void TileGroupManager::LinkMergeNodes() {
+  for (const auto& [pos, obj] : simulationObjects) {
+    if (auto* group = dynamic_cast<SimulationGroup*>(obj.get())) {
+      group->LinkMergeNodes();
+    }
+  }
+}
+
 // Main preprocessing function - now much cleaner and easier to follow
-void TileGroupManager::PreprocessTiles(const TileMap& tiles) {
+void TileGroupManager::PreprocessTiles(
+    const TileMap& tiles, std::span<const std::shared_ptr<GridTile>> liveTiles,
+    std::atomic<float>* progress) {
   // Clear() (called by whoever triggered this) freed the old SimulationObjects,
   // so every tile's cached pointer is dangling until we hand out fresh ones below.
   // So, just to be sure, let's zero them out. 
   for (const auto& [pos, tile] : tiles) {
     tile->SetCachedSimObject(nullptr);
   }
+  groups.clear();
+  ++groupRevision;
 
   // Find all potential start tiles
-  auto initialStartTiles = FindInitialStartTiles(tiles);
+  // Paths only lead on to tiles their input tile reaches, so starting from
+  // live tiles keeps every path live.
+  auto initialStartTiles = FindInitialStartTiles(tiles, liveTiles);
+  const auto chunkKeys =
+      cache ? PreprocessCache::KeyChunks(tiles) : PreprocessCache::ChunkKeys{};
   ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>
       globalVisited;
   std::queue<std::shared_ptr<GridTile>> pendingStartTiles;
@@ -336,22 +650,37 @@ void TileGroupManager::PreprocessTiles(const TileMap& tiles) {
     }
 
     // Trace the deterministic path from this start tile
-    auto pathResult = TraceDeterministicPath(inputTile, tiles,
-                                             pendingStartTiles, globalVisited);
+    auto pathResult =
+        cache ? TraceCachedPath(inputTile, tiles, chunkKeys,
+                                pendingStartTiles, globalVisited)
+              : TraceDeterministicPath(inputTile, tiles, pendingStartTiles,
+                                       globalVisited);
 
     // Mark all tiles in this path as visited
     globalVisited.insert(inputTile);
     for (auto& tile : pathResult.pathTiles) {
       globalVisited.insert(tile);
     }
+    for (auto& tile : pathResult.invertedTiles) {
+      globalVisited.insert(tile);
+    }
 
     // Create appropriate simulation object
     CreateSimulationObject(inputTile, std::move(pathResult.pathTiles),
+                           std::move(pathResult.invertedTiles),
                            std::move(pathResult.outputTiles));
+    if (progress) {
+      progress->store(static_cast<float>(globalVisited.size()) /
+                          static_cast<float>(liveTiles.size()),
+                      std::memory_order_relaxed);
+    }
   }
 
   // Ensure all remaining tiles are covered
-  CoverRemainingTiles(tiles, globalVisited);
+  CoverRemainingTiles(liveTiles, globalVisited);
+  LinkMergeNodes();
+  if (cache) cache->Flush();
+  if (progress) progress->store(1.f, std::memory_order_relaxed);
 
   for (const auto& [pos, obj] : simulationObjects) {
     DebugPrint("{}", obj->GetObjectInfo());
@@ -361,6 +690,185 @@ void TileGroupManager::PreprocessTiles(const TileMap& tiles) {
              simulationObjects.size());
 }
 
+void TileGroupManager::CopyFrom(const TileGroupManager& other,
+                                const TileMap& tiles) {
+  Clear();
+  // Objects of the old preprocessing are gone, as in PreprocessTiles().
+  for (const auto& [pos, tile] : tiles) tile->SetCachedSimObject(nullptr);
+  if (other.cache) cache = other.cache;
+  simulationObjects.reserve(other.simulationObjects.size());
+  groups.resize(other.groups.size(), nullptr);
+  // Past both, as the copied ids need not match ones handed out here before.
+  groupRevision = std::max(groupRevision, other.groupRevision) + 1;
+  for (const auto& [pos, obj] : other.simulationObjects) {
+    auto it = simulationObjects.emplace(pos, obj->CloneOnto(tiles)).first;
+    // Objects are keyed by their input tile, which is the one pointing back.
+    tiles.find(pos)->second->SetCachedSimObject(it->second.get());
+    if (const auto* group =
+            dynamic_cast<const SimulationGroup*>(it->second.get())) {
+      groups[group->GetId()] = group;
+      groups[group->GetInvertedId()] = group;
+    }
+  }
+  LinkMergeNodes();
+}
+
+void TileGroupManager::SaveTopology(std::vector<char>& out) const {
+  AppendRaw(out, static_cast<std::uint32_t>(simulationObjects.size()));
+  AppendRaw(out, static_cast<std::uint32_t>(groups.size()));
+  // The map keeps insertion order, so objects come back in the same order
+  // and with the same group ids.
+  for (const auto& [pos, obj] : simulationObjects) {
+    const auto* group = dynamic_cast<const SimulationGroup*>(obj.get());
+    AppendRaw(out, group ? TopologyKind::Group : TopologyKind::Tile);
+    AppendRaw(out, pos);
+    if (!group) continue;
+    const auto& inbetween = group->GetInbetweenTiles();
+    const auto& inverted = group->GetInvertedTiles();
+    const auto& outputs = group->GetOutputTiles();
+    AppendRaw(out, group->GetId());
+    AppendRaw(out, group->GetInvertedId());
+    AppendRaw(out, static_cast<std::uint32_t>(inbetween.size()));
+    AppendRaw(out, static_cast<std::uint32_t>(inverted.size()));
+    AppendRaw(out, static_cast<std::uint32_t>(outputs.size()));
+    for (const auto& tile : inbetween) AppendRaw(out, tile->GetPos());
+    for (const auto& tile : inverted) AppendRaw(out, tile->GetPos());
+    for (const auto& output : outputs) {
+      AppendRaw(out, output.tile->GetPos());
+      AppendRaw(out, output.inputterTile->GetPos());
+      AppendRaw(out, static_cast<std::uint8_t>(output.inverted));
+    }
+  }
+}
+
+bool TileGroupManager::LoadTopology(std::span<const char> data,
+                                    const TileMap& tiles) {
+  Clear();
+  for (const auto& [pos, tile] : tiles) tile->SetCachedSimObject(nullptr);
+  ++groupRevision;
+
+  auto fail = [this, &tiles] {
+    Clear();
+    for (const auto& [pos, tile] : tiles) tile->SetCachedSimObject(nullptr);
+    return false;
+  };
+  TopologyReader reader(data);
+  auto readTile = [&reader, &tiles](std::shared_ptr<GridTile>& tile) {
+    vi2d pos;
+    if (!reader.Read(pos)) return false;
+    auto it = tiles.find(pos);
+    if (it == tiles.end()) return false;
+    tile = it->second;
+    return true;
+  };
+
+  std::uint32_t objectCount = 0;
+  std::uint32_t groupCount = 0;
+  if (!reader.Read(objectCount) || !reader.Read(groupCount)) return fail();
+  // Counts come from a file, so never reserve more than the board can use.
+  // Every group has up to two ids.
+  if (objectCount > tiles.size() || groupCount > 2 * std::size_t{objectCount}) {
+    return fail();
+  }
+  simulationObjects.reserve(objectCount);
+  groups.assign(groupCount, nullptr);
+
+  for (std::uint32_t i = 0; i < objectCount; ++i) {
+    TopologyKind kind;
+    std::shared_ptr<GridTile> inputTile;
+    if (!reader.Read(kind) || !readTile(inputTile)) return fail();
+    if (simulationObjects.contains(inputTile->GetPos())) return fail();
+
+    std::unique_ptr<SimulationObject> obj;
+    if (kind == TopologyKind::Tile) {
+      obj = std::make_unique<SimulationTile>(inputTile);
+    } else if (kind == TopologyKind::Group) {
+      GroupId id = 0;
+      GroupId invertedId = 0;
+      std::uint32_t inbetweenCount = 0;
+      std::uint32_t invertedCount = 0;
+      std::uint32_t outputCount = 0;
+      if (!reader.Read(id) || !reader.Read(invertedId) ||
+          !reader.Read(inbetweenCount) || !reader.Read(invertedCount) ||
+          !reader.Read(outputCount)) {
+        return fail();
+      }
+      if (id >= groupCount || groups[id] || invertedId >= groupCount ||
+          (invertedId != id && groups[invertedId]) ||
+          inbetweenCount > tiles.size() || invertedCount > tiles.size() ||
+          outputCount > tiles.size()) {
+        return fail();
+      }
+      std::vector<std::shared_ptr<GridTile>> inbetween(inbetweenCount);
+      for (auto& tile : inbetween) {
+        if (!readTile(tile)) return fail();
+      }
+      std::vector<std::shared_ptr<GridTile>> inverted(invertedCount);
+      for (auto& tile : inverted) {
+        if (!readTile(tile)) return fail();
+      }
+      std::vector<SimulationGroup::OutputTile> outputs(outputCount);
+      for (auto& output : outputs) {
+        std::uint8_t outputInverted = 0;
+        if (!readTile(output.tile) || !readTile(output.inputterTile) ||
+            !reader.Read(outputInverted)) {
+          return fail();
+        }
+        output.inverted = outputInverted != 0;
+      }
+      auto group = std::make_unique<SimulationGroup>(
+          id, invertedId, inputTile, std::move(inbetween), std::move(inverted),
+          std::move(outputs));
+      groups[id] = group.get();
+      groups[invertedId] = group.get();
+      obj = std::move(group);
+    } else {
+      return fail();
+    }
+    auto it = simulationObjects.emplace(inputTile->GetPos(), std::move(obj))
+                  .first;
+    inputTile->SetCachedSimObject(it->second.get());
+  }
+
+  if (!reader.AtEnd() || std::ranges::find(groups, nullptr) != groups.end()) {
+    return fail();
+  }
+  LinkMergeNodes();
+  DebugPrint("Loaded preprocessed topology, total simulation objects: {}",
+             simulationObjects.size());
+  return true;
+}
+
+const std::vector<std::shared_ptr<GridTile>>& TileGroupManager::GetGroupTiles(
+    GroupId group) const noexcept {
+  static const std::vector<std::shared_ptr<GridTile>> noTiles;
+  if (group >= groups.size()) return noTiles;
+  return group == groups[group]->GetId() ? groups[group]->GetInbetweenTiles()
+                                         : groups[group]->GetInvertedTiles();
+}
+
+const GridTile* TileGroupManager::GetGroupInputTile(
+    GroupId group) const noexcept {
+  if (group >= groups.size()) return nullptr;
+  return groups[group]->GetInputTile().get();
+}
+
+// Tiles in a group have no object of their own, and an inverter is only
+// ever left without one by folding it in.
+bool TileGroupManager::IsFoldedIntoGroup(const GridTile& tile) const noexcept {
+  return tile.InvertsSignal() && !tile.GetCachedSimObject();
+}
+
+std::vector<SignalEvent> TileGroupManager::InitGroups() {
+  std::vector<SignalEvent> signals;
+  for (const auto& [pos, obj] : simulationObjects) {
+    auto* group = dynamic_cast<SimulationGroup*>(obj.get());
+    if (!group || group->GetInvertedTiles().empty()) continue;
+    std::ranges::move(group->Init(), std::back_inserter(signals));
+  }
+  return signals;
+}
+
 #endif  // SIM_PREPROCESSING
 
 }  // namespace ElecSim
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <queue>
+#include <span>
 #include <string>
 #include <vector>
 
 #include "GridTile.h"
+#include "PreprocessCache.h"
 #include "ankerl/unordered_dense.h"
 #include "v2d.h"
 
@@ -18,15 +21,25 @@ namespace ElecSim {
 struct TileGroupProcessResult {
   std::vector<SignalEvent> newSignals;  // New signals to be processed
   std::vector<TileStateChange> affectedTiles;  // Tiles that were affected by the signal
+  // Groups whose in-between tiles all changed at once. Those tiles are not
+  // listed in affectedTiles, see TileGroupManager::GetGroupTiles().
+  std::vector<GroupStateChange> affectedGroups;
 };
 
 class SimulationObject {
  public:
+  using TileMap = ankerl::unordered_dense::map<vi2d, std::shared_ptr<GridTile>,
+                                               PositionHash>;
+
   virtual ~SimulationObject() = default;
   // This function will be called when the simulation is running.
   // It should return a vector of new signal events to be processed.
   virtual TileGroupProcessResult ProcessSignal(const SignalEvent& signal) = 0;
   virtual std::string GetObjectInfo() const = 0;
+  // Builds the same object over the tiles at the same positions of another
+  // board, e.g. a forked copy of this one.
+  virtual std::unique_ptr<SimulationObject> CloneOnto(
+      const TileMap& tiles) const = 0;
 };
 
 class TileGroupManager {
@@ -47,31 +60,83 @@ class TileGroupManager {
       auto affectedTiles = std::vector<TileStateChange>{
           TileStateChange{tile->GetPos(), tile->GetActivation()}};
       return TileGroupProcessResult{std::move(newSignals),
-                                    std::move(affectedTiles)};
+                                    std::move(affectedTiles), {}};
     }
+    std::unique_ptr<SimulationObject> CloneOnto(
+        const TileMap& tiles) const final;
   };
 
   class SimulationGroup : public SimulationObject {
    public:
     struct OutputTile {
       std::shared_ptr<GridTile> tile;
+      // The tile right before it: a path tile, or the last crossing the
+      // path passed through to get there
       std::shared_ptr<GridTile> inputterTile;
+      // Whether it is fed the opposite of the input tile's activation
+      bool inverted = false;
+      // The group starting at the tile if it is a merge node, i.e. a path
+      // tile with several inputs. See LinkMergeNodes().
+      SimulationGroup* merge = nullptr;
     };
 
    private:
+    GroupId id;
+    // Only meaningful if there are inverted tiles
+    GroupId invertedId;
     std::shared_ptr<GridTile> inputTile;
     std::vector<std::shared_ptr<GridTile>> inbetweenTiles;
+    // In-between tiles behind an odd number of folded inverters, which
+    // always hold the opposite of the input tile's activation
+    std::vector<std::shared_ptr<GridTile>> invertedTiles;
     std::vector<OutputTile> outputTiles;
+    // Set while a dispatch that already evaluated the group is running
+    bool evaluated = false;
+
+    using MergeQueue = std::vector<std::pair<SimulationGroup*, SignalEvent>>;
+    // Evaluates the group alone, queueing the signals into merge nodes for
+    // ProcessSignal() rather than returning them.
+    void Evaluate(const SignalEvent& signal, bool merged,
+                  TileGroupProcessResult& result, MergeQueue& mergeQueue);
 
    public:
-    explicit SimulationGroup(std::shared_ptr<GridTile> input,
+    explicit SimulationGroup(GroupId groupId, GroupId invertedGroupId,
+                             std::shared_ptr<GridTile> input,
                              std::vector<std::shared_ptr<GridTile>> inbetween,
+                             std::vector<std::shared_ptr<GridTile>> inverted,
                              std::vector<OutputTile> output)
-        : inputTile(std::move(input)),
+        : id(groupId),
+          invertedId(invertedGroupId),
+          inputTile(std::move(input)),
           inbetweenTiles(std::move(inbetween)),
+          invertedTiles(std::move(inverted)),
           outputTiles(std::move(output)) {}
     std::string GetObjectInfo() const final;
     TileGroupProcessResult ProcessSignal(const SignalEvent& signal) final;
+    std::unique_ptr<SimulationObject> CloneOnto(
+        const TileMap& tiles) const final;
+    // Brings the in-between tiles in line with the input tile after a
+    // simulation reset and returns the signals of the outputs fed an active
+    // signal, the way the folded inverters' Init() would have.
+    std::vector<SignalEvent> Init();
+    // Points every output into a merge node at the group it starts.
+    void LinkMergeNodes();
+    GroupId GetId() const noexcept { return id; }
+    GroupId GetInvertedId() const noexcept { return invertedId; }
+    const std::shared_ptr<GridTile>& GetInputTile() const noexcept {
+      return inputTile;
+    }
+    const std::vector<OutputTile>& GetOutputTiles() const noexcept {
+      return outputTiles;
+    }
+    const std::vector<std::shared_ptr<GridTile>>& GetInbetweenTiles()
+        const noexcept {
+      return inbetweenTiles;
+    }
+    const std::vector<std::shared_ptr<GridTile>>& GetInvertedTiles()
+        const noexcept {
+      return invertedTiles;
+    }
   };
 
  private:
@@ -83,8 +148,26 @@ class TileGroupManager {
       ankerl::unordered_dense::map<vi2d, std::shared_ptr<SimulationObject>,
                                    PositionHash>;
   SimObjMap simulationObjects;
+  // Indexed by GroupId; owned by simulationObjects. A group with inverted
+  // tiles is listed under both of its ids.
+  std::vector<const SimulationGroup*> groups;
+  // Bumped by every preprocessing pass, as that invalidates all group ids.
+  std::uint32_t groupRevision = 0;
+  // Optional, shared with forks of the board. See SetCache().
+  std::shared_ptr<PreprocessCache> cache;
+
+  // Where a signal leaving a tile ends up once it passed straight through
+  // any crossings in its way.
+  struct ChannelEnd {
+    std::shared_ptr<GridTile> tile;  // nullptr if nothing is there
+    // The tile feeding it: the starting tile or the last crossing
+    std::shared_ptr<GridTile> inputterTile;
+    std::vector<std::shared_ptr<GridTile>> crossedTiles;
+  };
 
   // Helper functions for preprocessing
+  ChannelEnd FollowChannel(const std::shared_ptr<GridTile>& tile,
+                           Direction dir, const TileMap& tiles) const;
   bool HasOutputConnection(const std::shared_ptr<GridTile>& tile,
                            const TileMap& tiles) const;
   bool HasDeterministicInputs(const std::shared_ptr<GridTile>& tile,
@@ -92,7 +175,8 @@ class TileGroupManager {
   bool IsValidStartTile(const std::shared_ptr<GridTile>& tile,
                         const TileMap& tiles) const;
   std::vector<std::shared_ptr<GridTile>> FindInitialStartTiles(
-      const TileMap& tiles) const;
+      const TileMap& tiles,
+      std::span<const std::shared_ptr<GridTile>> liveTiles) const;
   int CountInputsToTile(const std::shared_ptr<GridTile>& neighbor,
                         const TileMap& tiles) const;
   std::shared_ptr<GridTile> FindInputterTile(
@@ -104,40 +188,160 @@ class TileGroupManager {
       std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
       const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
           globalVisited) const;
+  // A path tile along with whether it holds the opposite of the input tile's
+  // activation.
+  using PathEntry = std::pair<std::shared_ptr<GridTile>, bool>;
   void ProcessDeterministicTileNeighbors(
-      const std::shared_ptr<GridTile>& current, const TileMap& tiles,
-      std::queue<std::shared_ptr<GridTile>>& pathQueue,
+      const std::shared_ptr<GridTile>& current, bool inverted,
+      bool foldInverters, const TileMap& tiles,
+      std::queue<PathEntry>& pathQueue,
       std::vector<SimulationGroup::OutputTile>& outputTiles,
+      std::vector<std::shared_ptr<GridTile>>& crossedTiles,
       std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
       const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
           globalVisited) const;
 
   struct PathTraceResult {
     std::vector<std::shared_ptr<GridTile>> pathTiles;
+    std::vector<std::shared_ptr<GridTile>> invertedTiles;
     std::vector<SimulationGroup::OutputTile> outputTiles;
+    // Crossings the path went straight through. They keep their own state
+    // and belong to no group.
+    std::vector<std::shared_ptr<GridTile>> crossedTiles;
     ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>
         pathVisited;
+    bool foldedInverter = false;  // Whether any inverter was folded in
+    bool closesLoop = false;      // Whether the path runs back into itself
   };
 
+  // Traces the path from an input tile, folding single-input inverters into
+  // it unless told not to.
   PathTraceResult TraceDeterministicPath(
       const std::shared_ptr<GridTile>& inputTile, const TileMap& tiles,
       std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
       const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
-          globalVisited) const;
+          globalVisited,
+      bool foldInverters = true) const;
+  // Same as TraceDeterministicPath(), but replays the trace from the cache
+  // if it has one and caches traces that stay within their chunk.
+  PathTraceResult TraceCachedPath(
+      const std::shared_ptr<GridTile>& inputTile, const TileMap& tiles,
+      const PreprocessCache::ChunkKeys& chunkKeys,
+      std::queue<std::shared_ptr<GridTile>>& pendingStartTiles,
+      const ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
+          globalVisited);
   void CreateSimulationObject(
       const std::shared_ptr<GridTile>& inputTile,
       std::vector<std::shared_ptr<GridTile>> pathTiles,
+      std::vector<std::shared_ptr<GridTile>> invertedTiles,
       std::vector<SimulationGroup::OutputTile> outputTiles);
   void CoverRemainingTiles(
-      const TileMap& tiles,
+      std::span<const std::shared_ptr<GridTile>> liveTiles,
       ankerl::unordered_dense::segmented_set<std::shared_ptr<GridTile>>&
           globalVisited);
+  // Lets groups evaluate the merge nodes they feed in place. Run once all
+  // objects exist, as links point at other groups.
+  void LinkMergeNodes();
 
  public:
   TileGroupManager() = default;
-  void Clear() { simulationObjects.clear(); }
-  void PreprocessTiles(const TileMap& tiles);  // This will preprocess all tiles
-                                               // and create simulation objects.
+  void Clear() {
+    simulationObjects.clear();
+    groups.clear();
+  }
+  // This will preprocess the live tiles, i.e. the ones a signal source can
+  // reach, and create simulation objects. The others never change, so they
+  // get none. The fraction of live tiles covered so far is stored into
+  // progress, if given.
+  void PreprocessTiles(const TileMap& tiles,
+                       std::span<const std::shared_ptr<GridTile>> liveTiles,
+                       std::atomic<float>* progress = nullptr);
+
+  /**
+   * @brief Takes over another manager's preprocessing for a copy of its
+   * board, without tracing a single path. Group ids and the group revision
+   * stay the same, so ids handed out by the original remain valid. The
+   * other's preprocessing cache, if it has one, is shared.
+   * @param other The manager to copy
+   * @param tiles The copied board, holding a tile at every position the
+   * original's objects refer to
+   */
+  void CopyFrom(const TileGroupManager& other, const TileMap& tiles);
+
+  /**
+   * @brief Writes down which tiles every simulation object covers, by
+   * position, so a later load can skip preprocessing the same layout.
+   * @param out Receives the data
+   */
+  void SaveTopology(std::vector<char>& out) const;
+  /**
+   * @brief Rebuilds the simulation objects from SaveTopology() data instead
+   * of preprocessing. Counts as a preprocessing pass, so group ids handed
+   * out before are invalidated.
+   * @param data The saved topology
+   * @param tiles All tiles of the board, laid out like the saved one
+   * @return false if the data does not fit the board, in which case nothing
+   * is left preprocessed
+   */
+  bool LoadTopology(std::span<const char> data, const TileMap& tiles);
+
+  /**
+   * @brief Whether a tile was folded into a group as an inverter, and so
+   * is set up by InitGroups() rather than its own Init().
+   */
+  [[nodiscard]] bool IsFoldedIntoGroup(const GridTile& tile) const noexcept;
+  /**
+   * @brief Sets up the groups' inverted tiles after a simulation reset,
+   * standing in for the Init() of the inverters folded into them.
+   * @return The signals the groups send to their outputs
+   */
+  std::vector<SignalEvent> InitGroups();
+
+  /**
+   * @brief Has preprocessing reuse traces from, and add traces to, a cache
+   * shared across boards and runs.
+   * @param newCache The cache, or nullptr to always trace
+   */
+  void SetCache(std::shared_ptr<PreprocessCache> newCache) noexcept {
+    cache = std::move(newCache);
+  }
+  [[nodiscard]] const PreprocessCache* GetCache() const noexcept {
+    return cache.get();
+  }
+  /**
+   * @brief Uses the cache of another manager, e.g. the one of the grid a
+   * fork was made from.
+   * @param other The manager to share the cache of
+   */
+  void ShareCache(const TileGroupManager& other) noexcept {
+    cache = other.cache;
+  }
+
+  /**
+   * @brief Looks up the tiles a group sets all at once, i.e. the ones
+   * reported through TileGroupProcessResult::affectedGroups.
+   * @param group Id of the group
+   * @return The group's in-between tiles, empty for an unknown id
+   */
+  const std::vector<std::shared_ptr<GridTile>>& GetGroupTiles(
+      GroupId group) const noexcept;
+  /**
+   * @brief Looks up the tile a group takes its activation from.
+   * @param group Id of the group
+   * @return The group's input tile, which the tiles GetGroupTiles() lists
+   * follow, or nullptr for an unknown id. For an inverted id they hold the
+   * opposite of its activation.
+   */
+  [[nodiscard]] const GridTile* GetGroupInputTile(GroupId group) const noexcept;
+  [[nodiscard]] bool IsInvertedGroup(GroupId group) const noexcept {
+    return group < groups.size() && group != groups[group]->GetId();
+  }
+  [[nodiscard]] std::size_t GetGroupCount() const noexcept {
+    return groups.size();
+  }
+  [[nodiscard]] std::uint32_t GetGroupRevision() const noexcept {
+    return groupRevision;
+  }
   ~TileGroupManager() = default;
 };
 
@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <format>
 #include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -9,6 +17,8 @@ extern "C" {
 #include "hope.h"
 }
 #define OLC_PGE_APPLICATION
+#include "EditJournal.h"
+#include "EditLog.h"
 #include "Grid.h"
 
 const char* prog_desc = "Prober is a tool for simulating elecSim circuits.";
@@ -24,6 +34,45 @@ static hope_t initParser(const char* prog_name) {
   hope_add_param(&paramSet,
                  hope_init_param("-v", "Verbose mode: Print the log event",
                                  HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-p",
+                                 "Detect periodic board states and skip over "
+                                 "whole periods in multi-tick steps",
+                                 HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-m",
+                                 "Memoise how each 8x8 cell responds to "
+                                 "signals and replay cached responses",
+                                 HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-b",
+                                 "Defer preprocessing edited boards like the "
+                                 "game does: step them tile by tile until "
+                                 "the a command adopts a preprocessed fork",
+                                 HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-c",
+                                 "Directory to cache preprocessed paths in, "
+                                 "shared by all boards and runs using it",
+                                 HOPE_TYPE_STRING, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-e",
+                                 "Simulation engine to use: legacy, "
+                                 "preprocessed or compiled. compiled needs "
+                                 "-a, and only runs boards without feedback "
+                                 "loops",
+                                 HOPE_TYPE_STRING, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-a",
+                                 "Circuit library built from the grid by "
+                                 "circuit_compiler, for the compiled engine",
+                                 HOPE_TYPE_STRING, HOPE_ARGC_OPT));
+  hope_add_param(&paramSet,
+                 hope_init_param("-x",
+                                 "Cross-check against a second board run on "
+                                 "this engine, one tick at a time, and fail "
+                                 "on the first tile that differs",
+                                 HOPE_TYPE_STRING, HOPE_ARGC_OPT));
   hope_set_t helpSet = hope_init_set("Help");
   hope_add_param(&helpSet, hope_init_param("-h", "Show this help message",
                                            HOPE_TYPE_SWITCH, HOPE_ARGC_OPT));
@@ -38,19 +87,78 @@ static hope_t initParser(const char* prog_name) {
 // the write comes from)
 // Writing: w x y (1/0) s
 // Interacting: i x y
-// Stepping in the simulation: s
+// Stepping in the simulation: s [count]
+// (Idle ticks within a multi-tick step are skipped rather than simulated.)
 // Reading: r x y (1/0)
 // If the result of a read is not as expected, the test fails.
+// Checkpointing: c
+// (Saves the simulation state, reloads the board from scratch and resumes
+// from the checkpoint, like a restarted run would.)
+// Scenarios: { ... }
+// (The commands in between run on a fork of the board, which is thrown away
+// at the closing brace, so consecutive scenarios all start from the same
+// state. Scenarios can be nested.)
+// Editing, through an undo journal: p x y type facing, e x y
+// (type is the tile id grid files use, -1 in a tile check for no tile)
+// Undoing and redoing: u, y
+// Grouping edits into one undo entry: [ ... ]
+// Setting the journal's byte budget: b bytes
+// Checking the journal: h undoable redoable
+// Checking a tile's type: t x y type
+// Adopting the groups of a fork preprocessed meanwhile: a
+// (What the game does in the background once editing pauses. Only needed
+// with -b, otherwise resets preprocess right away.)
+// Resetting the simulation, without editing the board: z
+// Checking a counter of the board: = counter value
+// (preprocessed: preprocessing passes the board ran, pruned: tiles no signal
+// source reaches as of the last reset, replayed: edits the last crash
+// replayed from the edit log)
+// If a check fails, the test fails like a read does.
+// Autosaving edits to an edit log, from here on: l
+// Compacting the edit log: k
+// Crashing: x bytes
+// (Kills the edit log once it caught up, tears the given number of bytes off
+// the end of the log and restarts from the autosaved grid file and its logs,
+// like a run that crashed mid-write. The undo history is lost. Edit log
+// commands cannot be used in scenarios.)
 class TestParser {
  public:
-  enum class CommandType { Write, Interact, Step, Read, Comment };
+  enum class CommandType {
+    Write,
+    Interact,
+    Step,
+    Read,
+    Comment,
+    Checkpoint,
+    Fork,
+    Discard,
+    Place,
+    Erase,
+    Undo,
+    Redo,
+    BeginGroup,
+    EndGroup,
+    Budget,
+    History,
+    Type,
+    Counter,
+    Adopt,
+    OpenLog,
+    CompactLog,
+    Crash,
+    Reset
+  };
   struct Command {
     CommandType type;
     int x = 0;
     int y = 0;
-    int value = 0;  // For write/read: 1 or 0. For step: unused.
+    // For write/read: 1 or 0. For step: tick count. For place and type
+    // checks: tile id. For budgets: bytes. For history checks: redoable
+    // entries, with the undoable ones in x. For counters: the count. For
+    // crashes: bytes torn off the log.
+    int value = 0;
     ElecSim::Direction dir = ElecSim::Direction::Top;
-    std::string comment = "";
+    std::string comment = "";  // For counters: which one
   };
 
  private:
@@ -84,6 +192,42 @@ class TestParser {
         return "Read";
       case CommandType::Comment:
         return "Comment";
+      case CommandType::Checkpoint:
+        return "Checkpoint";
+      case CommandType::Fork:
+        return "Fork";
+      case CommandType::Discard:
+        return "Discard";
+      case CommandType::Place:
+        return "Place";
+      case CommandType::Erase:
+        return "Erase";
+      case CommandType::Undo:
+        return "Undo";
+      case CommandType::Redo:
+        return "Redo";
+      case CommandType::BeginGroup:
+        return "BeginGroup";
+      case CommandType::EndGroup:
+        return "EndGroup";
+      case CommandType::Budget:
+        return "Budget";
+      case CommandType::History:
+        return "History";
+      case CommandType::Type:
+        return "Type";
+      case CommandType::Counter:
+        return "Counter";
+      case CommandType::Adopt:
+        return "Adopt";
+      case CommandType::OpenLog:
+        return "OpenLog";
+      case CommandType::CompactLog:
+        return "CompactLog";
+      case CommandType::Crash:
+        return "Crash";
+      case CommandType::Reset:
+        return "Reset";
       default:
         return "Unknown";
     }
@@ -100,6 +244,8 @@ class TestParser {
       throw std::runtime_error("Could not open test file: " + testFile);
     std::string line;
     int lineNum = 0;
+    int scenarioDepth = 0;
+    bool logOpen = false;
     while (std::getline(file, line)) {
       lineNum++;
       std::istringstream iss(line);
@@ -132,7 +278,10 @@ class TestParser {
         commands.push_back({CommandType::Interact, x, y});
         continue;
       } else if (cmd == 's') {
-        commands.push_back({CommandType::Step});
+        int count = 1;
+        if (!ReadInt(iss, count)) count = 1;
+        if (count < 1) goto malformed_step;
+        commands.push_back({CommandType::Step, 0, 0, count});
         continue;
       } else if (cmd == 'r') {
         int x, y, v;
@@ -141,6 +290,107 @@ class TestParser {
         if (!ReadInt(iss, v)) goto malformed_read;
         commands.push_back({CommandType::Read, x, y, v});
         continue;
+      } else if (cmd == 'c') {
+        commands.push_back({CommandType::Checkpoint});
+        continue;
+      } else if (cmd == '{') {
+        ++scenarioDepth;
+        commands.push_back({CommandType::Fork});
+        continue;
+      } else if (cmd == '}') {
+        if (--scenarioDepth < 0) {
+          throw std::runtime_error(std::format(
+              "Scenario closed at line {} was never opened", lineNum));
+        }
+        commands.push_back({CommandType::Discard});
+        continue;
+      } else if (cmd == 'p') {
+        int x, y, type, facing;
+        if (!ReadInt(iss, x) || !ReadInt(iss, y) || !ReadInt(iss, type) ||
+            !ReadInt(iss, facing) || type < 0 ||
+            type >= static_cast<int>(ElecSim::GRIDTILE_COUNT) || facing < 0 ||
+            facing >= static_cast<int>(ElecSim::Direction::Count)) {
+          goto malformed_edit;
+        }
+        commands.push_back({CommandType::Place, x, y, type,
+                            static_cast<ElecSim::Direction>(facing)});
+        continue;
+      } else if (cmd == 'e') {
+        int x, y;
+        if (!ReadInt(iss, x) || !ReadInt(iss, y)) goto malformed_edit;
+        commands.push_back({CommandType::Erase, x, y});
+        continue;
+      } else if (cmd == 'u') {
+        commands.push_back({CommandType::Undo});
+        continue;
+      } else if (cmd == 'y') {
+        commands.push_back({CommandType::Redo});
+        continue;
+      } else if (cmd == '[') {
+        commands.push_back({CommandType::BeginGroup});
+        continue;
+      } else if (cmd == ']') {
+        commands.push_back({CommandType::EndGroup});
+        continue;
+      } else if (cmd == 'b') {
+        int bytes;
+        if (!ReadInt(iss, bytes) || bytes < 0) goto malformed_check;
+        commands.push_back({CommandType::Budget, 0, 0, bytes});
+        continue;
+      } else if (cmd == 'h') {
+        int undoable, redoable;
+        if (!ReadInt(iss, undoable) || !ReadInt(iss, redoable)) {
+          goto malformed_check;
+        }
+        commands.push_back({CommandType::History, undoable, 0, redoable});
+        continue;
+      } else if (cmd == 't') {
+        int x, y, type;
+        if (!ReadInt(iss, x) || !ReadInt(iss, y) || !ReadInt(iss, type)) {
+          goto malformed_check;
+        }
+        commands.push_back({CommandType::Type, x, y, type});
+        continue;
+      } else if (cmd == 'a') {
+        commands.push_back({CommandType::Adopt});
+        continue;
+      } else if (cmd == 'z') {
+        commands.push_back({CommandType::Reset});
+        continue;
+      } else if (cmd == '=') {
+        std::string counter;
+        int expected;
+        iss >> counter;
+        if (!ReadInt(iss, expected) || expected < 0) goto malformed_check;
+        if (counter != "preprocessed" && counter != "pruned" &&
+            counter != "replayed") {
+          throw std::runtime_error(std::format(
+              "Unknown counter '{}' at line {}", counter, lineNum));
+        }
+        commands.push_back({CommandType::Counter, 0, 0, expected,
+                            ElecSim::Direction::Top, counter});
+        continue;
+      } else if (cmd == 'l' || cmd == 'k' || cmd == 'x') {
+        if (scenarioDepth > 0) {
+          throw std::runtime_error(std::format(
+              "Edit log command at line {} is inside a scenario", lineNum));
+        }
+        if (cmd != 'l' && !logOpen) {
+          throw std::runtime_error(std::format(
+              "Edit log command at line {} before the log was opened",
+              lineNum));
+        }
+        if (cmd == 'l') {
+          logOpen = true;
+          commands.push_back({CommandType::OpenLog});
+        } else if (cmd == 'k') {
+          commands.push_back({CommandType::CompactLog});
+        } else {
+          int bytes;
+          if (!ReadInt(iss, bytes) || bytes < 0) goto malformed_edit;
+          commands.push_back({CommandType::Crash, 0, 0, bytes});
+        }
+        continue;
       }
     // unknown_read:
     //   throw std::runtime_error(std::format("Unknown command '{}' at line {}",
@@ -154,6 +404,20 @@ class TestParser {
     malformed_read:
       throw std::runtime_error(
           std::format("Malformed read command at line {}", lineNum));
+    malformed_step:
+      throw std::runtime_error(
+          std::format("Malformed step command at line {}", lineNum));
+    malformed_edit:
+      throw std::runtime_error(
+          std::format("Malformed edit command at line {}", lineNum));
+    malformed_check:
+      throw std::runtime_error(
+          std::format("Malformed check command at line {}", lineNum));
+    }
+    if (scenarioDepth > 0) {
+      throw std::runtime_error(std::format(
+          "{} scenario(s) left open at the end of {}", scenarioDepth,
+          testFile));
     }
   }
   const std::vector<Command>& GetCommands() const { return commands; }
@@ -171,42 +435,204 @@ int main([[maybe_unused]] int argc, char** argv) {
   std::string gridFile = hope_get_single_string(&hope, "-f");
   std::string testFile = hope_get_single_string(&hope, "-t");
   bool verbose = hope_get_single_switch(&hope, "-v");
+  bool detectPeriods = hope_get_single_switch(&hope, "-p");
+  bool memoiseChunks = hope_get_single_switch(&hope, "-m");
+  bool deferPreprocessing = hope_get_single_switch(&hope, "-b");
+  const char* cacheArg = hope_get_single_string(&hope, "-c");
+  std::string cacheDirectory = cacheArg ? cacheArg : "";
+  const char* engineArg = hope_get_single_string(&hope, "-e");
+  const char* crossCheckArg = hope_get_single_string(&hope, "-x");
+  const char* circuitArg = hope_get_single_string(&hope, "-a");
+  std::string engineName = engineArg ? engineArg : "";
+  std::string crossCheckName = crossCheckArg ? crossCheckArg : "";
+  std::string circuitFile = circuitArg ? circuitArg : "";
   hope_free(&hope);
 
-  auto grid = ElecSim::Grid();
-  grid.Load(gridFile);
-  grid.Simulate();
+  auto parseEngine = [](const std::string& name)
+      -> std::optional<ElecSim::SimulationEngine> {
+    auto engine = ElecSim::ParseEngine(name);
+    if (!engine || !ElecSim::IsEngineAvailable(*engine)) {
+      std::cerr << std::format("Unknown or unavailable engine: {}", name)
+                << std::endl;
+    }
+    return engine;
+  };
+  auto engine = ElecSim::DEFAULT_ENGINE;
+  if (!engineName.empty()) {
+    auto parsed = parseEngine(engineName);
+    if (!parsed) return 1;
+    engine = *parsed;
+  }
+  std::optional<ElecSim::SimulationEngine> crossCheckEngine;
+  if (!crossCheckName.empty()) {
+    crossCheckEngine = parseEngine(crossCheckName);
+    if (!crossCheckEngine) return 1;
+  }
+  std::shared_ptr<const ElecSim::CompiledCircuit> circuit;
+  if (!circuitFile.empty()) {
+    try {
+      circuit = ElecSim::CompiledCircuit::Load(circuitFile);
+    } catch (const std::runtime_error& error) {
+      std::cerr << error.what() << std::endl;
+      return 1;
+    }
+  } else if (engine == ElecSim::SimulationEngine::Compiled ||
+             crossCheckEngine == ElecSim::SimulationEngine::Compiled) {
+    std::cerr << "The compiled engine needs a circuit library, see -a"
+              << std::endl;
+    return 1;
+  }
+
+  auto loadBoard = [&](const std::string& filename) {
+    auto board = std::make_unique<ElecSim::Grid>();
+    board->SetEngine(engine);
+    board->SetCompiledCircuit(circuit);
+    board->SetPeriodDetection(detectPeriods);
+    board->SetDeferredPreprocessing(deferPreprocessing);
+    board->SetChunkMemoisation(memoiseChunks);
+    board->SetPreprocessCache(cacheDirectory);
+    board->Load(filename);
+    return board;
+  };
+  // The reference board runs plainly on its engine, without any of the
+  // shortcuts the options above turn on.
+  auto loadReference = [&](const std::string& filename) {
+    auto board = std::make_unique<ElecSim::Grid>();
+    board->SetEngine(*crossCheckEngine);
+    board->SetCompiledCircuit(circuit);
+    board->Load(filename);
+    return board;
+  };
+
+  // The loaded board comes first, followed by a fork for every scenario
+  // currently open, each with the undo journal of its edits. When
+  // cross-checking, references mirrors boards.
+  std::vector<std::unique_ptr<ElecSim::Grid>> boards;
+  std::vector<ElecSim::EditJournal> journals(1);
+  std::vector<std::unique_ptr<ElecSim::Grid>> references;
+  boards.push_back(loadBoard(gridFile));
+  boards.front()->Simulate();
+  if (crossCheckEngine) {
+    references.push_back(loadReference(gridFile));
+    references.front()->Simulate();
+  }
+
+  // Reports the first tile the boards disagree on, if any.
+  auto diverged = [&]() {
+    if (!crossCheckEngine) return false;
+    auto& grid = *boards.back();
+    auto& reference = *references.back();
+    const auto pos = grid.FindDivergence(reference);
+    if (!pos) return false;
+    auto describe = [&pos](ElecSim::Grid& board) -> std::string {
+      const auto tile = board.GetTile(*pos);
+      if (!tile) return "None";
+      const auto state = (*tile)->GetState();
+      return std::format("{}, state bits {:#x}, extra {}",
+                         (*tile)->GetActivation() ? "active" : "inactive",
+                         state.bits, state.extra);
+    };
+    std::cout << std::format(
+                     "Engines diverged at tick {}, tile at {}:\n  {}: {}\n"
+                     "  {}: {}",
+                     grid.GetCurrentTick(), *pos,
+                     ElecSim::EngineToString(grid.GetEngine()),
+                     describe(grid),
+                     ElecSim::EngineToString(reference.GetEngine()),
+                     describe(reference))
+              << std::endl;
+    return true;
+  };
+  if (diverged()) return 1;
+
+  // The grid file the edit log autosaves to, removed with its logs on exit.
+  struct LogFiles {
+    std::filesystem::path grid;
+    ~LogFiles() {
+      if (grid.empty()) return;
+      ElecSim::EditLog::Discard(grid.string());
+      std::error_code error;
+      std::filesystem::remove(grid, error);
+      std::filesystem::remove(grid.string() + ".tmp", error);
+    }
+  } logFiles;
+  std::unique_ptr<ElecSim::EditLog> editLog;
+  std::size_t replayedEdits = 0;  // By the last crash
 
   auto testParser = TestParser();
   testParser.Parse(testFile);
   auto commands = testParser.GetCommands();
 
+  // Writes and interactions go to the reference board as well.
+  auto applyInput = [](ElecSim::Grid& grid,
+                       const TestParser::Command& command) {
+    auto tileMaybe = grid.GetTile(command.x, command.y);
+    if (!tileMaybe.has_value()) return;
+    auto tile = tileMaybe.value();
+    if (command.type == TestParser::CommandType::Interact) {
+      grid.InteractWithTile(ElecSim::vi2d(command.x, command.y));
+    } else if (command.value == 1) {
+      // Queue an update
+      tile->SetActivation(command.value);
+      grid.QueueUpdate(tile, ElecSim::SignalEvent(tile->GetPos(), command.dir,
+                                                  command.value));
+    }
+  };
+
+  // Tiles as grid files store them.
+  auto makeTile = [](const TestParser::Command& command) {
+    std::array<char, ElecSim::GRIDTILE_BYTESIZE> record{};
+    const int fields[] = {command.value, static_cast<int>(command.dir),
+                          command.x, command.y};
+    static_assert(sizeof(fields) == ElecSim::GRIDTILE_BYTESIZE);
+    std::memcpy(record.data(), fields, sizeof(fields));
+    return std::shared_ptr<ElecSim::GridTile>(
+        ElecSim::GridTile::Deserialize(record));
+  };
+  // The reference board takes the edits straight, without a journal, and
+  // the edit log as the game would.
+  auto recordEdit = [&](const ElecSim::EditJournal::Change& change) {
+    if (editLog) editLog->Append(change.erased, change.placed);
+    if (!crossCheckEngine) return;
+    auto& reference = *references.back();
+    reference.EraseTiles(change.erased);
+    std::vector<std::shared_ptr<ElecSim::GridTile>> placed;
+    for (const auto& tile : change.placed) placed.push_back(tile->Clone());
+    reference.SetTiles(placed);
+  };
+  auto check = [](std::string_view what, auto expected, auto actual) {
+    std::cout << std::format("{}:\n  Expected: {}\n  Actual: {}", what,
+                             expected, actual);
+    if (expected != actual) {
+      std::cout << " (Test failed)" << std::endl;
+      return false;
+    }
+    std::cout << std::endl;
+    return true;
+  };
+
   for (auto& command : commands) {
+    auto& grid = *boards.back();
+    auto& journal = journals.back();
     auto tileMaybe = grid.GetTile(command.x, command.y);
     switch (command.type) {
       case TestParser::CommandType::Write:
-        if (tileMaybe.has_value()) {
-          auto tile = tileMaybe.value();
-          if (command.value == 1) {
-            // Queue an update
-            tile->SetActivation(command.value);
-            grid.QueueUpdate(tile,
-                             ElecSim::SignalEvent(tile->GetPos(), command.dir,
-                                                  command.value));
-          }
-        }
-        break;
       case TestParser::CommandType::Interact:
-        if (tileMaybe.has_value()) {
-          auto tile = tileMaybe.value();
-          auto signals = tile->Interact();
-          for (const auto& signal : signals) {
-            grid.QueueUpdate(tile, signal);
-          }
-        }
+        applyInput(grid, command);
+        if (crossCheckEngine) applyInput(*references.back(), command);
         break;
       case TestParser::CommandType::Step:
-        grid.Simulate();
+        if (!crossCheckEngine) {
+          grid.SimulateUntil(grid.GetCurrentTick() + command.value);
+          break;
+        }
+        // In lockstep, so the divergence is caught on the tick it happens.
+        for (int i = 0; i < command.value; ++i) {
+          grid.SimulateUntil(grid.GetCurrentTick() + 1);
+          references.back()->SimulateUntil(
+              references.back()->GetCurrentTick() + 1);
+          if (diverged()) return 1;
+        }
         break;
       case TestParser::CommandType::Read:
         std::cout << std::format("Tile at {}:\n  Expected: {}\n  Actual: ",
@@ -227,6 +653,159 @@ int main([[maybe_unused]] int argc, char** argv) {
       case TestParser::CommandType::Comment:
         if (verbose) std::cout << command.comment << std::endl;
         break;
+      case TestParser::CommandType::Checkpoint: {
+        const auto statePath =
+            std::filesystem::temp_directory_path() /
+            std::format("prober-{:08x}.state", std::random_device{}());
+        grid.SaveState(statePath.string());
+        auto resumed = loadBoard(gridFile);
+        const bool restored = resumed->LoadState(statePath.string());
+        std::filesystem::remove(statePath);
+        if (!restored) {
+          std::cerr << "Could not resume from checkpoint, aborting"
+                    << std::endl;
+          return 1;
+        }
+        boards.back() = std::move(resumed);
+        // The reference carries on as it is, so a checkpoint that does not
+        // restore exactly shows up as a divergence.
+        if (diverged()) return 1;
+        break;
+      }
+      case TestParser::CommandType::Fork:
+        boards.push_back(grid.Fork());
+        journals.push_back(journal);
+        if (crossCheckEngine) references.push_back(references.back()->Fork());
+        break;
+      case TestParser::CommandType::Discard:
+        boards.pop_back();
+        journals.pop_back();
+        if (crossCheckEngine) references.pop_back();
+        break;
+      case TestParser::CommandType::Place: {
+        const auto tile = makeTile(command);
+        journal.SetTiles(grid, std::array{tile});
+        recordEdit({{}, {tile}});
+        break;
+      }
+      case TestParser::CommandType::Erase: {
+        const ElecSim::vi2d pos(command.x, command.y);
+        journal.EraseTiles(grid, std::array{pos});
+        recordEdit({{pos}, {}});
+        break;
+      }
+      case TestParser::CommandType::Undo:
+      case TestParser::CommandType::Redo: {
+        const auto change = command.type == TestParser::CommandType::Undo
+                                ? journal.Undo(grid)
+                                : journal.Redo(grid);
+        if (change) recordEdit(*change);
+        break;
+      }
+      case TestParser::CommandType::BeginGroup:
+        journal.BeginGroup();
+        break;
+      case TestParser::CommandType::EndGroup:
+        journal.EndGroup();
+        break;
+      case TestParser::CommandType::Budget:
+        journal.SetByteBudget(static_cast<std::size_t>(command.value));
+        break;
+      case TestParser::CommandType::History:
+        if (!check("Undoable edits", std::size_t(command.x),
+                   journal.GetUndoCount()) ||
+            !check("Redoable edits", std::size_t(command.value),
+                   journal.GetRedoCount())) {
+          return 1;
+        }
+        break;
+      case TestParser::CommandType::Type: {
+        auto describe = [](int type) -> std::string {
+          if (type < 0) return "None";
+          return std::string(ElecSim::TileTypeToString(
+              static_cast<ElecSim::TileType>(type)));
+        };
+        const int actual =
+            tileMaybe ? static_cast<int>((*tileMaybe)->GetTileType()) : -1;
+        if (!check(std::format("Tile type at {}",
+                               ElecSim::vi2d(command.x, command.y)),
+                   describe(command.value), describe(actual))) {
+          return 1;
+        }
+        break;
+      }
+      case TestParser::CommandType::Counter: {
+        const std::size_t actual =
+            command.comment == "pruned"     ? grid.GetPrunedTileCount()
+            : command.comment == "replayed" ? replayedEdits
+                                            : grid.GetPreprocessingPasses();
+        if (!check(std::format("Counter {}", command.comment),
+                   std::size_t(command.value), actual)) {
+          return 1;
+        }
+        break;
+      }
+      case TestParser::CommandType::Adopt: {
+        auto fork = grid.Fork();
+        fork->Preprocess();
+        const bool adopted = grid.AdoptPreprocessing(*fork);
+        if (verbose) {
+          std::cout << (adopted ? "Adopted the fork's preprocessing"
+                                : "Nothing to adopt from the fork")
+                    << std::endl;
+        }
+        break;
+      }
+      case TestParser::CommandType::Reset:
+        grid.ResetSimulation();
+        if (crossCheckEngine) references.back()->ResetSimulation();
+        break;
+      case TestParser::CommandType::OpenLog:
+        editLog.reset();
+        if (logFiles.grid.empty()) {
+          logFiles.grid =
+              std::filesystem::temp_directory_path() /
+              std::format("prober-{:08x}.grid", std::random_device{}());
+        }
+        grid.Save(logFiles.grid.string());
+        ElecSim::EditLog::Discard(logFiles.grid.string());
+        editLog = std::make_unique<ElecSim::EditLog>(logFiles.grid.string(),
+                                                     grid);
+        break;
+      case TestParser::CommandType::CompactLog:
+        editLog->Compact();
+        break;
+      case TestParser::CommandType::Crash: {
+        const auto filename = logFiles.grid.string();
+        editLog->Flush();
+        editLog.reset();
+        const auto logPath = filename + ".log";
+        std::error_code error;
+        const auto size = std::filesystem::file_size(logPath, error);
+        if (!error) {
+          std::filesystem::resize_file(
+              logPath,
+              size - std::min<std::uintmax_t>(size, command.value), error);
+        }
+        auto restarted = loadBoard(filename);
+        replayedEdits = ElecSim::EditLog::Replay(*restarted, filename);
+        if (verbose) {
+          std::cout << std::format("Replayed {} edits", replayedEdits)
+                    << std::endl;
+        }
+        restarted->Simulate();
+        // The reference restarts too, from what survived the crash.
+        if (crossCheckEngine) {
+          references.back() = loadReference(filename);
+          ElecSim::EditLog::Replay(*references.back(), filename);
+          references.back()->Simulate();
+        }
+        editLog = std::make_unique<ElecSim::EditLog>(filename, *restarted);
+        boards.back() = std::move(restarted);
+        journal = ElecSim::EditJournal();
+        if (diverged()) return 1;
+        break;
+      }
       default:
         std::cerr << "Unknown command type: "
                   << testParser.GetCommandTypeString(command.type)
@@ -235,6 +814,29 @@ int main([[maybe_unused]] int argc, char** argv) {
         return 1;
     }
   }
+  if (verbose && memoiseChunks) {
+    const auto& memo = boards.front()->GetChunkMemo();
+    std::cout << std::format("Chunk memo: {} hits, {} misses, {} cached",
+                             memo.GetHits(), memo.GetMisses(),
+                             memo.GetCacheSize())
+              << std::endl;
+  }
+  if (verbose && !cacheDirectory.empty()) {
+    const auto [hits, misses] = boards.front()->GetPreprocessCacheStats();
+    std::cout << std::format("Preprocess cache: {} hits, {} misses", hits,
+                             misses)
+              << std::endl;
+  }
+  if (verbose) {
+    const auto& board = *boards.front();
+    std::cout << std::format("Pruned {} of {} tiles no signal source reaches",
+                             board.GetPrunedTileCount(),
+                             board.GetTiles().size())
+              << std::endl;
+    std::cout << std::format("Preprocessing passes: {}",
+                             board.GetPreprocessingPasses())
+              << std::endl;
+  }
   std::cout << "Test completed successfully." << std::endl;
   return 0;
 }
\ No newline at end of file